@@ -0,0 +1,194 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include "rbtree.h"
+
+/*
+ * A tree with a hash index next to it. Exact key lookups go through an open
+ * addressing table, which costs about one cache miss instead of one per level,
+ * while ordered operations (min/max, lt/gt, bounds, next/prev and the
+ * traversals) use the rbt_base_* functions on `m_tree` directly. Elements must
+ * only be added and removed through the rbht_base_* functions so that the two
+ * stay in sync.
+ *
+ * The caller supplies a hash for keys and one for elements, which must agree
+ * for an element and its key, much like the two comparators.
+ */
+
+typedef struct red_black_hash_slot rbhs_t;
+struct red_black_hash_slot {
+    size_t hash;
+    rbn_t *node;    // NULL for an empty slot
+};
+
+typedef struct red_black_hash_tree rbht_t;
+struct red_black_hash_tree {
+    rbt_t m_tree;
+    rbhs_t *m_slots;
+    size_t m_mask;  // number of slots - 1, or 0 before the first add
+};
+
+#define RBHT_MIN_SLOTS 16
+
+static inline void
+rbht_init(rbht_t *const h)
+{
+    rbt_init(&h->m_tree);
+    h->m_slots = NULL;
+    h->m_mask = 0;
+}
+
+// Free the index. The elements belong to the caller.
+static inline void
+rbht_destroy(rbht_t *const h)
+{
+    free(h->m_slots);
+    rbht_init(h);
+}
+
+static inline void
+rbht_place(rbhs_t *const slots, size_t const mask, size_t const hash, rbn_t *const node)
+{
+    size_t i = hash & mask;
+    while (slots[i].node != NULL)
+        i = (i + 1) & mask;
+    slots[i].hash = hash;
+    slots[i].node = node;
+}
+
+// Make room for one more element, keeping the table at most half full.
+// Returns 0 on success, or -1 if the table can't be grown.
+static inline int
+rbht_reserve(rbht_t *const h)
+{
+    size_t const nslots = (h->m_slots == NULL) ? 0 : h->m_mask + 1;
+    if (2 * (h->m_tree.m_size + 1) <= nslots)
+        return 0;
+
+    size_t const n = (nslots == 0) ? RBHT_MIN_SLOTS : 2 * nslots;
+    rbhs_t *const slots = calloc(n, sizeof(*slots));
+    if (slots == NULL)
+        return -1;
+
+    for (size_t i = 0; i < nslots; ++i) {
+        if (h->m_slots[i].node != NULL)
+            rbht_place(slots, n - 1, h->m_slots[i].hash, h->m_slots[i].node);
+    }
+    free(h->m_slots);
+    h->m_slots = slots;
+    h->m_mask = n - 1;
+
+    return 0;
+}
+
+// Empty slot i, shifting back any entry of the probe run behind it that would
+// otherwise no longer be found
+static inline void
+rbht_vacate(rbht_t *const h, size_t i)
+{
+    rbhs_t *const slots = h->m_slots;
+    size_t const mask = h->m_mask;
+    for (size_t j = (i + 1) & mask; slots[j].node != NULL; j = (j + 1) & mask) {
+        size_t const home = slots[j].hash & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            slots[i] = slots[j];
+            i = j;
+        }
+    }
+    slots[i].node = NULL;
+}
+
+/*
+ * Add an element to both indexes. Returns z, the element already present with
+ * an equal key, or NULL if the hash table couldn't be grown, in which case
+ * nothing changes.
+ */
+static inline rbn_t *
+rbht_base_add(rbht_t *const h, rbn_t *const z, rbtcmp_t const cmpfunc, rbthash_t const hashfunc)
+{
+    if (rbht_reserve(h) != 0)
+        return NULL;
+
+    // z may be the element that is already there
+    size_t const size = h->m_tree.m_size;
+    rbn_t *const x = rbt_base_add(&h->m_tree, z, cmpfunc);
+    if (h->m_tree.m_size != size)
+        rbht_place(h->m_slots, h->m_mask, hashfunc(z), z);
+
+    return x;
+}
+
+// Returns the slot holding the element with the key, or SIZE_MAX
+__attribute__((pure))
+static inline size_t
+rbht_find_slot(rbht_t const*const h, void const*const key, size_t const hash,
+               rbtkeycmp_t const cmpfunc)
+{
+    if (h->m_slots == NULL)
+        return SIZE_MAX;
+
+    for (size_t i = hash & h->m_mask; h->m_slots[i].node != NULL; i = (i + 1) & h->m_mask) {
+        if ((h->m_slots[i].hash == hash) && (cmpfunc(key, h->m_slots[i].node) == 0))
+            return i;
+    }
+
+    return SIZE_MAX;
+}
+
+__attribute__((pure))
+static inline rbn_t *
+rbht_base_get(rbht_t const*const h, void const*const key, rbtkeyhash_t const hashfunc,
+              rbtkeycmp_t const cmpfunc)
+{
+    size_t const i = rbht_find_slot(h, key, hashfunc(key), cmpfunc);
+
+    return (i == SIZE_MAX) ? NULL : h->m_slots[i].node;
+}
+
+static inline rbn_t *
+rbht_base_rem(rbht_t *const h, void const*const key, rbtkeyhash_t const hashfunc,
+              rbtkeycmp_t const cmpfunc)
+{
+    size_t const i = rbht_find_slot(h, key, hashfunc(key), cmpfunc);
+    if (i == SIZE_MAX)
+        return NULL;
+
+    rbn_t *const x = h->m_slots[i].node;
+    rbht_vacate(h, i);
+    rb_base_delete(&h->m_tree, x);
+
+    return x;
+}
+
+// Remove an element that is in the container, found through either index
+static inline void
+rbht_base_delete(rbht_t *const h, rbn_t *const z, rbthash_t const hashfunc)
+{
+    size_t i = hashfunc(z) & h->m_mask;
+    while (h->m_slots[i].node != z)
+        i = (i + 1) & h->m_mask;
+
+    rbht_vacate(h, i);
+    rb_base_delete(&h->m_tree, z);
+}
+
+static inline rbn_t *
+rbht_base_popmin(rbht_t *const h, rbthash_t const hashfunc)
+{
+    rbn_t *const x = rbt_base_min(&h->m_tree);
+    if (x != NULL)
+        rbht_base_delete(h, x, hashfunc);
+
+    return x;
+}
+
+static inline rbn_t *
+rbht_base_popmax(rbht_t *const h, rbthash_t const hashfunc)
+{
+    rbn_t *const x = rbt_base_max(&h->m_tree);
+    if (x != NULL)
+        rbht_base_delete(h, x, hashfunc);
+
+    return x;
+}
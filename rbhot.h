@@ -0,0 +1,188 @@
+#pragma once
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rbtree.h"
+
+/*
+ * A tree with a small cache of the elements that lookups keep coming back to,
+ * for skewed traffic where a few thousand keys take most of the gets. The
+ * cache is a table of sets, each holding RBHK_WAYS (hash, element) pairs in
+ * one cache line, so a hit costs a hash and a comparison instead of a descent
+ * through cold nodes, and a miss costs one line more than rbt_base_get.
+ *
+ * A miss puts the element in the last way of its set, in place of whatever
+ * was there, and each hit moves an element up a way. So a key has to be asked
+ * for again before the next miss in its set to stay, and a stream of keys
+ * that are each asked for once only ever churns the last way.
+ *
+ * Elements taken out through the rbhk_base_* functions are evicted on the
+ * way, which keeps the rest of the cache. Anything else that changes m_tree
+ * directly, by way of m_gen, empties the whole cache on the next lookup, so
+ * ordered operations can use the rbt_base_* functions on `m_tree` as they
+ * like. A tree that is re-initialized needs rbhk_flush, since that restarts
+ * m_gen. With duplicate keys a hit may find a different one of the equal
+ * elements than a descent would.
+ */
+
+// Ways in a set, which all fit in a cache line
+#define RBHK_WAYS 4
+
+typedef struct red_black_hot_slot rbhks_t;
+struct red_black_hot_slot {
+    size_t hash;
+    rbn_t *node;    // NULL for an empty way
+};
+
+typedef struct red_black_hot_stats rbhk_stats_t;
+struct red_black_hot_stats {
+    uint64_t hits;
+    uint64_t misses;        // lookups that went on to the tree
+    uint64_t flushes;       // times the cache was emptied for a change to m_tree
+};
+
+typedef struct red_black_hot_tree rbhk_t;
+struct red_black_hot_tree {
+    rbt_t m_tree;
+    rbhks_t *m_slots;
+    size_t m_mask;          // number of sets - 1
+    unsigned m_gen;         // m_tree.m_gen when the cache was last good
+    rbhk_stats_t m_stats;
+};
+
+// Empty the cache, keeping the tree
+static inline void
+rbhk_flush(rbhk_t *const h)
+{
+    memset(h->m_slots, 0, sizeof(*h->m_slots) * RBHK_WAYS * (h->m_mask + 1));
+    h->m_gen = h->m_tree.m_gen;
+    ++h->m_stats.flushes;
+}
+
+// Set up an empty tree with at least `sets` sets in the cache. Returns -1 with
+// errno set if the cache can't be allocated.
+static inline int
+rbhk_init(rbhk_t *const h, size_t const sets)
+{
+    rbt_init(&h->m_tree);
+    h->m_slots = NULL;
+    h->m_mask = 0;
+    h->m_gen = h->m_tree.m_gen;
+    h->m_stats = (rbhk_stats_t) { 0 };
+    if ((sets == 0) || (sets > SIZE_MAX / 2 / RBHK_WAYS / sizeof(rbhks_t))) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t n = 1;
+    while (n < sets)
+        n *= 2;
+    h->m_slots = aligned_alloc(RBHK_WAYS * sizeof(rbhks_t), n * RBHK_WAYS * sizeof(rbhks_t));
+    if (h->m_slots == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    h->m_mask = n - 1;
+    memset(h->m_slots, 0, sizeof(*h->m_slots) * RBHK_WAYS * n);
+
+    return 0;
+}
+
+// Free the cache. The elements belong to the caller.
+static inline void
+rbhk_destroy(rbhk_t *const h)
+{
+    free(h->m_slots);
+    h->m_slots = NULL;
+    h->m_mask = 0;
+    rbt_init(&h->m_tree);
+}
+
+static inline rbn_t *
+rbhk_base_get(rbhk_t *const h, void const*const key, rbtkeyhash_t const hashfunc,
+              rbtkeycmp_t const cmpfunc)
+{
+    if (h->m_gen != h->m_tree.m_gen)
+        rbhk_flush(h);
+
+    size_t const hash = hashfunc(key);
+    rbhks_t *const set = &h->m_slots[(hash & h->m_mask) * RBHK_WAYS];
+    for (unsigned w = 0; w < RBHK_WAYS; ++w) {
+        if ((set[w].hash == hash) && (set[w].node != NULL) && (cmpfunc(key, set[w].node) == 0)) {
+            rbn_t *const x = set[w].node;
+            if (w > 0) {
+                set[w] = set[w - 1];
+                set[w - 1] = (rbhks_t) { hash, x };
+            }
+            ++h->m_stats.hits;
+            return x;
+        }
+    }
+
+    ++h->m_stats.misses;
+    rbn_t *const x = rb_find_node_by_key(&h->m_tree, key, cmpfunc);
+    if (x != NULL)
+        set[RBHK_WAYS - 1] = (rbhks_t) { hash, x };
+
+    return x;
+}
+
+// Adding an element leaves every other where it was, so the cache stays
+static inline rbn_t *
+rbhk_base_add(rbhk_t *const h, rbn_t *const z, rbtcmp_t const cmpfunc)
+{
+    int const good = (h->m_gen == h->m_tree.m_gen);
+    rbn_t *const x = rbt_base_add(&h->m_tree, z, cmpfunc);
+    if (good)
+        h->m_gen = h->m_tree.m_gen;
+
+    return x;
+}
+
+// Take z out of the cache, if it is in it, and out of the tree
+static inline void
+rb_hot_delete(rbhk_t *const h, rbn_t *const z, size_t const hash)
+{
+    int const good = (h->m_gen == h->m_tree.m_gen);
+    rbhks_t *const set = &h->m_slots[(hash & h->m_mask) * RBHK_WAYS];
+    for (unsigned w = 0; w < RBHK_WAYS; ++w) {
+        if (set[w].node == z)
+            set[w].node = NULL;
+    }
+    rb_base_delete(&h->m_tree, z);
+    if (good)
+        h->m_gen = h->m_tree.m_gen;
+}
+
+static inline rbn_t *
+rbhk_base_rem(rbhk_t *const h, void const*const key, rbtkeyhash_t const hashfunc,
+              rbtkeycmp_t const cmpfunc)
+{
+    rbn_t *const x = rb_find_node_by_key(&h->m_tree, key, cmpfunc);
+    if (x != NULL)
+        rb_hot_delete(h, x, hashfunc(key));
+
+    return x;
+}
+
+// Remove an element that is in the tree
+static inline void
+rbhk_base_delete(rbhk_t *const h, rbn_t *const z, rbthash_t const hashfunc)
+{
+    rb_hot_delete(h, z, hashfunc(z));
+}
+
+// Copy out the cache counters gathered since init or the last reset
+static inline void
+rbhk_stats(rbhk_t const*const h, rbhk_stats_t *const p_stats)
+{
+    *p_stats = h->m_stats;
+}
+
+static inline void
+rbhk_stats_reset(rbhk_t *const h)
+{
+    h->m_stats = (rbhk_stats_t) { 0 };
+}
@@ -0,0 +1,255 @@
+#pragma once
+
+#include "rbtree.h"
+
+/*
+ * Trees that can be compared by content. Elements embed an rbmn_t, which
+ * holds a 64-bit digest of the element from a caller-supplied function, and
+ * each node keeps the sum of the digests in its subtree and how many there are
+ * (see rbt_base_augment).
+ *
+ * A hash of each subtree's shape, as in a Merkle tree, would be of no use
+ * between replicas, which end up with different shapes from different
+ * histories. The sum of the digests over a key range is the same whatever the
+ * shape, and any range can be summed in O(log n) from the subtree sums. So two
+ * trees are compared by summing a range in both and only splitting it further
+ * where they disagree. Each difference sits under O(log n) splits, so d of them
+ * take O(d log n) range sums and O(d log^2 n) comparisons. A walk of both trees
+ * side by side can't skip a matching subtree in one step, because with
+ * different shapes the same range is seldom a single subtree in both.
+ *
+ * The digests should be well mixed, and cover everything that has to match,
+ * not just the key. A sum can be fooled on purpose far more easily than a
+ * cryptographic hash, so this is for finding accidental differences.
+ */
+
+// Returns a well mixed digest of an element
+typedef uint64_t (*rbtdigest_t)(rbn_t const*);
+// Called for an element only in the first tree (b is NULL), only in the
+// second (a is NULL), or in both but with different digests
+typedef void (*rbtdiff_t)(rbn_t *a, rbn_t *b, void *ctx);
+
+typedef struct rbm_node rbmn_t;
+
+struct rbm_node {
+    rbn_t nd;
+    uint64_t digest;        // of this element
+    uint64_t sum;           // of the digests in the subtree
+    size_t count;           // elements in the subtree
+};
+
+// Ranges with no more than this many elements between the two trees are
+// compared element by element
+#define RBM_DIFF_LEAF 8
+
+__attribute__((pure))
+static inline rbmn_t *
+rbm_of(rbn_t const*const x)
+{
+    return (rbmn_t *)((unsigned char *)x - offsetof(rbmn_t, nd));
+}
+
+static inline int
+rbm_aug(rbn_t *const x, rbn_t const*const nil)
+{
+    rbmn_t *const m = rbm_of(x);
+    uint64_t sum = m->digest;
+    size_t count = 1;
+    if (x->lc != nil) {
+        sum += rbm_of(x->lc)->sum;
+        count += rbm_of(x->lc)->count;
+    }
+    if (x->rc != nil) {
+        sum += rbm_of(x->rc)->sum;
+        count += rbm_of(x->rc)->count;
+    }
+    int const changed = (m->sum != sum) || (m->count != count);
+    m->sum = sum;
+    m->count = count;
+    return changed;
+}
+
+static inline void
+rbm_init(rbt_t *const tree)
+{
+    rbt_init(tree);
+    rbt_base_augment(tree, rbm_aug);
+}
+
+// As rbt_base_add, taking the element's digest first
+static inline rbn_t *
+rbm_base_add(rbt_t *const tree, rbmn_t *const z, rbtcmp_t const cmpfunc, rbtdigest_t const digest)
+{
+    z->digest = digest(&z->nd);
+    return rbt_base_add(tree, &z->nd, cmpfunc);
+}
+
+// Take a new digest of an element that was changed in place, keeping its key
+static inline void
+rbm_base_update(rbt_t *const tree, rbmn_t *const z, rbtdigest_t const digest)
+{
+    z->digest = digest(&z->nd);
+    rb_aug_path(tree, &z->nd);
+}
+
+__attribute__((pure))
+static inline uint64_t
+rbm_sum(rbt_t const*const tree, size_t *const p_count)
+{
+    if (tree->m_top == &tree->m_nil) {
+        *p_count = 0;
+        return 0;
+    }
+    *p_count = rbm_of(tree->m_top)->count;
+    return rbm_of(tree->m_top)->sum;
+}
+
+// Sum the digests of the elements before the key, NULL for all of them
+static inline uint64_t
+rbm_base_prefix(rbt_t const*const tree, void const*const key, rbtkeycmp_t const keycmp, size_t *const p_count)
+{
+    if (key == NULL)
+        return rbm_sum(tree, p_count);
+
+    rbn_t const*const nil = &tree->m_nil;
+    uint64_t sum = 0;
+    size_t count = 0;
+    for (rbn_t const *x = tree->m_top; x != nil; ) {
+        if (keycmp(key, x) > 0) {
+            sum += rbm_of(x)->digest;
+            ++count;
+            if (x->lc != nil) {
+                sum += rbm_of(x->lc)->sum;
+                count += rbm_of(x->lc)->count;
+            }
+            x = x->rc;
+        } else {
+            x = x->lc;
+        }
+    }
+    *p_count = count;
+    return sum;
+}
+
+// Sum the digests of the elements in [lo, hi), NULL bounds being open
+static inline uint64_t
+rbm_base_range(rbt_t const*const tree, void const*const lo, void const*const hi,
+               rbtkeycmp_t const keycmp, size_t *const p_count)
+{
+    size_t nlo = 0;
+    size_t nhi;
+    uint64_t const slo = (lo != NULL) ? rbm_base_prefix(tree, lo, keycmp, &nlo) : 0;
+    uint64_t const shi = rbm_base_prefix(tree, hi, keycmp, &nhi);
+    *p_count = nhi - nlo;
+    return shi - slo;
+}
+
+// The k-th element in order, counting from 0, or NULL if there are no more
+// than k
+__attribute__((pure))
+static inline rbn_t *
+rbm_select(rbt_t const*const tree, size_t k)
+{
+    rbn_t const*const nil = &tree->m_nil;
+    rbn_t *x = tree->m_top;
+    while (x != nil) {
+        size_t const l = (x->lc != nil) ? rbm_of(x->lc)->count : 0;
+        if (k == l)
+            return x;
+        if (k < l) {
+            x = x->lc;
+        } else {
+            k -= l + 1;
+            x = x->rc;
+        }
+    }
+
+    return NULL;
+}
+
+// As rbm_base_prefix, bounded by an element that may be in another tree
+static inline uint64_t
+rb_merkle_prefix(rbt_t const*const tree, rbn_t const*const bound, rbtcmp_t const cmpfunc, size_t *const p_count)
+{
+    if (bound == NULL)
+        return rbm_sum(tree, p_count);
+
+    rbn_t const*const nil = &tree->m_nil;
+    uint64_t sum = 0;
+    size_t count = 0;
+    for (rbn_t const *x = tree->m_top; x != nil; ) {
+        if (cmpfunc(bound, x) > 0) {
+            sum += rbm_of(x)->digest;
+            ++count;
+            if (x->lc != nil) {
+                sum += rbm_of(x->lc)->sum;
+                count += rbm_of(x->lc)->count;
+            }
+            x = x->rc;
+        } else {
+            x = x->lc;
+        }
+    }
+    *p_count = count;
+    return sum;
+}
+
+// Compare the elements in [lo, hi) of both trees, NULL bounds being open
+static inline size_t
+rb_merkle_diff(rbt_t *const a, rbt_t *const b, rbn_t const*const lo, rbn_t const*const hi,
+               rbtcmp_t const cmpfunc, rbtdiff_t const on_diff, void *const ctx)
+{
+    size_t alo = 0, blo = 0, ahi, bhi;
+    uint64_t sa = rb_merkle_prefix(a, hi, cmpfunc, &ahi);
+    uint64_t sb = rb_merkle_prefix(b, hi, cmpfunc, &bhi);
+    if (lo != NULL) {
+        sa -= rb_merkle_prefix(a, lo, cmpfunc, &alo);
+        sb -= rb_merkle_prefix(b, lo, cmpfunc, &blo);
+    }
+    size_t const na = ahi - alo;
+    size_t const nb = bhi - blo;
+    if ((na == nb) && (sa == sb))
+        return 0;
+
+    if (na + nb <= RBM_DIFF_LEAF) {
+        // Merge the two runs
+        size_t found = 0;
+        size_t i = 0, j = 0;
+        rbn_t *x = (na > 0) ? rbm_select(a, alo) : NULL;
+        rbn_t *y = (nb > 0) ? rbm_select(b, blo) : NULL;
+        while ((i < na) || (j < nb)) {
+            int const cmp = (i == na) ? 1 : (j == nb) ? -1 : cmpfunc(x, y);
+            if (cmp < 0) {
+                on_diff(x, NULL, ctx);
+                ++found;
+            } else if (cmp > 0) {
+                on_diff(NULL, y, ctx);
+                ++found;
+            } else if (rbm_of(x)->digest != rbm_of(y)->digest) {
+                on_diff(x, y, ctx);
+                ++found;
+            }
+            if (cmp <= 0)
+                x = (++i < na) ? tree_successor(a, x) : NULL;
+            if (cmp >= 0)
+                y = (++j < nb) ? tree_successor(b, y) : NULL;
+        }
+        return found;
+    }
+
+    // Split at the middle element of the larger side
+    rbn_t const*const mid = (na >= nb) ? rbm_select(a, alo + na / 2) : rbm_select(b, blo + nb / 2);
+    return rb_merkle_diff(a, b, lo, mid, cmpfunc, on_diff, ctx) +
+           rb_merkle_diff(a, b, mid, hi, cmpfunc, on_diff, ctx);
+}
+
+/*
+ * Report every difference between two trees kept with rbm_init, skipping the
+ * key ranges whose digests sum the same in both. Returns how many there were.
+ * `on_diff` may look at the trees but not change them.
+ */
+static inline size_t
+rbt_base_diff(rbt_t *const a, rbt_t *const b, rbtcmp_t const cmpfunc, rbtdiff_t const on_diff, void *const ctx)
+{
+    return rb_merkle_diff(a, b, NULL, NULL, cmpfunc, on_diff, ctx);
+}
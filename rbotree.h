@@ -0,0 +1,539 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "rbttype.h"
+
+/*
+ * Offset linked variant of the tree, meant to live in a region of memory that
+ * is mapped by several processes, possibly at different addresses, such as a
+ * MAP_SHARED file or POSIX shared memory object.
+ *
+ * Every link in a node is stored as the distance in bytes from that node to
+ * its target, and the links in the tree header are relative to the header.
+ * The header, its sentinel, and every element must therefore sit in the same
+ * region, but the region can be mapped anywhere and reopened without touching
+ * a single node.
+ *
+ * Locking protocol
+ *
+ * The header carries a process-shared rwlock. Any number of processes may
+ * read at once while holding it with rbot_rdlock(), and a single writer at a
+ * time mutates the tree while holding it with rbot_wrlock(). Nodes handed out
+ * by lookups may only be dereferenced while the read lock is held, since a
+ * writer is free to unlink them once it is dropped. Writers must also hold
+ * the write lock while changing the keys of linked elements. The lock is not
+ * robust: a process that dies while holding it leaves the region unusable
+ * until it is reinitialized with rbot_init().
+ */
+
+#define RBOT_MAGIC UINT64_C(0x5242544f46465331) /* "RBTOFFS1" */
+
+typedef struct red_black_offset_node rbon_t;
+
+struct red_black_offset_node {
+    intptr_t p;
+    intptr_t lc;
+    intptr_t rc;
+    int color;
+#if UINTPTR_MAX == 0xffffffffffffffffull
+    int reserved;
+#endif
+};
+
+typedef int (*rbotcmp_t)(rbon_t const*, rbon_t const*);
+typedef int (*rbotkeycmp_t)(void const*, rbon_t const*);
+
+typedef struct red_black_offset_tree rbot_t;
+
+struct red_black_offset_tree {
+    uint64_t m_magic;
+    pthread_rwlock_t m_lock;
+    rbon_t m_nil;
+    intptr_t m_top;         // relative to the tree
+    intptr_t m_min;
+    intptr_t m_max;
+    size_t m_size;
+    unsigned m_gen;
+};
+
+__attribute__((pure))
+static inline rbon_t *
+rbo_at(void const*const base, intptr_t const off)
+{
+    return (rbon_t *)((unsigned char *)base + off);
+}
+
+__attribute__((pure))
+static inline intptr_t
+rbo_rel(void const*const base, rbon_t const*const x)
+{
+    return (unsigned char const*)x - (unsigned char const*)base;
+}
+
+__attribute__((pure)) static inline rbon_t *rbo_p(rbon_t const*const x) { return rbo_at(x, x->p); }
+__attribute__((pure)) static inline rbon_t *rbo_lc(rbon_t const*const x) { return rbo_at(x, x->lc); }
+__attribute__((pure)) static inline rbon_t *rbo_rc(rbon_t const*const x) { return rbo_at(x, x->rc); }
+static inline void rbo_set_p(rbon_t *const x, rbon_t const*const y) { x->p = rbo_rel(x, y); }
+static inline void rbo_set_lc(rbon_t *const x, rbon_t const*const y) { x->lc = rbo_rel(x, y); }
+static inline void rbo_set_rc(rbon_t *const x, rbon_t const*const y) { x->rc = rbo_rel(x, y); }
+
+__attribute__((pure)) static inline rbon_t *rbot_top(rbot_t const*const T) { return rbo_at(T, T->m_top); }
+__attribute__((pure)) static inline rbon_t *rbot_nil(rbot_t const*const T) { return (rbon_t *)&T->m_nil; }
+static inline void rbot_set_top(rbot_t *const T, rbon_t const*const x) { T->m_top = rbo_rel(T, x); }
+
+/*
+ * Initialize a tree in place. This is only done once by whoever creates the
+ * region, every other process simply maps it. Returns 0 on success or an
+ * error number from pthreads.
+ */
+static inline int
+rbot_init(rbot_t *const T)
+{
+    pthread_rwlockattr_t attr;
+    int rc = pthread_rwlockattr_init(&attr);
+    if (rc != 0)
+        return rc;
+    rc = pthread_rwlockattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    if (rc == 0)
+        rc = pthread_rwlock_init(&T->m_lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+    if (rc != 0)
+        return rc;
+
+    T->m_nil = (rbon_t) {
+        .p = 0,
+        .lc = 0,
+        .rc = 0,
+        .color = BLACK,
+    };
+    rbot_set_top(T, &T->m_nil);
+    T->m_min = T->m_top;
+    T->m_max = T->m_top;
+    T->m_size = 0;
+    T->m_gen = 0;
+    T->m_magic = RBOT_MAGIC;
+
+    return 0;
+}
+
+// Check that a freshly mapped region holds an initialized tree
+__attribute__((pure))
+static inline int
+rbot_valid(rbot_t const*const T)
+{
+    return T->m_magic == RBOT_MAGIC;
+}
+
+static inline int rbot_rdlock(rbot_t *const T) { return pthread_rwlock_rdlock(&T->m_lock); }
+static inline int rbot_wrlock(rbot_t *const T) { return pthread_rwlock_wrlock(&T->m_lock); }
+static inline int rbot_unlock(rbot_t *const T) { return pthread_rwlock_unlock(&T->m_lock); }
+
+__attribute__((pure))
+static inline size_t
+rbot_size(rbot_t const*const T)
+{
+    return T->m_size;
+}
+
+static inline void
+rbo_right_rotate(rbot_t *const T, rbon_t *const x)
+{
+    rbon_t *const nil = rbot_nil(T);
+    rbon_t *const y = rbo_lc(x);
+    rbon_t *const xp = rbo_p(x);
+
+    rbo_set_lc(x, rbo_rc(y));
+    if (rbo_rc(y) != nil) {
+        rbo_set_p(rbo_rc(y), x);
+    }
+    rbo_set_p(y, xp);
+    if (xp == nil) {
+        rbot_set_top(T, y);
+    } else if (x == rbo_lc(xp)) {
+        rbo_set_lc(xp, y);
+    } else {
+        rbo_set_rc(xp, y);
+    }
+    rbo_set_rc(y, x);
+    rbo_set_p(x, y);
+}
+
+static inline void
+rbo_left_rotate(rbot_t *const T, rbon_t *const x)
+{
+    rbon_t *const nil = rbot_nil(T);
+    rbon_t *const y = rbo_rc(x);
+    rbon_t *const xp = rbo_p(x);
+
+    rbo_set_rc(x, rbo_lc(y));
+    if (rbo_lc(y) != nil) {
+        rbo_set_p(rbo_lc(y), x);
+    }
+    rbo_set_p(y, xp);
+    if (xp == nil) {
+        rbot_set_top(T, y);
+    } else if (x == rbo_lc(xp)) {
+        rbo_set_lc(xp, y);
+    } else {
+        rbo_set_rc(xp, y);
+    }
+    rbo_set_lc(y, x);
+    rbo_set_p(x, y);
+}
+
+static inline void
+rbo_insert_fixup(rbot_t *const T, rbon_t *z)
+{
+    while (rbo_p(z)->color == RED) {
+        rbon_t *const zp = rbo_p(z);
+        rbon_t *const zpp = rbo_p(zp);
+
+        if (zp == rbo_lc(zpp)) {
+            rbon_t *const y = rbo_rc(zpp);
+            if (y->color == RED) {
+                zp->color = BLACK;
+                y->color = BLACK;
+                zpp->color = RED;
+                z = zpp;
+            } else {
+                if (z == rbo_rc(zp)) {
+                    z = zp;
+                    rbo_left_rotate(T, z);
+                }
+                rbo_p(z)->color = BLACK;
+                rbo_p(rbo_p(z))->color = RED;
+                rbo_right_rotate(T, rbo_p(rbo_p(z)));
+            }
+        } else {
+            rbon_t *const y = rbo_lc(zpp);
+            if (y->color == RED) {
+                zp->color = BLACK;
+                y->color = BLACK;
+                zpp->color = RED;
+                z = zpp;
+            } else {
+                if (z == rbo_lc(zp)) {
+                    z = zp;
+                    rbo_right_rotate(T, z);
+                }
+                rbo_p(z)->color = BLACK;
+                rbo_p(rbo_p(z))->color = RED;
+                rbo_left_rotate(T, rbo_p(rbo_p(z)));
+            }
+        }
+    }
+    rbot_top(T)->color = BLACK;
+}
+
+static inline rbon_t *
+rbot_base_add(rbot_t *const T, rbon_t *const z, rbotcmp_t const cmpfunc)
+{
+    rbon_t *const nil = rbot_nil(T);
+
+    rbon_t *y = nil;
+    rbon_t *x = rbot_top(T);
+    int cmp = 0;
+    while (x != nil) {
+        y = x;
+        cmp = cmpfunc(z, x);
+        if (cmp < 0)
+            x = rbo_lc(x);
+        else if (cmp > 0)
+            x = rbo_rc(x);
+        else
+            return x;
+    }
+
+    rbo_set_p(z, y);
+    rbo_set_lc(z, nil);
+    rbo_set_rc(z, nil);
+    z->color = RED;
+
+    if ((rbo_at(T, T->m_min) == nil) || (cmpfunc(z, rbo_at(T, T->m_min)) < 0)) {
+        T->m_min = rbo_rel(T, z);
+    }
+    if ((rbo_at(T, T->m_max) == nil) || (cmpfunc(z, rbo_at(T, T->m_max)) > 0)) {
+        T->m_max = rbo_rel(T, z);
+    }
+
+    if (y == nil) {
+        rbot_set_top(T, z);
+    } else if (cmp < 0) {
+        rbo_set_lc(y, z);
+    } else {
+        rbo_set_rc(y, z);
+    }
+
+    rbo_insert_fixup(T, z);
+
+    ++T->m_size;
+    ++T->m_gen;
+
+    return z;
+}
+
+__attribute__((pure))
+static inline rbon_t *
+rbot_base_get(rbot_t const*const T, void const*const key, rbotkeycmp_t const cmpfunc)
+{
+    rbon_t *const nil = rbot_nil(T);
+    rbon_t *x = rbot_top(T);
+    while (x != nil) {
+        int const cmp = cmpfunc(key, x);
+        if (cmp < 0)
+            x = rbo_lc(x);
+        else if (cmp > 0)
+            x = rbo_rc(x);
+        else
+            return x;
+    }
+
+    return NULL;
+}
+
+static inline void
+rbo_transplant(rbot_t *const T, rbon_t *const u, rbon_t *const v)
+{
+    rbon_t *const up = rbo_p(u);
+    if (up == rbot_nil(T)) {
+        rbot_set_top(T, v);
+    } else if (u == rbo_lc(up)) {
+        rbo_set_lc(up, v);
+    } else {
+        rbo_set_rc(up, v);
+    }
+    rbo_set_p(v, up);
+}
+
+__attribute__((pure))
+static inline rbon_t *
+rbo_minimum(rbot_t const*const T, rbon_t *x)
+{
+    while (rbo_lc(x) != rbot_nil(T))
+        x = rbo_lc(x);
+
+    return x;
+}
+
+__attribute__((pure))
+static inline rbon_t *
+rbo_maximum(rbot_t const*const T, rbon_t *x)
+{
+    while (rbo_rc(x) != rbot_nil(T))
+        x = rbo_rc(x);
+
+    return x;
+}
+
+static inline void
+rbo_delete_fixup(rbot_t *const T, rbon_t *x)
+{
+    while ((x != rbot_top(T)) && (x->color == BLACK)) {
+        rbon_t *const xp = rbo_p(x);
+        if (x == rbo_lc(xp)) {
+            rbon_t *w = rbo_rc(xp);
+            if (w->color == RED) {
+                w->color = BLACK;
+                xp->color = RED;
+                rbo_left_rotate(T, xp);
+                w = rbo_rc(xp);
+            }
+            if ((rbo_lc(w)->color == BLACK) && (rbo_rc(w)->color == BLACK)) {
+                w->color = RED;
+                x = xp;
+            } else {
+                if (rbo_rc(w)->color == BLACK) {
+                    rbo_lc(w)->color = BLACK;
+                    w->color = RED;
+                    rbo_right_rotate(T, w);
+                    w = rbo_rc(xp);
+                }
+                w->color = xp->color;
+                xp->color = BLACK;
+                rbo_rc(w)->color = BLACK;
+                rbo_left_rotate(T, xp);
+                x = rbot_top(T);
+            }
+        } else {
+            rbon_t *w = rbo_lc(xp);
+            if (w->color == RED) {
+                w->color = BLACK;
+                xp->color = RED;
+                rbo_right_rotate(T, xp);
+                w = rbo_lc(xp);
+            }
+            if ((rbo_rc(w)->color == BLACK) && (rbo_lc(w)->color == BLACK)) {
+                w->color = RED;
+                x = xp;
+            } else {
+                if (rbo_lc(w)->color == BLACK) {
+                    rbo_rc(w)->color = BLACK;
+                    w->color = RED;
+                    rbo_left_rotate(T, w);
+                    w = rbo_lc(xp);
+                }
+                w->color = xp->color;
+                xp->color = BLACK;
+                rbo_lc(w)->color = BLACK;
+                rbo_right_rotate(T, xp);
+                x = rbot_top(T);
+            }
+        }
+    }
+
+    x->color = BLACK;
+}
+
+// In-order neighbours, m_nil at either end
+__attribute__((pure))
+static inline rbon_t *
+rbo_successor(rbot_t const*const T, rbon_t *x)
+{
+    rbon_t *const nil = rbot_nil(T);
+    if (rbo_rc(x) != nil)
+        return rbo_minimum(T, rbo_rc(x));
+
+    rbon_t *y = rbo_p(x);
+    while ((y != nil) && (x == rbo_rc(y))) {
+        x = y;
+        y = rbo_p(y);
+    }
+
+    return y;
+}
+
+__attribute__((pure))
+static inline rbon_t *
+rbo_predecessor(rbot_t const*const T, rbon_t *x)
+{
+    rbon_t *const nil = rbot_nil(T);
+    if (rbo_lc(x) != nil)
+        return rbo_maximum(T, rbo_lc(x));
+
+    rbon_t *y = rbo_p(x);
+    while ((y != nil) && (x == rbo_lc(y))) {
+        x = y;
+        y = rbo_p(y);
+    }
+
+    return y;
+}
+
+static inline void
+rbot_base_delete(rbot_t *const T, rbon_t *const z)
+{
+    rbon_t *const nil = rbot_nil(T);
+
+    if (z == rbo_at(T, T->m_min)) {
+        T->m_min = rbo_rel(T, rbo_successor(T, z));
+    }
+    if (z == rbo_at(T, T->m_max)) {
+        T->m_max = rbo_rel(T, rbo_predecessor(T, z));
+    }
+
+    rbon_t *y = z;
+    int y_orig_color = y->color;
+    rbon_t *x;
+    if (rbo_lc(z) == nil) {
+        x = rbo_rc(z);
+        rbo_transplant(T, z, x);
+    } else if (rbo_rc(z) == nil) {
+        x = rbo_lc(z);
+        rbo_transplant(T, z, x);
+    } else {
+        y = rbo_minimum(T, rbo_rc(z));
+        y_orig_color = y->color;
+        x = rbo_rc(y);
+        if (rbo_p(y) == z) {
+            rbo_set_p(x, y);
+        } else {
+            rbo_transplant(T, y, x);
+            rbo_set_rc(y, rbo_rc(z));
+            rbo_set_p(rbo_rc(y), y);
+        }
+        rbo_transplant(T, z, y);
+        rbo_set_lc(y, rbo_lc(z));
+        rbo_set_p(rbo_lc(y), y);
+        y->color = z->color;
+    }
+
+    if (y_orig_color == BLACK)
+        rbo_delete_fixup(T, x);
+
+    // A detached node links to itself
+    z->p = 0;
+    z->lc = 0;
+    z->rc = 0;
+
+    T->m_size--;
+    T->m_gen++;
+}
+
+static inline rbon_t *
+rbot_base_rem(rbot_t *const T, void const*const key, rbotkeycmp_t const cmpfunc)
+{
+    rbon_t *const x = rbot_base_get(T, key, cmpfunc);
+
+    if (x == NULL) {
+        return NULL;
+    }
+
+    rbot_base_delete(T, x);
+
+    return x;
+}
+
+static inline rbon_t *
+rbot_base_min(rbot_t const*const T)
+{
+    rbon_t *const x = rbo_at(T, T->m_min);
+    return (x == rbot_nil(T)) ? NULL : x;
+}
+
+static inline rbon_t *
+rbot_base_max(rbot_t const*const T)
+{
+    rbon_t *const x = rbo_at(T, T->m_max);
+    return (x == rbot_nil(T)) ? NULL : x;
+}
+
+static inline rbon_t *
+rbot_base_popmin(rbot_t *const T)
+{
+    rbon_t *const x = rbot_base_min(T);
+    if (x != NULL)
+        rbot_base_delete(T, x);
+
+    return x;
+}
+
+static inline rbon_t *
+rbot_base_popmax(rbot_t *const T)
+{
+    rbon_t *const x = rbot_base_max(T);
+    if (x != NULL)
+        rbot_base_delete(T, x);
+
+    return x;
+}
+
+__attribute__((pure))
+static inline rbon_t *
+rbot_base_next(rbot_t const*const T, rbon_t *const x)
+{
+    rbon_t *const y = rbo_successor(T, x);
+    return (y == rbot_nil(T)) ? NULL : y;
+}
+
+__attribute__((pure))
+static inline rbon_t *
+rbot_base_prev(rbot_t const*const T, rbon_t *const x)
+{
+    rbon_t *const y = rbo_predecessor(T, x);
+    return (y == rbot_nil(T)) ? NULL : y;
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <errno.h>
+
+#include "rbtree.h"
+
+/*
+ * Quantiles over a sliding window of the last `cap` samples. Each sample is a
+ * node in a tree ordered by value, which keeps the size of every subtree (see
+ * rbt_base_augment), so the k-th smallest sample is one descent away. Equal
+ * values stay in arrival order.
+ *
+ * The nodes come from a ring allocated up front. Once the window is full, each
+ * new sample takes over the node of the oldest one, which is deleted through
+ * its handle without a search, so adding a sample never allocates.
+ */
+typedef struct rbq_sample rbq_sample_t;
+
+struct rbq_sample {
+    rbn_t nd;
+    uint64_t value;
+    size_t count;           // samples in the subtree
+};
+
+typedef struct rbq rbq_t;
+
+struct rbq {
+    rbt_t m_tree;
+    rbq_sample_t *m_ring;
+    size_t m_cap;           // samples in a full window
+    size_t m_next;          // ring slot the next sample goes in
+};
+
+__attribute__((pure))
+static inline rbq_sample_t *
+rbq_sample_of(rbn_t const*const x)
+{
+    return (rbq_sample_t *)((unsigned char *)x - offsetof(rbq_sample_t, nd));
+}
+
+__attribute__((pure))
+static inline int
+rbq_cmp(rbn_t const*const l, rbn_t const*const r)
+{
+    uint64_t const lv = rbq_sample_of(l)->value;
+    uint64_t const rv = rbq_sample_of(r)->value;
+    return (lv > rv) - (lv < rv);
+}
+
+__attribute__((pure))
+static inline size_t
+rbq_count(rbn_t const*const x, rbn_t const*const nil)
+{
+    return (x == nil) ? 0 : rbq_sample_of(x)->count;
+}
+
+static inline int
+rbq_recount(rbn_t *const x, rbn_t const*const nil)
+{
+    size_t const count = rbq_count(x->lc, nil) + 1 + rbq_count(x->rc, nil);
+    int const changed = (rbq_sample_of(x)->count != count);
+    rbq_sample_of(x)->count = count;
+    return changed;
+}
+
+// Returns -1 with errno set if the ring can't be allocated
+static inline int
+rbq_init(rbq_t *const q, size_t const cap)
+{
+    rbt_init(&q->m_tree);
+    rbt_base_augment(&q->m_tree, rbq_recount);
+    q->m_next = 0;
+    q->m_cap = cap;
+    q->m_ring = NULL;
+    if (cap == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    q->m_ring = malloc(sizeof(*q->m_ring) * cap);
+    if (q->m_ring == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    return 0;
+}
+
+static inline void
+rbq_destroy(rbq_t *const q)
+{
+    free(q->m_ring);
+    q->m_ring = NULL;
+    rbt_init(&q->m_tree);
+}
+
+__attribute__((pure))
+static inline size_t
+rbq_size(rbq_t const*const q)
+{
+    return rbt_size(&q->m_tree);
+}
+
+/*
+ * Add a sample, pushing the oldest one out of a full window. The sizes on the
+ * path of each are adjusted on the way, so the tree only recounts where it
+ * rotates or moves a node up to fill a gap, rather than all the way up.
+ */
+static inline void
+rbq_add(rbq_t *const q, uint64_t const value)
+{
+    rbt_t *const tree = &q->m_tree;
+    rbn_t *const nil = &tree->m_nil;
+    rbq_sample_t *const s = &q->m_ring[q->m_next];
+    if (rbt_size(tree) == q->m_cap) {
+        for (rbn_t *a = s->nd.p; a != nil; a = a->p)
+            --rbq_sample_of(a)->count;
+        rb_base_delete(tree, &s->nd);
+    }
+    if (++q->m_next == q->m_cap)
+        q->m_next = 0;
+
+    // After any equal samples, like rbt_base_add_multi
+    s->value = value;
+    rbn_t *y = nil;
+    int left = 0;
+    for (rbn_t *x = tree->m_top; x != nil; x = left ? x->lc : x->rc) {
+        y = x;
+        ++rbq_sample_of(x)->count;
+        left = (value < rbq_sample_of(x)->value);
+    }
+    rb_link_node(tree, &s->nd, y, left);
+}
+
+// The k-th smallest sample in the window, counting from 0, or NULL if there
+// are no more than k
+__attribute__((pure))
+static inline rbq_sample_t const*
+rbq_select(rbq_t const*const q, size_t k)
+{
+    rbn_t const*const nil = &q->m_tree.m_nil;
+    rbn_t const *x = q->m_tree.m_top;
+    while (x != nil) {
+        size_t const l = rbq_count(x->lc, nil);
+        if (k == l)
+            return rbq_sample_of(x);
+        if (k < l) {
+            x = x->lc;
+        } else {
+            k -= l + 1;
+            x = x->rc;
+        }
+    }
+
+    return NULL;
+}
+
+// The sample at quantile `phi` of the window by nearest rank, so 0.5 is the
+// median and 1 the largest sample, or NULL if the window is empty
+__attribute__((pure))
+static inline rbq_sample_t const*
+rbq_quantile(rbq_t const*const q, double const phi)
+{
+    size_t const n = rbq_size(q);
+    if (n == 0)
+        return NULL;
+
+    // The nearest rank is ceil(phi * n), counting from 1
+    double const r = phi * (double)n;
+    size_t k = (r <= 1.0) ? 0 : (size_t)r - ((double)(size_t)r == r);
+    if (k >= n)
+        k = n - 1;
+
+    return rbq_select(q, k);
+}
@@ -0,0 +1,284 @@
+#pragma once
+
+#include "rbtree.h"
+
+/*
+ * Sequences ordered by position rather than by a comparator, such as the
+ * chunks of an editor buffer or a playlist. Elements embed an rbsn_t, which
+ * keeps the size of its subtree (see rbt_base_augment), so the element at an
+ * index is one descent away and inserting or removing at an index costs
+ * O(log n) with the same rotations and fixups as any other tree.
+ *
+ * Splitting a sequence and joining two only relink O(log n) nodes, which needs
+ * the two sides to share the m_nil that the leaves point at. So sequences
+ * belong to a forest, which owns that m_nil along with an rbt_t that each
+ * operation borrows for the sequence it is working on. The sequences of a
+ * forest can't be changed from more than one thread at a time.
+ */
+typedef struct rbs_node rbsn_t;
+
+struct rbs_node {
+    rbn_t nd;
+    size_t count;           // elements in the subtree
+};
+
+typedef struct rbs_forest rbsf_t;
+
+struct rbs_forest {
+    rbt_t m_work;
+};
+
+typedef struct rbs rbs_t;
+
+struct rbs {
+    rbsf_t *m_forest;
+    rbn_t *m_top;
+    rbn_t *m_min;
+    rbn_t *m_max;
+};
+
+__attribute__((pure))
+static inline rbsn_t *
+rbs_of(rbn_t const*const x)
+{
+    return (rbsn_t *)((unsigned char *)x - offsetof(rbsn_t, nd));
+}
+
+__attribute__((pure))
+static inline size_t
+rbs_count(rbn_t const*const x, rbn_t const*const nil)
+{
+    return (x == nil) ? 0 : rbs_of(x)->count;
+}
+
+static inline int
+rbs_recount(rbn_t *const x, rbn_t const*const nil)
+{
+    size_t const count = rbs_count(x->lc, nil) + 1 + rbs_count(x->rc, nil);
+    int const changed = (rbs_of(x)->count != count);
+    rbs_of(x)->count = count;
+    return changed;
+}
+
+static inline void
+rbsf_init(rbsf_t *const forest)
+{
+    rbt_init(&forest->m_work);
+    rbt_base_augment(&forest->m_work, rbs_recount);
+}
+
+static inline void
+rbs_init(rbs_t *const seq, rbsf_t *const forest)
+{
+    seq->m_forest = forest;
+    seq->m_top = &forest->m_work.m_nil;
+    seq->m_min = &forest->m_work.m_nil;
+    seq->m_max = &forest->m_work.m_nil;
+}
+
+__attribute__((pure))
+static inline size_t
+rbs_size(rbs_t const*const seq)
+{
+    return rbs_count(seq->m_top, &seq->m_forest->m_work.m_nil);
+}
+
+// Lend the forest's tree to a sequence, and take it back
+static inline rbt_t *
+rb_seq_load(rbs_t const*const seq)
+{
+    rbt_t *const tree = &seq->m_forest->m_work;
+    tree->m_top = seq->m_top;
+    tree->m_min = seq->m_min;
+    tree->m_max = seq->m_max;
+    tree->m_size = rbs_size(seq);
+    return tree;
+}
+
+static inline void
+rb_seq_store(rbs_t *const seq, rbt_t *const tree)
+{
+    seq->m_top = tree->m_top;
+    seq->m_min = tree->m_min;
+    seq->m_max = tree->m_max;
+    tree->m_top = &tree->m_nil;
+    tree->m_min = &tree->m_nil;
+    tree->m_max = &tree->m_nil;
+    tree->m_size = 0;
+}
+
+// The element at an index, or NULL if there are no more than that
+__attribute__((pure))
+static inline rbn_t *
+rbs_at(rbs_t const*const seq, size_t i)
+{
+    rbn_t const*const nil = &seq->m_forest->m_work.m_nil;
+    rbn_t *x = seq->m_top;
+    while (x != nil) {
+        size_t const l = rbs_count(x->lc, nil);
+        if (i == l)
+            return x;
+        if (i < l) {
+            x = x->lc;
+        } else {
+            i -= l + 1;
+            x = x->rc;
+        }
+    }
+
+    return NULL;
+}
+
+// The index of an element in its sequence
+__attribute__((pure))
+static inline size_t
+rbs_index(rbs_t const*const seq, rbn_t const *x)
+{
+    rbn_t const*const nil = &seq->m_forest->m_work.m_nil;
+    size_t i = rbs_count(x->lc, nil);
+    for (; x->p != nil; x = x->p) {
+        if (x == x->p->rc)
+            i += rbs_count(x->p->lc, nil) + 1;
+    }
+    return i;
+}
+
+// The element after x, or NULL at the end
+__attribute__((pure))
+static inline rbn_t *
+rbs_next(rbs_t const*const seq, rbn_t *const x)
+{
+    rbn_t *const y = tree_successor(&seq->m_forest->m_work, x);
+    return (y == &seq->m_forest->m_work.m_nil) ? NULL : y;
+}
+
+// Insert z so that it ends up at index i, which may be the size to append
+static inline void
+rbs_insert_at(rbs_t *const seq, size_t const i, rbsn_t *const z)
+{
+    rbt_t *const tree = rb_seq_load(seq);
+    rbt_base_insert_before(tree, (i < tree->m_size) ? rbs_at(seq, i) : NULL, &z->nd);
+    rb_seq_store(seq, tree);
+}
+
+// Take out the element at index i and return it, or NULL if there is none
+static inline rbn_t *
+rbs_remove_at(rbs_t *const seq, size_t const i)
+{
+    rbn_t *const x = rbs_at(seq, i);
+    if (x == NULL)
+        return NULL;
+
+    rbt_t *const tree = rb_seq_load(seq);
+    rb_base_delete(tree, x);
+    rb_seq_store(seq, tree);
+    return x;
+}
+
+__attribute__((pure))
+static inline unsigned
+rb_seq_height(rbn_t const *x, rbn_t const*const nil)
+{
+    unsigned h = 0;
+    for (; x != nil; x = x->lc)
+        h += (x->color == BLACK);
+    return h;
+}
+
+/*
+ * Move everything in `tail` onto the end of the sequence, leaving `tail`
+ * empty, in O(log n). Both have to belong to the same forest.
+ */
+static inline void
+rbs_concat(rbs_t *const seq, rbs_t *const tail)
+{
+    assert(seq->m_forest == tail->m_forest);
+    rbn_t *const nil = &seq->m_forest->m_work.m_nil;
+    if (tail->m_top == nil)
+        return;
+    if (seq->m_top == nil) {
+        *seq = *tail;
+        rbs_init(tail, tail->m_forest);
+        return;
+    }
+
+    // The first element of the tail goes between the two
+    rbn_t *const k = tail->m_min;
+    rbt_t *const tree = rb_seq_load(tail);
+    rb_base_delete(tree, k);
+    rb_seq_store(tail, tree);
+
+    rbn_t *const max = (tail->m_top == nil) ? k : tail->m_max;
+    rb_join(tree, seq->m_top, rb_seq_height(seq->m_top, nil), k, tail->m_top, rb_seq_height(tail->m_top, nil));
+    seq->m_top = tree->m_top;
+    seq->m_max = max;
+    tree->m_top = nil;
+    rbs_init(tail, tail->m_forest);
+}
+
+/*
+ * Move the elements from index i on into `tail`, which must be empty and in
+ * the same forest, in O(log n). The elements on the path to index i are
+ * parted left and right, and the subtrees hanging off it joined back together
+ * bottom up on each side.
+ */
+static inline void
+rbs_split(rbs_t *const seq, size_t i, rbs_t *const tail)
+{
+    assert(seq->m_forest == tail->m_forest);
+    rbt_t *const tree = &seq->m_forest->m_work;
+    rbn_t *const nil = &tree->m_nil;
+    assert(tail->m_top == nil);
+    if (i >= rbs_size(seq))
+        return;
+
+    rbn_t *path[RBT_MAX_DEPTH];
+    unsigned heights[RBT_MAX_DEPTH];
+    unsigned char right[RBT_MAX_DEPTH];
+
+    unsigned h = rb_seq_height(seq->m_top, nil);
+    unsigned n = 0;
+    for (rbn_t *x = seq->m_top; x != nil; ++n) {
+        assert(n < RBT_MAX_DEPTH);
+        size_t const l = rbs_count(x->lc, nil);
+        path[n] = x;
+        heights[n] = h - (x->color == BLACK);
+        h = heights[n];
+        right[n] = (i <= l);
+        if (right[n]) {
+            x = x->lc;
+        } else {
+            i -= l + 1;
+            x = x->rc;
+        }
+    }
+
+    // A node going right takes its right subtree with it and follows
+    // everything below it on the path, and the other way around on the left
+    rbn_t *const min = seq->m_min;
+    rbn_t *const max = seq->m_max;
+    rbn_t *top = nil;
+    unsigned th = 0;
+    for (unsigned j = n; j-- > 0; ) {
+        if (right[j]) {
+            th = rb_join(tree, top, th, path[j], path[j]->rc, heights[j]);
+            top = tree->m_top;
+        }
+    }
+    tail->m_top = top;
+    tail->m_max = max;
+    tail->m_min = tree_minimum(tree, top);
+
+    top = nil;
+    th = 0;
+    for (unsigned j = n; j-- > 0; ) {
+        if (!right[j]) {
+            th = rb_join(tree, path[j]->lc, heights[j], path[j], top, th);
+            top = tree->m_top;
+        }
+    }
+    seq->m_top = top;
+    seq->m_min = (top == nil) ? nil : min;
+    seq->m_max = (top == nil) ? nil : tree_maximum(tree, top);
+    tree->m_top = nil;
+}
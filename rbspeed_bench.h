@@ -0,0 +1,33 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Additional benchmarks, selected by name on the rbspeed command line. Each
+// gets the arguments following its name.
+int bench_suite(int argc, char **argv);
+int bench_relayout(int argc, char **argv);
+int bench_clear(int argc, char **argv);
+int bench_dump(int argc, char **argv);
+int bench_findins(int argc, char **argv);
+int bench_cursor(int argc, char **argv);
+int bench_relaxed(int argc, char **argv);
+int bench_wavl(int argc, char **argv);
+int bench_hashget(int argc, char **argv);
+int bench_timer(int argc, char **argv);
+int bench_rekey(int argc, char **argv);
+int bench_strkey(int argc, char **argv);
+int bench_parscan(int argc, char **argv);
+int bench_clone(int argc, char **argv);
+int bench_branch(int argc, char **argv);
+int bench_sweep(int argc, char **argv);
+int bench_quantile(int argc, char **argv);
+int bench_sync(int argc, char **argv);
+int bench_seq(int argc, char **argv);
+int bench_hot(int argc, char **argv);
+int bench_static(int argc, char **argv);
+
+#ifdef __cplusplus
+}
+#endif
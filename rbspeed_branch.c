@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "rbtree.h"
+
+#include "rbspeed_util.h"
+#include "rbspeed_bench.h"
+
+typedef struct entry entry_t;
+struct entry {
+    rbn_t nd;
+    int64_t key;
+};
+
+__attribute__((pure))
+static inline int64_t
+entkey(rbn_t const*const n)
+{
+    return ((entry_t const*)((unsigned char const*)n - offsetof(entry_t, nd)))->key;
+}
+
+__attribute__((pure))
+static inline int
+entcmp(rbn_t const*const l, rbn_t const*const r)
+{
+    return (entkey(l) > entkey(r)) - (entkey(l) < entkey(r));
+}
+
+__attribute__((pure))
+static inline int
+entkeycmp(void const*const key, rbn_t const*const r)
+{
+    int64_t const k = *(int64_t const*)key;
+    return (k > entkey(r)) - (k < entkey(r));
+}
+
+// The same descent as rbt_base_get, but indexing the children by the comparison
+__attribute__((pure))
+static inline rbn_t *
+get_indexed(rbt_t const*const tree, int64_t const key)
+{
+    rbn_t *x = tree->m_top;
+    while (x != &tree->m_nil) {
+        int const cmp = entkeycmp(&key, x);
+        if (cmp == 0)
+            return x;
+        x = x->ch[cmp > 0];
+    }
+
+    return NULL;
+}
+
+// Branch mispredictions of this thread in user space, or -1 if the hardware
+// counter isn't available
+static int
+open_branch_misses(void)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t
+read_counter(int const fd)
+{
+    uint64_t v = 0;
+    if ((fd < 0) || (read(fd, &v, sizeof(v)) != sizeof(v)))
+        return 0;
+    return v;
+}
+
+/*
+ * Look up random keys, about half of them present, with rbt_base_get which
+ * branches three ways on the comparator, with the same descent indexing the
+ * children by the comparison, and with rbt_base_get_int which only takes the
+ * direction bit and runs to the bottom. Tree sizes go up by tens to
+ * `num_objs`, and mispredictions are counted where the CPU lets us.
+ *
+ * usage: rbspeed branch [num_objs]
+ */
+int
+bench_branch(int argc, char **argv)
+{
+    int const n = (argc > 1) ? atoi(argv[1]) : 1000000;
+    if (n <= 0) {
+        fprintf(stderr, "usage: rbspeed branch [num_objs]\n");
+        return 1;
+    }
+    int const ops = 2000000;
+    unsigned rng = time(NULL);
+
+    int const fd = open_branch_misses();
+    if (fd < 0)
+        perror("perf_event_open, mispredictions not counted");
+
+    entry_t *const objs = malloc(sizeof(*objs) * n);
+    int64_t *const keys = malloc(sizeof(*keys) * ops);
+    struct timespec start, end;
+
+    for (int size = (n < 1000) ? n : 1000; size <= n; size *= 10) {
+        rbt_t tree;
+        rbt_init(&tree);
+        // Even keys are present, odd ones aren't
+        for (int i = 0; i < size; ++i) {
+            do {
+                objs[i].key = 2 * (int64_t)(xorshift32(&rng) % (8u * size));
+            } while (rbt_base_add(&tree, &objs[i].nd, entcmp) != &objs[i].nd);
+        }
+        for (int i = 0; i < ops; ++i) {
+            keys[i] = (xorshift32(&rng) & 1) ? objs[xorshift32(&rng) % size].key : 2 * (int64_t)(xorshift32(&rng) % (8u * size)) + 1;
+        }
+
+        printf("Ran test with a tree of size %d\n", size);
+        size_t want = 0;
+        for (int variant = 0; variant < 3; ++variant) {
+            size_t found = 0;
+            uint64_t const misses = read_counter(fd);
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (int i = 0; i < ops; ++i) {
+                rbn_t const *x;
+                if (variant == 0)
+                    x = rbt_base_get(&tree, &keys[i], entkeycmp);
+                else if (variant == 1)
+                    x = get_indexed(&tree, keys[i]);
+                else
+                    x = rbt_base_get_int(&tree, keys[i], entkey);
+                found += (x != NULL);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            uint64_t const missed = read_counter(fd) - misses;
+            if (variant == 0)
+                want = found;
+            else if (found != want)
+                abort();
+
+            static char const*const names[] = { "rbt_base_get", "indexed", "rbt_base_get_int" };
+            printf("  %-17s %7.1f ns per lookup", names[variant], (double)elapsed_ns(&start, &end) / ops);
+            if (fd >= 0)
+                printf(", %5.2f mispredictions per lookup", (double)missed / ops);
+            printf("\n");
+        }
+    }
+
+    if (fd >= 0)
+        close(fd);
+    free(keys);
+    free(objs);
+
+    return 0;
+}
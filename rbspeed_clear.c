@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+
+#include "rbspeed_helper.h"
+#include "rbspeed_util.h"
+#include "rbspeed_bench.h"
+
+static void
+fill(rbt_t *const tree, my_t *const objs, int const n, unsigned *const p_rng)
+{
+    rbt_init(tree);
+    for (int i = 0; i < n; ++i) {
+        do {
+            objs[i].my_key = (int)(xorshift32(p_rng) & 0x7fffffffu);
+        } while (rbt_add(tree, &objs[i]) != &objs[i]);
+    }
+}
+
+/*
+ * Tear down a full tree with a loop of rbt_popmin, which rebalances on every
+ * removal, and with a single rbt_base_clear pass.
+ *
+ * usage: rbspeed clear [num_objs]
+ */
+int
+bench_clear(int argc, char **argv)
+{
+    int const n = (argc > 1) ? atoi(argv[1]) : 10000000;
+    if (n <= 0) {
+        fprintf(stderr, "usage: rbspeed clear [num_objs]\n");
+        return 1;
+    }
+    unsigned rng = time(NULL);
+
+    my_t *const objs = malloc(sizeof(*objs) * n);
+    rbt_t tree;
+    struct timespec start, end;
+
+    fill(&tree, objs, n, &rng);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    size_t popped = 0;
+    while (rbt_popmin(&tree) != NULL) {
+        ++popped;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    assert(popped == (size_t)n);
+    uint64_t const pop_ns = elapsed_ns(&start, &end);
+
+    fill(&tree, objs, n, &rng);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    size_t const cleared = rbt_clear(&tree);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    assert(cleared == (size_t)n);
+    (void)cleared;
+    uint64_t const clear_ns = elapsed_ns(&start, &end);
+
+    printf("Ran test with a tree of size %d\n", n);
+    printf("Time to tear down with popmin: %f milliseconds (%f nanoseconds per node)\n",
+            pop_ns / 1e6, 1.0 * pop_ns / n);
+    printf("Time to tear down with clear: %f milliseconds (%f nanoseconds per node)\n",
+            clear_ns / 1e6, 1.0 * clear_ns / n);
+
+    free(objs);
+
+    return 0;
+}
@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+
+#include "rbspeed_helper.h"
+#include "rbspeed_util.h"
+#include "rbspeed_bench.h"
+
+static void
+free_all(rbt_t *const tree)
+{
+    my_t *obj;
+    while ((obj = rbt_popmin(tree)) != NULL)
+        free(obj);
+}
+
+/*
+ * Take a copy of a tree built from random inserts by walking it in order and
+ * inserting a copy of each element into a new tree, and with rbt_base_clone,
+ * first with every copy allocated on its own and then with the copies placed
+ * in one buffer.
+ *
+ * usage: rbspeed clone [num_objs]
+ */
+int
+bench_clone(int argc, char **argv)
+{
+    int const n = (argc > 1) ? atoi(argv[1]) : 10000000;
+    if (n <= 0) {
+        fprintf(stderr, "usage: rbspeed clone [num_objs]\n");
+        return 1;
+    }
+    unsigned rng = time(NULL);
+
+    my_t *const objs = malloc(sizeof(*objs) * n);
+    my_t *const buf = malloc(sizeof(*buf) * n);
+    rbt_t src, dst;
+    struct timespec start, end;
+
+    rbt_init(&src);
+    for (int i = 0; i < n; ++i) {
+        do {
+            objs[i].my_key = (int)(xorshift32(&rng) & 0x7fffffffu);
+        } while (rbt_add(&src, &objs[i]) != &objs[i]);
+    }
+
+    printf("Ran test with a tree of size %d\n", n);
+
+    for (int into = 0; into < 2; ++into) {
+        rbt_init(&dst);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int i = 0;
+        // Keys are never negative
+        for (my_t *x = rbt_gt(&src, -1); x != NULL; x = rbt_next(&src, x), ++i) {
+            my_t *const copy = into ? &buf[i] : malloc(sizeof(*copy));
+            *copy = *x;
+            rbt_add(&dst, copy);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        assert(dst.m_size == (size_t)n);
+        uint64_t const insert_ns = elapsed_ns(&start, &end);
+        if (into)
+            rbt_clear(&dst);
+        else
+            free_all(&dst);
+
+        rbt_init(&dst);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (into) {
+            rbt_clone_into(&dst, &src, buf);
+        } else if (rbt_clone(&dst, &src) != 0) {
+            abort();
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        assert(dst.m_size == (size_t)n);
+        uint64_t const clone_ns = elapsed_ns(&start, &end);
+        if (into)
+            rbt_clear(&dst);
+        else
+            free_all(&dst);
+
+        printf("%-7s re-insert %8.1f ms (%5.1f ns per element), clone %8.1f ms (%5.1f ns per element)\n",
+               into ? "buffer" : "malloc", insert_ns / 1e6, (double)insert_ns / n, clone_ns / 1e6,
+               (double)clone_ns / n);
+    }
+
+    free(buf);
+    free(objs);
+
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+
+#include "rbspeed_helper.h"
+#include "rbspeed_util.h"
+#include "rbspeed_bench.h"
+
+static void
+fill(rbt_t *const tree, my_t *const objs, int const n)
+{
+    rbt_init(tree);
+    for (int i = 0; i < n; ++i) {
+        objs[i].my_key = 2 * i;
+        rbt_add(tree, &objs[i]);
+    }
+}
+
+/*
+ * Workloads where every update lands close to the previous one, done with
+ * keyed operations from the top of the tree and with cursor operations.
+ *
+ *  walk:  look up a key within 8 places of the last one, unlink it and link
+ *         it back in
+ *  queue: consume the head of the tree and append a new tail
+ *
+ * usage: rbspeed cursor [num_objs] [num_ops]
+ */
+int
+bench_cursor(int argc, char **argv)
+{
+    int const n = (argc > 1) ? atoi(argv[1]) : 1000000;
+    int const ops = (argc > 2) ? atoi(argv[2]) : 5000000;
+    if ((n <= 16) || (ops <= 0)) {
+        fprintf(stderr, "usage: rbspeed cursor [num_objs > 16] [num_ops]\n");
+        return 1;
+    }
+    unsigned const seed = time(NULL);
+
+    my_t *const objs = malloc(sizeof(*objs) * n);
+    rbt_t tree;
+    struct timespec start, end;
+
+    fill(&tree, objs, n);
+    unsigned rng = seed;
+    int pos = n / 2;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < ops; ++i) {
+        pos += (int)(xorshift32(&rng) % 17) - 8;
+        pos = (pos < 0) ? 0 : (pos >= n) ? n - 1 : pos;
+        my_t *const x = rbt_get(&tree, 2 * pos);
+        rbt_rem(&tree, x->my_key);
+        rbt_add(&tree, x);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t const walk_key_ns = elapsed_ns(&start, &end);
+
+    fill(&tree, objs, n);
+    rng = seed;
+    pos = n / 2;
+    my_t *cursor = rbt_get(&tree, 2 * pos);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < ops; ++i) {
+        pos += (int)(xorshift32(&rng) % 17) - 8;
+        pos = (pos < 0) ? 0 : (pos >= n) ? n - 1 : pos;
+        my_t *const x = rbt_finger(&tree, cursor, 2 * pos);
+        rbt_insert_before(&tree, rbt_remove_at(&tree, x), x);
+        cursor = x;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t const walk_cursor_ns = elapsed_ns(&start, &end);
+
+    fill(&tree, objs, n);
+    int tail = 2 * (n - 1);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < ops; ++i) {
+        my_t *const x = rbt_popmin(&tree);
+        x->my_key = (tail += 2);
+        rbt_add(&tree, x);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t const queue_key_ns = elapsed_ns(&start, &end);
+
+    fill(&tree, objs, n);
+    tail = 2 * (n - 1);
+    my_t *head = rbt_get(&tree, 0);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < ops; ++i) {
+        my_t *const x = head;
+        head = rbt_remove_at(&tree, x);
+        x->my_key = (tail += 2);
+        rbt_insert_before(&tree, NULL, x);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t const queue_cursor_ns = elapsed_ns(&start, &end);
+    assert(rbt_get(&tree, tail) != NULL);
+
+    printf("Ran test with a tree of size %d, %d operations each\n", n, ops);
+    printf("walk with keys: %f nanoseconds per op\n", 1.0 * walk_key_ns / ops);
+    printf("walk with a cursor: %f nanoseconds per op\n", 1.0 * walk_cursor_ns / ops);
+    printf("queue with keys: %f nanoseconds per op\n", 1.0 * queue_key_ns / ops);
+    printf("queue with a cursor: %f nanoseconds per op\n", 1.0 * queue_cursor_ns / ops);
+
+    free(objs);
+
+    return 0;
+}
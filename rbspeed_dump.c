@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "rbspeed_helper.h"
+#include "rbspeed_util.h"
+#include "rbspeed_bench.h"
+
+// Push the dump out of the page cache so the reload starts cold, as far as
+// the kernel lets us
+static void
+drop_cache(int const fd)
+{
+    fsync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+static int
+check_tree(rbt_t *const tree, my_t const*const objs, int const n)
+{
+    for (int i = 0; i < n; i += 1 + n / 1000) {
+        if (rbt_get(tree, objs[i].my_key) == NULL)
+            return -1;
+    }
+    return (tree->m_size == (size_t)n) ? 0 : -1;
+}
+
+/*
+ * Dump a tree to a file and reload it, once by streaming the sorted records
+ * into rbt_base_build and once by inserting them one at a time.
+ *
+ * usage: rbspeed dump [num_objs] [path]
+ */
+int
+bench_dump(int argc, char **argv)
+{
+    int const n = (argc > 1) ? atoi(argv[1]) : 10000000;
+    char const*const path = (argc > 2) ? argv[2] : "rbspeed.dump";
+    if (n <= 0) {
+        fprintf(stderr, "usage: rbspeed dump [num_objs] [path]\n");
+        return 1;
+    }
+    unsigned rng = time(NULL);
+
+    rbt_t tree;
+    rbt_init(&tree);
+    my_t *const objs = malloc(sizeof(*objs) * n);
+    for (int i = 0; i < n; ++i) {
+        do {
+            objs[i].my_key = (int)(xorshift32(&rng) & 0x7fffffffu);
+        } while (rbt_add(&tree, &objs[i]) != &objs[i]);
+    }
+
+    struct timespec start, end;
+    FILE *const fp = fopen(path, "w+");
+    if (fp == NULL) {
+        perror(path);
+        free(objs);
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int rc = rbt_dump(&tree, fp);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t const dump_ns = elapsed_ns(&start, &end);
+
+    struct stat st;
+    fstat(fileno(fp), &st);
+    double const mb = st.st_size / 1e6;
+
+    my_t *const loaded = malloc(sizeof(*loaded) * n);
+    rbt_t copy;
+
+    drop_cache(fileno(fp));
+    rbt_init(&copy);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    rc |= rbt_load(&copy, fileno(fp), loaded);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t const load_ns = elapsed_ns(&start, &end);
+    rc |= check_tree(&copy, objs, n);
+
+    drop_cache(fileno(fp));
+    rbt_init(&copy);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    rc |= rbt_load_by_insert(&copy, fileno(fp), loaded);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t const insert_ns = elapsed_ns(&start, &end);
+    rc |= check_tree(&copy, objs, n);
+
+    fclose(fp);
+    unlink(path);
+
+    if (rc != 0) {
+        fprintf(stderr, "dump/reload failed\n");
+    } else {
+        printf("Ran test with a tree of size %d (%f MB on disk)\n", n, mb);
+        printf("Time to dump: %f milliseconds (%f MB/s)\n", dump_ns / 1e6, mb / (dump_ns / 1e9));
+        printf("Time to ready with linear reload: %f milliseconds (%f MB/s)\n",
+                load_ns / 1e6, mb / (load_ns / 1e9));
+        printf("Time to ready with insert loop: %f milliseconds (%f MB/s)\n",
+                insert_ns / 1e6, mb / (insert_ns / 1e9));
+    }
+
+    free(loaded);
+    free(objs);
+
+    return rc != 0;
+}
@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+
+#include "rbspeed_helper.h"
+#include "rbspeed_util.h"
+#include "rbspeed_bench.h"
+
+// The tree holds the even keys, misses use fresh odd keys so they never hit
+static void
+fill(rbt_t *const tree, int const n)
+{
+    rbt_init(tree);
+    for (int i = 0; i < n; ++i) {
+        my_t *const obj = malloc(sizeof(*obj));
+        obj->my_key = 2 * i;
+        rbt_add(tree, obj);
+    }
+}
+
+static void
+drain(rbt_t *const tree)
+{
+    my_t *obj;
+    while ((obj = rbt_popmin(tree)) != NULL)
+        free(obj);
+}
+
+static int
+next_key(unsigned *const p_rng, int const n, unsigned const hit_pct, int *const p_miss)
+{
+    if (xorshift32(p_rng) % 100 < hit_pct)
+        return 2 * (int)(xorshift32(p_rng) % (unsigned)n);
+    return 2 * (n + (*p_miss)++) + 1;
+}
+
+/*
+ * Compare find-or-insert against building an object up front and throwing it
+ * away when rbt_add finds the key already there, at several hit ratios.
+ *
+ * usage: rbspeed findins [num_objs] [num_ops]
+ */
+int
+bench_findins(int argc, char **argv)
+{
+    int const n = (argc > 1) ? atoi(argv[1]) : 1000000;
+    int const ops = (argc > 2) ? atoi(argv[2]) : 2000000;
+    if ((n <= 0) || (ops <= 0)) {
+        fprintf(stderr, "usage: rbspeed findins [num_objs] [num_ops]\n");
+        return 1;
+    }
+    unsigned const seed = time(NULL);
+    static unsigned const hit_pcts[] = { 0, 50, 90, 99, 100 };
+
+    printf("Ran test with a tree of size %d, %d operations each\n", n, ops);
+    printf("%8s %16s %16s\n", "hit %", "add ns/op", "findins ns/op");
+
+    for (size_t h = 0; h < sizeof(hit_pcts) / sizeof(hit_pcts[0]); ++h) {
+        rbt_t tree;
+        struct timespec start, end;
+
+        fill(&tree, n);
+        unsigned rng = seed;
+        int miss = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < ops; ++i) {
+            my_t *const obj = malloc(sizeof(*obj));
+            obj->my_key = next_key(&rng, n, hit_pcts[h], &miss);
+            if (rbt_add(&tree, obj) != obj)
+                free(obj);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        uint64_t const add_ns = elapsed_ns(&start, &end);
+        drain(&tree);
+
+        fill(&tree, n);
+        rng = seed;
+        miss = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < ops; ++i) {
+            my_t *const obj = rbt_find_or_insert(&tree, next_key(&rng, n, hit_pcts[h], &miss));
+            assert(obj != NULL);
+            (void)obj;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        uint64_t const findins_ns = elapsed_ns(&start, &end);
+        drain(&tree);
+
+        printf("%8u %16.1f %16.1f\n", hit_pcts[h], 1.0 * add_ns / ops, 1.0 * findins_ns / ops);
+    }
+
+    return 0;
+}
@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "rbspeed_helper.h"
+#include "rbspeed_util.h"
+#include "rbspeed_hist.h"
+#include "rbspeed_bench.h"
+
+static void
+print_hist(char const*const what, int const n, hist_t const*const h)
+{
+    printf("%-8s %10d  mean %8.1f  p50 %6" PRIu64 "  p99 %6" PRIu64 "  p999 %7" PRIu64 "\n",
+           what, n, (double)h->sum / (double)h->count, hist_percentile(h, 0.5),
+           hist_percentile(h, 0.99), hist_percentile(h, 0.999));
+}
+
+/*
+ * Time lookups of random present keys in the plain tree and in the same
+ * elements indexed by a tree with a hash table beside it, for each size.
+ *
+ * usage: rbspeed hashget [num_objs...]
+ */
+int
+bench_hashget(int argc, char **argv)
+{
+    static char *defaults[] = { "hashget", "1000000", "10000000" };
+    if (argc < 2) {
+        argc = sizeof(defaults) / sizeof(defaults[0]);
+        argv = defaults;
+    }
+
+    unsigned rng = time(NULL);
+    int const ops = 1000000;
+    hist_t *const h = malloc(sizeof(*h));
+    struct timespec start, end;
+
+    for (int a = 1; a < argc; ++a) {
+        int const n = atoi(argv[a]);
+        my_t *const objs = (n > 0) ? malloc(sizeof(*objs) * n) : NULL;
+        if (objs == NULL) {
+            fprintf(stderr, "can't run with %s elements\n", argv[a]);
+            free(h);
+            return 1;
+        }
+        // An odd multiplier permutes the 31 bit keys, so they are unique
+        for (int i = 0; i < n; ++i)
+            objs[i].my_key = (int)(((unsigned)i * 2654435761u) & 0x7fffffffu);
+
+        rbt_t tree;
+        rbt_init(&tree);
+        for (int i = 0; i < n; ++i)
+            rbt_add(&tree, &objs[i]);
+
+        hist_init(h);
+        for (int i = 0; i < ops; ++i) {
+            my_t const*const obj = &objs[xorshift32(&rng) % n];
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            my_t const*const g = rbt_get(&tree, obj->my_key);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            hist_record(h, elapsed_ns(&start, &end));
+            if (g != obj)
+                abort();
+        }
+        print_hist("tree", n, h);
+
+        // The elements move over to the hybrid container
+        rbht_t *const ht = rbht_create();
+        for (int i = 0; i < n; ++i) {
+            if (rbht_add(ht, &objs[i]) != &objs[i])
+                abort();
+        }
+
+        hist_init(h);
+        for (int i = 0; i < ops; ++i) {
+            my_t const*const obj = &objs[xorshift32(&rng) % n];
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            my_t const*const g = rbht_get(ht, obj->my_key);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            hist_record(h, elapsed_ns(&start, &end));
+            if (g != obj)
+                abort();
+        }
+        print_hist("hybrid", n, h);
+
+        rbht_free(ht);
+        free(objs);
+    }
+
+    free(h);
+
+    return 0;
+}
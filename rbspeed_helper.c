@@ -1,5 +1,10 @@
 
+#include <string.h>
+
 #include "rbtree.h"
+#include "rbtfile.h"
+#include "wavltree.h"
+#include "rbhash.h"
 
 #include "rbspeed_helper.h"
 
@@ -82,3 +87,406 @@ rbt_popmax(rbt_t *const tree)
 
     return (void *)((unsigned char *)v - offsetof(my_t, ok));
 }
+
+my_t *
+rbt_lt(rbt_t *const tree, int key)
+{
+    myk_t const k = {
+        key,
+    };
+    rbn_t *v = rbt_base_lt(tree, &k, mykeycmp);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(my_t, ok));
+}
+
+my_t *
+rbt_gt(rbt_t *const tree, int key)
+{
+    myk_t const k = {
+        key,
+    };
+    rbn_t *v = rbt_base_gt(tree, &k, mykeycmp);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(my_t, ok));
+}
+
+my_t *
+rbt_next(rbt_t *const tree, my_t *const obj)
+{
+    rbn_t *v = rbt_base_next(tree, &obj->ok, mycmp);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(my_t, ok));
+}
+
+static rbn_t *
+mymove(void *const dst, rbn_t *const src)
+{
+    my_t *const d = dst;
+    *d = *(my_t *)((unsigned char *)src - offsetof(my_t, ok));
+    return &d->ok;
+}
+
+void
+rbt_relayout(rbt_t *const tree, my_t *const buf)
+{
+    rbt_base_relayout(tree, buf, sizeof(*buf), mymove);
+}
+
+static rbn_t *
+mycopy(rbn_t const*const x, void *const ctx)
+{
+    (void)ctx;
+    my_t *const d = malloc(sizeof(*d));
+    if (d == NULL)
+        return NULL;
+    *d = *(my_t const*)((unsigned char const*)x - offsetof(my_t, ok));
+    return &d->ok;
+}
+
+static void
+myfree(rbn_t *const x, void *const ctx)
+{
+    (void)ctx;
+    free((unsigned char *)x - offsetof(my_t, ok));
+}
+
+int
+rbt_clone(rbt_t *const dst, rbt_t const*const src)
+{
+    return rbt_base_clone(dst, src, mycopy, myfree, NULL);
+}
+
+void
+rbt_clone_into(rbt_t *const dst, rbt_t const*const src, my_t *const buf)
+{
+    rbt_base_clone_into(dst, src, buf, sizeof(*buf), mymove);
+}
+
+my_t *
+rbt_popmin(rbt_t *const tree)
+{
+    rbn_t *v = rbt_base_popmin(tree);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(my_t, ok));
+}
+
+static void
+mycount(rbn_t *const x, void *const ctx)
+{
+    (void)x;
+    ++*(size_t *)ctx;
+}
+
+size_t
+rbt_clear(rbt_t *const tree)
+{
+    size_t count = 0;
+    rbt_base_clear(tree, mycount, &count);
+    return count;
+}
+
+static size_t
+myenc(rbn_t const*const x, void *const buf, size_t const cap, void *const ctx)
+{
+    (void)ctx;
+    my_t const*const obj = (void *)((unsigned char *)x - offsetof(my_t, ok));
+    if (cap >= sizeof(obj->my_key))
+        memcpy(buf, &obj->my_key, sizeof(obj->my_key));
+    return sizeof(obj->my_key);
+}
+
+static rbn_t *
+mydec(void const*const rec, size_t const len, void *const ctx)
+{
+    (void)len;
+    my_t **const p_next = ctx;
+    my_t *const obj = (*p_next)++;
+    memcpy(&obj->my_key, rec, sizeof(obj->my_key));
+    return &obj->ok;
+}
+
+int
+rbt_dump(rbt_t *const tree, FILE *const fp)
+{
+    return rbt_base_dump(tree, fp, myenc, NULL);
+}
+
+int
+rbt_load(rbt_t *const tree, int const fd, my_t *const objs)
+{
+    my_t *next = objs;
+    return rbt_base_load(tree, fd, mydec, NULL, &next);
+}
+
+int
+rbt_load_by_insert(rbt_t *const tree, int const fd, my_t *const objs)
+{
+    rbtfr_t r;
+    if (rbt_file_open(&r, fd) != 0)
+        return -1;
+
+    my_t *next = objs;
+    void const *rec;
+    size_t len;
+    while ((rec = rbt_file_next(&r, &len)) != NULL) {
+        rbt_base_add(tree, mydec(rec, len, &next), mycmp);
+    }
+
+    rbt_file_close(&r);
+
+    return 0;
+}
+
+static rbn_t *
+mymake(void const*const key, void *const ctx)
+{
+    (void)ctx;
+    my_t *const obj = malloc(sizeof(*obj));
+    if (obj == NULL)
+        return NULL;
+    obj->my_key = ((myk_t const*)key)->my_key;
+    return &obj->ok;
+}
+
+// Returns the element for the key, allocating it only if it isn't there yet
+my_t *
+rbt_find_or_insert(rbt_t *const tree, int key)
+{
+    myk_t const k = {
+        key,
+    };
+    rbn_t *v = rbt_base_find_or_insert(tree, &k, mykeycmp, mymake, NULL);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(my_t, ok));
+}
+
+my_t *
+rbt_finger(rbt_t *const tree, my_t *const cursor, int key)
+{
+    myk_t const k = {
+        key,
+    };
+    rbn_t *v = rbt_base_finger(tree, &cursor->ok, &k, mykeycmp);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(my_t, ok));
+}
+
+my_t *
+rbt_remove_at(rbt_t *const tree, my_t *const cursor)
+{
+    rbn_t *v = rbt_base_remove_at(tree, &cursor->ok);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(my_t, ok));
+}
+
+void
+rbt_insert_before(rbt_t *const tree, my_t *const cursor, my_t *const obj)
+{
+    rbt_base_insert_before(tree, (cursor == NULL) ? NULL : &cursor->ok, &obj->ok);
+}
+
+my_t *
+rbt_add_relaxed(rbt_t *const tree, my_t *const obj)
+{
+    rbn_t *v = rbt_base_add_relaxed(tree, &obj->ok, mycmp);
+    return (void *)((unsigned char *)v - offsetof(my_t, ok));
+}
+
+int
+rbt_rebalance(rbt_t *const tree, size_t budget)
+{
+    return rbt_base_rebalance(tree, budget);
+}
+
+wavl_t *
+wavl_create(void)
+{
+    wavl_t *const w = malloc(sizeof(*w));
+    if (w != NULL)
+        wavl_init(w);
+    return w;
+}
+
+void
+wavl_free(wavl_t *const w)
+{
+    free(w);
+}
+
+void
+wavl_setup(wavl_t *const w)
+{
+    wavl_init(w);
+}
+
+rbt_t *
+wavl_tree(wavl_t *const w)
+{
+    return &w->m_tree;
+}
+
+my_t *
+wavl_add(wavl_t *const w, my_t *const obj)
+{
+    rbn_t *v = wavl_base_add(w, &obj->ok, mycmp);
+    return (void *)((unsigned char *)v - offsetof(my_t, ok));
+}
+
+my_t *
+wavl_rem(wavl_t *const w, int key)
+{
+    myk_t const k = {
+        key,
+    };
+    rbn_t *v = wavl_base_rem(w, &k, mykeycmp);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(my_t, ok));
+}
+
+my_t *
+wavl_popmin(wavl_t *const w)
+{
+    rbn_t *v = wavl_base_popmin(w);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(my_t, ok));
+}
+
+// The finaliser of MurmurHash3, so every bit of the key reaches the low bits
+// that pick the slot
+__attribute__((const))
+static inline size_t
+myhashkey(int const key)
+{
+    uint64_t h = (uint32_t)key;
+    h ^= h >> 33;
+    h *= UINT64_C(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+    h *= UINT64_C(0xc4ceb9fe1a85ec53);
+    h ^= h >> 33;
+    return (size_t)h;
+}
+
+__attribute__((pure))
+static inline size_t
+mykeyhash(void const*const key)
+{
+    myk_t const*const k = key;
+    return myhashkey(k->my_key);
+}
+
+__attribute__((pure))
+static inline size_t
+myhash(rbn_t const*const n)
+{
+    my_t const*const o = (void *)((unsigned char *)n - offsetof(my_t, ok));
+    return myhashkey(o->my_key);
+}
+
+rbht_t *
+rbht_create(void)
+{
+    rbht_t *const h = malloc(sizeof(*h));
+    if (h != NULL)
+        rbht_init(h);
+    return h;
+}
+
+void
+rbht_free(rbht_t *const h)
+{
+    rbht_destroy(h);
+    free(h);
+}
+
+my_t *
+rbht_add(rbht_t *const h, my_t *const obj)
+{
+    rbn_t *v = rbht_base_add(h, &obj->ok, mycmp, myhash);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(my_t, ok));
+}
+
+my_t *
+rbht_get(rbht_t *const h, int key)
+{
+    myk_t const k = {
+        key,
+    };
+    rbn_t *v = rbht_base_get(h, &k, mykeyhash, mykeycmp);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(my_t, ok));
+}
+
+double
+rbt_mean_depth(rbt_t *const tree, unsigned *const p_height)
+{
+    rbt_shape_t shape;
+    rbt_shape(tree, &shape);
+
+    double mean = 0;
+    for (unsigned d = 0; d < shape.height; ++d)
+        mean += (double)shape.depth[d] * (d + 1);
+    if (rbt_size(tree) > 0)
+        mean /= (double)rbt_size(tree);
+
+    *p_height = shape.height;
+    return mean;
+}
+
+void
+rbt_report_reset(rbt_t *const tree)
+{
+#ifdef RBT_STATS
+    rbt_stats_reset(tree);
+#else
+    (void)tree;
+#endif
+}
+
+// Print the shape of the tree, and the counters per operation since the last
+// reset when they are compiled in
+void
+rbt_report(rbt_t *const tree, FILE *const fp, long const nops)
+{
+    rbt_shape_t shape;
+    rbt_shape(tree, &shape);
+
+    double mean = 0;
+    for (unsigned d = 0; d < shape.height; ++d)
+        mean += (double)shape.depth[d] * (d + 1);
+    if (rbt_size(tree) > 0)
+        mean /= (double)rbt_size(tree);
+
+    fprintf(fp, "shape: size %zu, height %u, black height %u, mean depth %.2f\n",
+            rbt_size(tree), shape.height, shape.black_height, mean);
+    fprintf(fp, "depth histogram:");
+    for (unsigned d = 0; d < shape.height; ++d)
+        fprintf(fp, " %zu", shape.depth[d]);
+    fprintf(fp, "\n");
+
+#ifdef RBT_STATS
+    rbt_stats_t st;
+    rbt_stats(tree, &st);
+    double const ops = (nops > 0) ? (double)nops : 1.0;
+    fprintf(fp, "per op: %.2f cmps, %.2f descents, %.2f rotl, %.2f rotr, "
+            "%.2f insert fixups, %.2f delete fixups, %.2f recolors\n",
+            st.cmps / ops, st.descents / ops, st.rotl / ops, st.rotr / ops,
+            st.ins_fixups / ops, st.del_fixups / ops, st.recolors / ops);
+    fprintf(fp, "depth per descent: %.2f\n",
+            (st.descents > 0) ? (double)st.depth / (double)st.descents : 0.0);
+#else
+    (void)nops;
+    fprintf(fp, "build with -DRBT_STATS for hot path counters\n");
+#endif
+}
@@ -1,7 +1,14 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdio.h>
+
 #include "rbttype.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 // Define the base type that contains an embedded node
 typedef struct my_type my_t;
 struct my_type {
@@ -13,3 +20,42 @@ my_t *rbt_add(rbt_t *const tree, my_t *const obj);
 my_t *rbt_get(rbt_t *const tree, int key);
 my_t *rbt_rem(rbt_t *const tree, int key);
 my_t *rbt_popmax(rbt_t *const tree);
+my_t *rbt_lt(rbt_t *const tree, int key);
+my_t *rbt_gt(rbt_t *const tree, int key);
+my_t *rbt_next(rbt_t *const tree, my_t *const obj);
+void rbt_relayout(rbt_t *const tree, my_t *const buf);
+int rbt_clone(rbt_t *const dst, rbt_t const*const src);
+void rbt_clone_into(rbt_t *const dst, rbt_t const*const src, my_t *const buf);
+my_t *rbt_popmin(rbt_t *const tree);
+size_t rbt_clear(rbt_t *const tree);
+int rbt_dump(rbt_t *const tree, FILE *const fp);
+int rbt_load(rbt_t *const tree, int const fd, my_t *const objs);
+int rbt_load_by_insert(rbt_t *const tree, int const fd, my_t *const objs);
+my_t *rbt_find_or_insert(rbt_t *const tree, int key);
+my_t *rbt_finger(rbt_t *const tree, my_t *const cursor, int key);
+my_t *rbt_remove_at(rbt_t *const tree, my_t *const cursor);
+void rbt_insert_before(rbt_t *const tree, my_t *const cursor, my_t *const obj);
+my_t *rbt_add_relaxed(rbt_t *const tree, my_t *const obj);
+int rbt_rebalance(rbt_t *const tree, size_t budget);
+// The same operations on a weak AVL tree, whose m_tree is there for lookups
+typedef struct weak_avl_tree wavl_t;
+wavl_t *wavl_create(void);
+void wavl_free(wavl_t *const w);
+void wavl_setup(wavl_t *const w);
+rbt_t *wavl_tree(wavl_t *const w);
+my_t *wavl_add(wavl_t *const w, my_t *const obj);
+my_t *wavl_rem(wavl_t *const w, int key);
+my_t *wavl_popmin(wavl_t *const w);
+// A tree with a hash index for exact lookups
+typedef struct red_black_hash_tree rbht_t;
+rbht_t *rbht_create(void);
+void rbht_free(rbht_t *const h);
+my_t *rbht_add(rbht_t *const h, my_t *const obj);
+my_t *rbht_get(rbht_t *const h, int key);
+double rbt_mean_depth(rbt_t *const tree, unsigned *const p_height);
+void rbt_report_reset(rbt_t *const tree);
+void rbt_report(rbt_t *const tree, FILE *const fp, long const nops);
+
+#ifdef __cplusplus
+}
+#endif
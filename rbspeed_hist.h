@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Log-linear latency histogram in the style of HdrHistogram. Values below
+ * 2*HIST_SUB are counted exactly, above that every power of two is split into
+ * HIST_SUB buckets, so a reported value is within 1/HIST_SUB of the truth.
+ */
+#define HIST_SUB_BITS 5
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_NBUCKETS ((64 - HIST_SUB_BITS) * HIST_SUB)
+
+typedef struct hist hist_t;
+struct hist {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[HIST_NBUCKETS];
+};
+
+static inline void
+hist_init(hist_t *const h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+__attribute__((const))
+static inline unsigned
+hist_index(uint64_t const v)
+{
+    if (v < 2 * HIST_SUB)
+        return (unsigned)v;
+
+    unsigned const e = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+    return (e + 1) * HIST_SUB + (unsigned)(v >> e) - HIST_SUB;
+}
+
+// Highest value that lands in the bucket
+__attribute__((const))
+static inline uint64_t
+hist_value(unsigned const idx)
+{
+    if (idx < 2 * HIST_SUB)
+        return idx;
+
+    unsigned const e = idx / HIST_SUB - 1;
+    uint64_t const m = idx % HIST_SUB + HIST_SUB;
+    return ((m + 1) << e) - 1;
+}
+
+static inline void
+hist_record(hist_t *const h, uint64_t const v)
+{
+    ++h->buckets[hist_index(v)];
+    ++h->count;
+    h->sum += v;
+    if (v > h->max)
+        h->max = v;
+}
+
+// Value at or below which the fraction q of the recorded values fall
+static inline uint64_t
+hist_percentile(hist_t const*const h, double const q)
+{
+    if (h->count == 0)
+        return 0;
+
+    uint64_t want = (uint64_t)(q * h->count + 0.5);
+    if (want == 0)
+        want = 1;
+
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < HIST_NBUCKETS; ++i) {
+        seen += h->buckets[i];
+        if (seen >= want)
+            return (hist_value(i) < h->max) ? hist_value(i) : h->max;
+    }
+
+    return h->max;
+}
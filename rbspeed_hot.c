@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+
+#include "rbhot.h"
+
+#include "rbspeed_util.h"
+#include "rbspeed_bench.h"
+
+typedef struct entry entry_t;
+struct entry {
+    rbn_t nd;
+    uint32_t key;
+};
+
+__attribute__((pure))
+static inline entry_t *
+entry_of(rbn_t const*const n)
+{
+    return (entry_t *)((unsigned char *)n - offsetof(entry_t, nd));
+}
+
+__attribute__((pure))
+static int
+entcmp(rbn_t const*const l, rbn_t const*const r)
+{
+    return (entry_of(l)->key > entry_of(r)->key) - (entry_of(l)->key < entry_of(r)->key);
+}
+
+__attribute__((pure))
+static int
+entkeycmp(void const*const key, rbn_t const*const r)
+{
+    uint32_t const k = *(uint32_t const*)key;
+    return (k > entry_of(r)->key) - (k < entry_of(r)->key);
+}
+
+__attribute__((pure))
+static size_t
+entkeyhash(void const*const key)
+{
+    return (size_t)((*(uint32_t const*)key * UINT64_C(0x9e3779b97f4a7c15)) >> 32);
+}
+
+// Fill `keys` with lookups of keys[rank], where rank k is drawn with weight
+// 1/(k+1)^s, or evenly if s is 0
+static void
+draw(uint32_t *const out, int const ops, uint32_t const*const keys, int const n, double const s,
+     double *const cdf, unsigned *const p_rng)
+{
+    if (s == 0) {
+        for (int i = 0; i < ops; ++i)
+            out[i] = keys[xorshift32(p_rng) % n];
+        return;
+    }
+
+    double total = 0;
+    for (int k = 0; k < n; ++k) {
+        total += pow(k + 1, -s);
+        cdf[k] = total;
+    }
+    for (int i = 0; i < ops; ++i) {
+        double const u = (double)xorshift32(p_rng) / UINT32_MAX * total;
+        int lo = 0, hi = n - 1;
+        while (lo < hi) {
+            int const mid = lo + (hi - lo) / 2;
+            if (cdf[mid] < u)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        out[i] = keys[lo];
+    }
+}
+
+/*
+ * Look keys up in a large tree with and without an rbhk_t cache in front, as
+ * the skew of the lookups goes from none to Zipf with s = 1.2. The hottest keys
+ * are scattered through the key space and through memory.
+ *
+ * usage: rbspeed hot [num_objs] [lookups] [sets]
+ */
+int
+bench_hot(int argc, char **argv)
+{
+    int const n = (argc > 1) ? atoi(argv[1]) : 1000000;
+    int const ops = (argc > 2) ? atoi(argv[2]) : 5000000;
+    int const sets = (argc > 3) ? atoi(argv[3]) : 1024;
+    if ((n <= 0) || (ops <= 0) || (sets <= 0)) {
+        fprintf(stderr, "usage: rbspeed hot [num_objs] [lookups] [sets]\n");
+        return 1;
+    }
+    unsigned rng = time(NULL);
+    struct timespec start, end;
+
+    rbhk_t h;
+    if (rbhk_init(&h, sets) != 0) {
+        perror("rbhk_init");
+        return 1;
+    }
+    // Distinct keys in random order, which is also the order of the ranks
+    entry_t *const objs = malloc(sizeof(*objs) * n);
+    uint32_t *const keys = malloc(sizeof(*keys) * n);
+    for (int i = 0; i < n; ++i)
+        keys[i] = (uint32_t)i * 2654435761u;
+    for (int i = n - 1; i > 0; --i) {
+        int const j = xorshift32(&rng) % (i + 1);
+        uint32_t const k = keys[i];
+        keys[i] = keys[j];
+        keys[j] = k;
+    }
+    for (int i = 0; i < n; ++i) {
+        objs[i].key = keys[i];
+        rbhk_base_add(&h, &objs[i].nd, entcmp);
+    }
+    for (int i = n - 1; i > 0; --i) {
+        int const j = xorshift32(&rng) % (i + 1);
+        uint32_t const k = keys[i];
+        keys[i] = keys[j];
+        keys[j] = k;
+    }
+
+    uint32_t *const lookups = malloc(sizeof(*lookups) * ops);
+    double *const cdf = malloc(sizeof(*cdf) * n);
+
+    printf("Ran test with a tree of size %d, %d lookups, %zu cached keys\n", n, ops,
+           (h.m_mask + 1) * RBHK_WAYS);
+    static double const skews[] = { 0, 0.5, 0.8, 1.0, 1.2 };
+    for (size_t si = 0; si < sizeof(skews) / sizeof(skews[0]); ++si) {
+        draw(lookups, ops, keys, n, skews[si], cdf, &rng);
+
+        uint64_t sums[2] = { 0, 0 };
+        double ns[2];
+        rbhk_flush(&h);
+        rbhk_stats_reset(&h);
+        for (int impl = 0; impl < 2; ++impl) {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (int i = 0; i < ops; ++i) {
+                rbn_t *const x = impl ? rbhk_base_get(&h, &lookups[i], entkeyhash, entkeycmp) :
+                                        rbt_base_get(&h.m_tree, &lookups[i], entkeycmp);
+                sums[impl] += entry_of(x)->key;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            ns[impl] = (double)elapsed_ns(&start, &end) / ops;
+        }
+        if (sums[0] != sums[1])
+            abort();
+
+        rbhk_stats_t st;
+        rbhk_stats(&h, &st);
+        double const rate = 100.0 * st.hits / (st.hits + st.misses);
+        if (skews[si] == 0)
+            printf("  uniform:    rbt_base_get %7.1f ns, rbhk_base_get %7.1f ns, %5.1f%% hits\n", ns[0], ns[1], rate);
+        else
+            printf("  zipf s=%.1f: rbt_base_get %7.1f ns, rbhk_base_get %7.1f ns, %5.1f%% hits\n", skews[si], ns[0],
+                   ns[1], rate);
+    }
+
+    free(cdf);
+    free(lookups);
+    free(keys);
+    free(objs);
+    rbhk_destroy(&h);
+
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include <map>
+
+#include "rbspeed_suite.h"
+
+// std::map baseline for the benchmark suite, holding the same elements
+
+typedef std::map<int, my_t *> map_t;
+
+static void *
+map_create(void)
+{
+    return new map_t;
+}
+
+static void
+map_destroy(void *const c)
+{
+    delete static_cast<map_t *>(c);
+}
+
+static my_t *
+map_add(void *const c, my_t *const obj)
+{
+    return static_cast<map_t *>(c)->emplace(obj->my_key, obj).first->second;
+}
+
+static my_t *
+map_get(void *const c, int const key)
+{
+    map_t *const m = static_cast<map_t *>(c);
+    map_t::iterator const it = m->find(key);
+    return (it == m->end()) ? NULL : it->second;
+}
+
+static my_t *
+map_rem(void *const c, int const key)
+{
+    map_t *const m = static_cast<map_t *>(c);
+    map_t::iterator const it = m->find(key);
+    if (it == m->end())
+        return NULL;
+    my_t *const obj = it->second;
+    m->erase(it);
+    return obj;
+}
+
+static my_t *
+map_lt(void *const c, int const key)
+{
+    map_t *const m = static_cast<map_t *>(c);
+    map_t::iterator it = m->lower_bound(key);
+    if (it == m->begin())
+        return NULL;
+    return (--it)->second;
+}
+
+static my_t *
+map_gt(void *const c, int const key)
+{
+    map_t *const m = static_cast<map_t *>(c);
+    map_t::iterator const it = m->upper_bound(key);
+    return (it == m->end()) ? NULL : it->second;
+}
+
+static long
+map_scan(void *const c, int const key, int const len)
+{
+    map_t *const m = static_cast<map_t *>(c);
+    long sum = 0;
+    map_t::iterator it = m->lower_bound(key);
+    for (int i = 0; (i < len) && (it != m->end()); ++i, ++it)
+        sum += it->first;
+    return sum;
+}
+
+static my_t *
+map_popmin(void *const c)
+{
+    map_t *const m = static_cast<map_t *>(c);
+    if (m->empty())
+        return NULL;
+    my_t *const obj = m->begin()->second;
+    m->erase(m->begin());
+    return obj;
+}
+
+extern "C" suite_impl_t const suite_map = {
+    "map",
+    map_create,
+    map_destroy,
+    map_add,
+    map_get,
+    map_rem,
+    map_lt,
+    map_gt,
+    map_scan,
+    map_popmin,
+    NULL,
+    NULL,
+};
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rbtpar.h"
+
+#include "rbspeed_util.h"
+#include "rbspeed_bench.h"
+
+typedef struct record record_t;
+struct record {
+    rbn_t nd;
+    uint64_t key;
+    uint64_t value;
+};
+
+__attribute__((pure))
+static inline int
+reccmp(rbn_t const*const ln, rbn_t const*const rn)
+{
+    record_t const*const l = (void *)((unsigned char *)ln - offsetof(record_t, nd));
+    record_t const*const r = (void *)((unsigned char *)rn - offsetof(record_t, nd));
+    return (l->key > r->key) - (l->key < r->key);
+}
+
+__attribute__((pure))
+static inline int
+reckeycmp(void const*const key, rbn_t const*const rn)
+{
+    uint64_t const l = *(uint64_t const*)key;
+    record_t const*const r = (void *)((unsigned char *)rn - offsetof(record_t, nd));
+    return (l > r->key) - (l < r->key);
+}
+
+// The aggregate is a count and a checksum that depends on the visiting order
+struct agg {
+    uint64_t count;
+    uint64_t sum;
+};
+
+static void
+agg_visit(rbn_t *const x, void *const ctx)
+{
+    struct agg *const a = ctx;
+    record_t const*const r = (void *)((unsigned char *)x - offsetof(record_t, nd));
+    a->sum = a->sum * 31 + r->value;
+    ++a->count;
+}
+
+static void
+agg_reduce(void *const acc, void const*const piece)
+{
+    struct agg *const a = acc;
+    struct agg const*const p = piece;
+    uint64_t scale = 1;
+    uint64_t base = 31;
+    for (uint64_t e = p->count; e != 0; e >>= 1) {
+        if (e & 1)
+            scale *= base;
+        base *= base;
+    }
+    a->sum = a->sum * scale + p->sum;
+    a->count += p->count;
+}
+
+/*
+ * Aggregate every element of a large tree built from random inserts, and the
+ * middle half of its key range, with rbt_base_next and with
+ * rbt_base_parallel_for_each on 1 up to `max_threads` threads. The aggregate
+ * depends on the order the elements are seen in, so the ordered reduction has
+ * to put the pieces back together correctly for the results to agree.
+ *
+ * usage: rbspeed parscan [num_objs] [max_threads]
+ */
+int
+bench_parscan(int argc, char **argv)
+{
+    long const ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int const n = (argc > 1) ? atoi(argv[1]) : 10000000;
+    int const max_threads = (argc > 2) ? atoi(argv[2]) : ((ncpu > 1) ? (int)ncpu : 4);
+    if ((n <= 0) || (max_threads <= 0)) {
+        fprintf(stderr, "usage: rbspeed parscan [num_objs] [max_threads]\n");
+        return 1;
+    }
+    unsigned rng = time(NULL);
+
+    record_t *const objs = malloc(sizeof(*objs) * n);
+    rbt_t tree;
+    rbt_init(&tree);
+    for (int i = 0; i < n; ++i) {
+        objs[i].key = ((uint64_t)xorshift32(&rng) << 32) | xorshift32(&rng);
+        objs[i].value = xorshift32(&rng);
+        rbt_base_add(&tree, &objs[i].nd, reccmp);
+    }
+
+    printf("Ran test with %zu elements on %ld cpus\n", rbt_size(&tree), ncpu);
+
+    struct timespec start, end;
+    for (int range = 0; range < 2; ++range) {
+        uint64_t const lo = UINT64_MAX / 4;
+        uint64_t const hi = UINT64_MAX / 4 * 3;
+
+        struct agg want = { 0, 0 };
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        rbn_t *x = range ? rbt_base_lower_bound(&tree, &lo, reckeycmp) : rbt_base_min(&tree);
+        for (; x != NULL; x = rbt_base_next(&tree, x, reccmp)) {
+            if (range && (reckeycmp(&hi, x) <= 0))
+                break;
+            agg_visit(x, &want);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double const base_ns = (double)elapsed_ns(&start, &end);
+        printf("%-6s rbt_base_next     %8.1f ms  %6.1f M/s\n", range ? "middle" : "all",
+               base_ns / 1e6, (double)want.count / base_ns * 1e3);
+
+        for (int t = 1; t <= max_threads; ++t) {
+            struct agg got = { 0, 0 };
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            if (rbt_base_parallel_for_each(&tree, range ? &lo : NULL, range ? &hi : NULL, reckeycmp,
+                                           agg_visit, &got, sizeof(got), agg_reduce, t) != 0) {
+                perror("rbt_base_parallel_for_each");
+                abort();
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            if ((got.count != want.count) || (got.sum != want.sum))
+                abort();
+            double const ns = (double)elapsed_ns(&start, &end);
+            printf("%-6s %2d thread%s        %8.1f ms  %6.1f M/s  %.2fx\n", range ? "middle" : "all",
+                   t, (t == 1) ? " " : "s", ns / 1e6, (double)got.count / ns * 1e3, base_ns / ns);
+        }
+    }
+
+    free(objs);
+
+    return 0;
+}
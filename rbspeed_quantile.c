@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "rbquantile.h"
+
+#include "rbspeed_util.h"
+#include "rbspeed_bench.h"
+
+static int
+cmp_u64(void const*const l, void const*const r)
+{
+    uint64_t const a = *(uint64_t const*)l;
+    uint64_t const b = *(uint64_t const*)r;
+    return (a > b) - (a < b);
+}
+
+// Where rbq_quantile finds phi in n sorted samples
+static size_t
+nearest_rank(double const phi, size_t const n)
+{
+    double const r = phi * (double)n;
+    size_t const k = (r <= 1.0) ? 0 : (size_t)r - ((double)(size_t)r == r);
+    return (k >= n) ? n - 1 : k;
+}
+
+// A latency in ns, mostly around a microsecond with a long tail
+static uint64_t
+latency(unsigned *const p_rng)
+{
+    unsigned const r = xorshift32(p_rng);
+    uint64_t v = 800 + (r % 400);
+    if ((r >> 16) % 100 == 0)
+        v += xorshift32(p_rng) % 100000;
+    return v;
+}
+
+/*
+ * Stream latency samples through a sliding window of the last `window` of
+ * them and report p50, p95 and p99 every `every` samples, as a service taking
+ * a million samples a second would ten times a second. The window is kept in
+ * an rbq_t and, for comparison, as a ring of values that a sorted copy is made
+ * of for each report.
+ *
+ * usage: rbspeed quantile [window] [samples] [every]
+ */
+int
+bench_quantile(int argc, char **argv)
+{
+    int const window = (argc > 1) ? atoi(argv[1]) : 1000000;
+    int const samples = (argc > 2) ? atoi(argv[2]) : 5000000;
+    int const every = (argc > 3) ? atoi(argv[3]) : 100000;
+    if ((window <= 0) || (every <= 0) || (samples < every)) {
+        fprintf(stderr, "usage: rbspeed quantile [window] [samples] [every]\n");
+        return 1;
+    }
+    static double const phis[] = { 0.5, 0.95, 0.99 };
+    enum { NPHI = sizeof(phis) / sizeof(phis[0]) };
+    unsigned const seed = time(NULL);
+    struct timespec start, end;
+
+    rbq_t q;
+    if (rbq_init(&q, window) != 0) {
+        perror("rbq_init");
+        return 1;
+    }
+    uint64_t *const ring = malloc(sizeof(*ring) * window);
+    uint64_t *const sorted = malloc(sizeof(*sorted) * window);
+    int const reports = samples / every;
+    uint64_t *const got = malloc(sizeof(*got) * NPHI * reports);
+
+    printf("Ran test with a window of %d samples, %d samples, reporting every %d\n", window, samples, every);
+
+    double add_ns[2] = { 0, 0 };
+    double report_ns[2] = { 0, 0 };
+    for (int impl = 0; impl < 2; ++impl) {
+        unsigned rng = seed;
+        for (int r = 0; r < reports; ++r) {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (int i = r * every; i < (r + 1) * every; ++i) {
+                uint64_t const v = latency(&rng);
+                if (impl)
+                    rbq_add(&q, v);
+                else
+                    ring[i % window] = v;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            add_ns[impl] += elapsed_ns(&start, &end);
+
+            size_t const n = ((r + 1) * every < window) ? (size_t)(r + 1) * every : (size_t)window;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            if (impl) {
+                for (int p = 0; p < NPHI; ++p) {
+                    if (rbq_quantile(&q, phis[p])->value != got[r * NPHI + p])
+                        abort();
+                }
+            } else {
+                memcpy(sorted, ring, sizeof(*ring) * n);
+                qsort(sorted, n, sizeof(*sorted), cmp_u64);
+                for (int p = 0; p < NPHI; ++p)
+                    got[r * NPHI + p] = sorted[nearest_rank(phis[p], n)];
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            report_ns[impl] += elapsed_ns(&start, &end);
+        }
+    }
+    printf("last report: p50 %llu ns, p95 %llu ns, p99 %llu ns\n",
+           (unsigned long long)got[(reports - 1) * NPHI], (unsigned long long)got[(reports - 1) * NPHI + 1],
+           (unsigned long long)got[(reports - 1) * NPHI + 2]);
+
+    for (int impl = 0; impl < 2; ++impl) {
+        // CPU time spent per second of a million samples a second
+        double const per_second = (add_ns[impl] + report_ns[impl]) / ((double)reports * every) * 1e6 / 1e9;
+        printf("%-11s %7.1f ns per sample, %9.1f us per report, %5.1f%% of a cpu at 1M samples/s\n",
+               impl ? "rbq_t" : "sorted copy", add_ns[impl] / ((double)reports * every), report_ns[impl] / reports / 1e3,
+               per_second * 100);
+    }
+
+    free(got);
+    free(sorted);
+    free(ring);
+    rbq_destroy(&q);
+
+    return 0;
+}
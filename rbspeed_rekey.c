@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "rbtree.h"
+
+#include "rbspeed_util.h"
+#include "rbspeed_bench.h"
+
+// A vertex in the queue is ordered by its tentative distance, then its id
+typedef struct vertex vertex_t;
+struct vertex {
+    rbn_t nd;
+    uint64_t key;
+};
+
+#define KEY(dist, id) (((uint64_t)(dist) << 32) | (uint32_t)(id))
+
+__attribute__((pure))
+static inline int
+vcmp(rbn_t const*const ln, rbn_t const*const rn)
+{
+    vertex_t const*const l = (void *)((unsigned char *)ln - offsetof(vertex_t, nd));
+    vertex_t const*const r = (void *)((unsigned char *)rn - offsetof(vertex_t, nd));
+    return (l->key > r->key) - (l->key < r->key);
+}
+
+__attribute__((pure))
+static inline int
+vkeycmp(void const*const key, rbn_t const*const rn)
+{
+    uint64_t const l = *(uint64_t const*)key;
+    vertex_t const*const r = (void *)((unsigned char *)rn - offsetof(vertex_t, nd));
+    return (l > r->key) - (l < r->key);
+}
+
+struct graph {
+    int n;
+    int *first;     // edges of vertex v are first[v] .. first[v + 1] - 1
+    int *to;
+    uint32_t *weight;
+};
+
+// Returns the sum of the distances of the reachable vertices, and the number
+// of decrease-key operations and the time spent in them
+static uint64_t
+dijkstra(struct graph const*const g, vertex_t *const vs, int const rekey, size_t *const p_decreases,
+         uint64_t *const p_ns)
+{
+    struct timespec start, end;
+    uint64_t ns = 0;
+    uint32_t const unseen = UINT32_MAX;
+    rbt_t q;
+    rbt_init(&q);
+    for (int v = 0; v < g->n; ++v) {
+        vs[v].nd.p = NULL;
+        vs[v].key = KEY(unseen, v);
+    }
+
+    vs[0].key = KEY(0, 0);
+    rbt_base_add(&q, &vs[0].nd, vcmp);
+
+    uint64_t total = 0;
+    size_t decreases = 0;
+    rbn_t *x;
+    while ((x = rbt_base_popmin(&q)) != NULL) {
+        vertex_t *const u = (void *)((unsigned char *)x - offsetof(vertex_t, nd));
+        uint32_t const d = (uint32_t)(u->key >> 32);
+        total += d;
+
+        for (int e = g->first[u - vs]; e < g->first[u - vs + 1]; ++e) {
+            vertex_t *const v = &vs[g->to[e]];
+            uint32_t const old = (uint32_t)(v->key >> 32);
+            uint32_t const nd = d + g->weight[e];
+            // Already settled
+            if ((v->nd.p == NULL) && (old != unseen))
+                continue;
+            if (old == unseen) {
+                v->key = KEY(nd, g->to[e]);
+                rbt_base_add(&q, &v->nd, vcmp);
+            } else if (nd < old) {
+                ++decreases;
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                if (rekey) {
+                    v->key = KEY(nd, g->to[e]);
+                    rbt_base_rekey(&q, &v->nd, vcmp);
+                } else {
+                    rbt_base_rem(&q, &v->key, vkeycmp);
+                    v->key = KEY(nd, g->to[e]);
+                    rbt_base_add(&q, &v->nd, vcmp);
+                }
+                clock_gettime(CLOCK_MONOTONIC, &end);
+                ns += elapsed_ns(&start, &end);
+            }
+        }
+    }
+
+    *p_decreases = decreases;
+    *p_ns = ns;
+    return total;
+}
+
+/*
+ * Shortest paths over a random graph where each vertex has edges to some
+ * nearby vertices and a few far away ones, so that the frontier is large and
+ * keys are lowered often. Decrease-key is done with rbt_base_rekey, and with
+ * a remove and an add.
+ *
+ * usage: rbspeed rekey [num_vertices] [degree]
+ */
+int
+bench_rekey(int argc, char **argv)
+{
+    int const n = (argc > 1) ? atoi(argv[1]) : 1000000;
+    int const degree = (argc > 2) ? atoi(argv[2]) : 8;
+    if ((n <= 1) || (degree <= 0)) {
+        fprintf(stderr, "usage: rbspeed rekey [num_vertices] [degree]\n");
+        return 1;
+    }
+    unsigned rng = time(NULL);
+
+    struct graph g = {
+        .n = n,
+        .first = malloc(sizeof(*g.first) * (n + 1)),
+        .to = malloc(sizeof(*g.to) * (size_t)n * degree),
+        .weight = malloc(sizeof(*g.weight) * (size_t)n * degree),
+    };
+    vertex_t *const vs = malloc(sizeof(*vs) * n);
+    for (int v = 0; v < n; ++v) {
+        g.first[v] = v * degree;
+        for (int e = v * degree; e < (v + 1) * degree; ++e) {
+            unsigned const r = xorshift32(&rng);
+            g.to[e] = (r % 4 == 0) ? (int)(xorshift32(&rng) % n) : (v + 1 + (int)(r >> 2) % 64) % n;
+            g.weight[e] = 1 + xorshift32(&rng) % 1000;
+        }
+    }
+    g.first[n] = n * degree;
+
+    printf("Ran test with %d vertices of degree %d\n", n, degree);
+
+    uint64_t totals[2];
+    struct timespec start, end;
+    for (int rekey = 0; rekey < 2; ++rekey) {
+        size_t decreases;
+        uint64_t ns;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        totals[rekey] = dijkstra(&g, vs, rekey, &decreases, &ns);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        printf("%-10s %f milliseconds, %zu decrease-keys at %.1f ns each\n",
+               rekey ? "rekey" : "rem+add", elapsed_ns(&start, &end) / 1e6, decreases,
+               (decreases > 0) ? (double)ns / (double)decreases : 0.0);
+    }
+    if (totals[0] != totals[1])
+        abort();
+
+    free(vs);
+    free(g.weight);
+    free(g.to);
+    free(g.first);
+
+    return 0;
+}
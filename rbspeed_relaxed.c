@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "rbspeed_helper.h"
+#include "rbspeed_util.h"
+#include "rbspeed_hist.h"
+#include "rbspeed_bench.h"
+
+static void
+fill(rbt_t *const tree, my_t *const objs, int const n, unsigned *const p_rng)
+{
+    rbt_init(tree);
+    for (int i = 0; i < n; ++i) {
+        do {
+            objs[i].my_key = (int)(xorshift32(p_rng) & 0x7fffffffu);
+        } while (rbt_add(tree, &objs[i]) != &objs[i]);
+    }
+}
+
+static void
+print_hist(char const*const what, hist_t const*const h)
+{
+    printf("%-32s mean %8.1f  p50 %6" PRIu64 "  p99 %6" PRIu64 "  p999 %7" PRIu64 "  max %8" PRIu64 "\n",
+           what, (double)h->sum / (double)h->count, hist_percentile(h, 0.5),
+           hist_percentile(h, 0.99), hist_percentile(h, 0.999), h->max);
+}
+
+// Time random lookups of present keys. With a budget, each is followed by a
+// timed rebalancing step while there is still work pending.
+static void
+time_gets(rbt_t *const tree, my_t *const objs, int const n, int const ops, size_t const budget,
+          unsigned *const p_rng, hist_t *const h, hist_t *const steps)
+{
+    struct timespec start, end;
+    hist_init(h);
+    int pending = (budget > 0);
+    for (int i = 0; i < ops; ++i) {
+        my_t const*const obj = &objs[xorshift32(p_rng) % n];
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        my_t *const g = rbt_get(tree, obj->my_key);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        hist_record(h, elapsed_ns(&start, &end));
+        if (g != obj)
+            abort();
+        if (pending) {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            pending = rbt_rebalance(tree, budget);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            hist_record(steps, elapsed_ns(&start, &end));
+        }
+    }
+}
+
+/*
+ * Insert a burst into a populated tree with the regular and the relaxed
+ * insert, then time lookups while the deferred work is paid off a little after
+ * each one, and after it is all done.
+ *
+ * usage: rbspeed relaxed [num_objs] [burst] [budget]
+ */
+int
+bench_relaxed(int argc, char **argv)
+{
+    int const n = (argc > 1) ? atoi(argv[1]) : 1000000;
+    int const burst = (argc > 2) ? atoi(argv[2]) : 200000;
+    int const budget = (argc > 3) ? atoi(argv[3]) : 64;
+    if ((n <= 0) || (burst <= 0) || (budget <= 0)) {
+        fprintf(stderr, "usage: rbspeed relaxed [num_objs] [burst] [budget]\n");
+        return 1;
+    }
+    int const total = n + burst;
+    unsigned const seed = time(NULL);
+
+    my_t *const objs = malloc(sizeof(*objs) * total);
+    hist_t *const h = malloc(sizeof(*h));
+    hist_t *const steps = malloc(sizeof(*steps));
+    rbt_t tree;
+    struct timespec start, end;
+
+    printf("Ran test with a tree of size %d, burst of %d, budget %d\n", n, burst, budget);
+
+    for (int relaxed = 0; relaxed < 2; ++relaxed) {
+        unsigned rng = seed;
+        fill(&tree, objs, n, &rng);
+
+        hist_init(h);
+        for (int i = n; i < total; ++i) {
+            my_t *a;
+            do {
+                objs[i].my_key = (int)(xorshift32(&rng) & 0x7fffffffu);
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                a = relaxed ? rbt_add_relaxed(&tree, &objs[i]) : rbt_add(&tree, &objs[i]);
+                clock_gettime(CLOCK_MONOTONIC, &end);
+            } while (a != &objs[i]);
+            hist_record(h, elapsed_ns(&start, &end));
+        }
+        print_hist(relaxed ? "relaxed insert" : "insert", h);
+
+        if (relaxed) {
+            hist_init(steps);
+            time_gets(&tree, objs, total, burst, budget, &rng, h, steps);
+            print_hist("get while rebalancing", h);
+            print_hist("rebalancing step", steps);
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            rbt_rebalance(&tree, SIZE_MAX);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            printf("%-32s %f milliseconds in steps, %f after the gets\n", "rebalancing",
+                   steps->sum / 1e6, elapsed_ns(&start, &end) / 1e6);
+        }
+
+        time_gets(&tree, objs, total, burst, 0, &rng, h, NULL);
+        print_hist(relaxed ? "get after rebalancing" : "get", h);
+    }
+
+    free(steps);
+    free(h);
+    free(objs);
+
+    return 0;
+}
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+
+#include "rbspeed_helper.h"
+#include "rbspeed_util.h"
+#include "rbspeed_bench.h"
+
+#define NUM_GETS (1 << 22)
+#define NUM_JUNK 4096
+
+static int
+random_key(unsigned *const p_rng)
+{
+    return (int)(xorshift32(p_rng) & 0x7fffffffu);
+}
+
+static double
+time_gets(rbt_t *const tree, int const*const keys, int const n, unsigned *const p_rng)
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < NUM_GETS; ++i) {
+        int const key = keys[xorshift32(p_rng) % n];
+        my_t *const g = rbt_get(tree, key);
+        assert(g != NULL && g->my_key == key);
+        (void)g;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return 1.0 * elapsed_ns(&start, &end) / NUM_GETS;
+}
+
+static my_t *
+new_obj(rbt_t *const tree, unsigned *const p_rng)
+{
+    my_t *const obj = malloc(sizeof(*obj));
+    do {
+        obj->my_key = random_key(p_rng);
+    } while (rbt_add(tree, obj) != obj);
+    return obj;
+}
+
+/*
+ * Age a tree of individually allocated nodes with random churn, interleaved
+ * with unrelated allocations of random sizes so the nodes scatter across the
+ * heap, then compare lookups before and after a relayout against a tree that
+ * was freshly built from one array.
+ *
+ * usage: rbspeed relayout [num_objs] [churn_rounds]
+ */
+int
+bench_relayout(int argc, char **argv)
+{
+    int const n = (argc > 1) ? atoi(argv[1]) : (1 << 20);
+    long const rounds = (argc > 2) ? atol(argv[2]) : 4L * n;
+    if (n <= 0 || rounds < 0) {
+        fprintf(stderr, "usage: rbspeed relayout [num_objs] [churn_rounds]\n");
+        return 1;
+    }
+    unsigned rng = time(NULL);
+
+    rbt_t tree;
+    rbt_init(&tree);
+
+    my_t **const objs = malloc(sizeof(*objs) * n);
+    int *const keys = malloc(sizeof(*keys) * n);
+    void **const junk = calloc(NUM_JUNK, sizeof(*junk));
+
+    for (int i = 0; i < n; ++i) {
+        objs[i] = new_obj(&tree, &rng);
+    }
+
+    for (long i = 0; i < rounds; ++i) {
+        unsigned const idx = xorshift32(&rng) % n;
+        my_t *const e = rbt_rem(&tree, objs[idx]->my_key);
+        assert(e == objs[idx]);
+        free(e);
+
+        unsigned const j = xorshift32(&rng) % NUM_JUNK;
+        free(junk[j]);
+        junk[j] = malloc(16 + xorshift32(&rng) % 256);
+
+        objs[idx] = new_obj(&tree, &rng);
+    }
+
+    for (int i = 0; i < n; ++i) {
+        keys[i] = objs[i]->my_key;
+    }
+
+    printf("Ran test with a tree of size %d after %ld churn rounds\n", n, rounds);
+    printf("Average time to get a node (aged): %f nanoseconds\n", time_gets(&tree, keys, n, &rng));
+
+    my_t *const buf = malloc(sizeof(*buf) * n);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    rbt_relayout(&tree, buf);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    for (int i = 0; i < n; ++i) {
+        free(objs[i]);
+    }
+
+    printf("Time to relayout: %f milliseconds\n", elapsed_ns(&start, &end) / 1e6);
+    printf("Average time to get a node (relayout): %f nanoseconds\n", time_gets(&tree, keys, n, &rng));
+
+    rbt_t fresh;
+    rbt_init(&fresh);
+    my_t *const arr = malloc(sizeof(*arr) * n);
+    for (int i = 0; i < n; ++i) {
+        arr[i].my_key = keys[i];
+        rbt_add(&fresh, &arr[i]);
+    }
+    printf("Average time to get a node (fresh): %f nanoseconds\n", time_gets(&fresh, keys, n, &rng));
+
+    for (int i = 0; i < NUM_JUNK; ++i) {
+        free(junk[i]);
+    }
+    free(arr);
+    free(buf);
+    free(junk);
+    free(keys);
+    free(objs);
+
+    return 0;
+}
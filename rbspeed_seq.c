@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "rbseq.h"
+
+#include "rbspeed_util.h"
+#include "rbspeed_bench.h"
+
+typedef struct item item_t;
+struct item {
+    rbsn_t sn;
+    uint32_t value;
+};
+
+__attribute__((pure))
+static inline item_t *
+item_of(rbn_t const*const n)
+{
+    return (item_t *)((unsigned char *)rbs_of(n) - offsetof(item_t, sn));
+}
+
+enum { OP_INSERT, OP_REMOVE, OP_READ };
+
+struct edit {
+    int op;
+    size_t at;
+    uint32_t value;
+};
+
+// Inserts and removes in equal measure with a read for every two, either
+// anywhere or within a short distance of the last edit, as typing would be
+static void
+make_edits(struct edit *const edits, int const ops, size_t n, int const local, unsigned *const p_rng)
+{
+    size_t at = n / 2;
+    for (int i = 0; i < ops; ++i) {
+        unsigned const r = xorshift32(p_rng);
+        int const op = (n == 0) ? OP_INSERT : (r % 5 < 2) ? OP_INSERT : (r % 5 < 4) ? OP_REMOVE : OP_READ;
+        size_t const bound = n + (op == OP_INSERT);
+        if (local) {
+            size_t const d = (r >> 8) % 64;
+            at = ((r >> 16) & 1) ? at + d : (at > d ? at - d : 0);
+            if (at >= bound)
+                at = bound - 1;
+        } else {
+            at = xorshift32(p_rng) % bound;
+        }
+        edits[i] = (struct edit){ op, at, r };
+        n += (op == OP_INSERT) - (op == OP_REMOVE);
+    }
+}
+
+static uint64_t
+run_tree(rbs_t *const seq, item_t *const items, size_t used, struct edit const*const edits, int const ops)
+{
+    item_t **const free_items = malloc(sizeof(*free_items) * ops);
+    size_t nfree = 0;
+    uint64_t sum = 0;
+    for (int i = 0; i < ops; ++i) {
+        if (edits[i].op == OP_INSERT) {
+            item_t *const it = (nfree > 0) ? free_items[--nfree] : &items[used++];
+            it->value = edits[i].value;
+            rbs_insert_at(seq, edits[i].at, &it->sn);
+        } else if (edits[i].op == OP_REMOVE) {
+            free_items[nfree++] = item_of(rbs_remove_at(seq, edits[i].at));
+        } else {
+            sum += item_of(rbs_at(seq, edits[i].at))->value;
+        }
+    }
+    free(free_items);
+    return sum;
+}
+
+static uint64_t
+run_vector(uint32_t *const v, size_t n, struct edit const*const edits, int const ops)
+{
+    uint64_t sum = 0;
+    for (int i = 0; i < ops; ++i) {
+        size_t const at = edits[i].at;
+        if (edits[i].op == OP_INSERT) {
+            memmove(&v[at + 1], &v[at], sizeof(*v) * (n - at));
+            v[at] = edits[i].value;
+            ++n;
+        } else if (edits[i].op == OP_REMOVE) {
+            memmove(&v[at], &v[at + 1], sizeof(*v) * (n - at - 1));
+            --n;
+        } else {
+            sum += v[at];
+        }
+    }
+    return sum;
+}
+
+// The values before the gap sit at the front, the rest at the back
+struct gap {
+    uint32_t *buf;
+    size_t start;
+    size_t end;
+};
+
+static void
+gap_move(struct gap *const g, size_t const at)
+{
+    if (at < g->start) {
+        size_t const len = g->start - at;
+        memmove(&g->buf[g->end - len], &g->buf[at], sizeof(*g->buf) * len);
+        g->end -= len;
+    } else if (at > g->start) {
+        size_t const len = at - g->start;
+        memmove(&g->buf[g->start], &g->buf[g->end], sizeof(*g->buf) * len);
+        g->end += len;
+    }
+    g->start = at;
+}
+
+static uint64_t
+run_gap(struct gap *const g, struct edit const*const edits, int const ops)
+{
+    uint64_t sum = 0;
+    for (int i = 0; i < ops; ++i) {
+        size_t const at = edits[i].at;
+        if (edits[i].op == OP_INSERT) {
+            gap_move(g, at);
+            g->buf[g->start++] = edits[i].value;
+        } else if (edits[i].op == OP_REMOVE) {
+            gap_move(g, at);
+            ++g->end;
+        } else {
+            sum += g->buf[(at < g->start) ? at : at + (g->end - g->start)];
+        }
+    }
+    return sum;
+}
+
+/*
+ * Edit a sequence of values by position: as an rbs_t, as a gap buffer and as
+ * a plain array, with the edits at random positions and then close together.
+ * All three have to end up the same.
+ *
+ * usage: rbspeed seq [num_objs] [edits]
+ */
+int
+bench_seq(int argc, char **argv)
+{
+    int const n = (argc > 1) ? atoi(argv[1]) : 100000;
+    int const ops = (argc > 2) ? atoi(argv[2]) : 100000;
+    if ((n <= 0) || (ops <= 0)) {
+        fprintf(stderr, "usage: rbspeed seq [num_objs] [edits]\n");
+        return 1;
+    }
+    unsigned rng = time(NULL);
+    struct timespec start, end;
+
+    size_t const cap = (size_t)n + ops;
+    item_t *const items = malloc(sizeof(*items) * cap);
+    uint32_t *const vec = malloc(sizeof(*vec) * cap);
+    struct gap gap = { malloc(sizeof(*gap.buf) * cap), 0, 0 };
+    struct edit *const edits = malloc(sizeof(*edits) * ops);
+
+    printf("Ran test with sequences of %d values, %d edits\n", n, ops);
+    for (int local = 0; local < 2; ++local) {
+        rbsf_t forest;
+        rbsf_init(&forest);
+        rbs_t seq;
+        rbs_init(&seq, &forest);
+        for (int i = 0; i < n; ++i) {
+            uint32_t const v = xorshift32(&rng);
+            items[i].value = v;
+            rbs_insert_at(&seq, i, &items[i].sn);
+            vec[i] = v;
+            gap.buf[i] = v;
+        }
+        gap.start = n;
+        gap.end = cap;
+        make_edits(edits, ops, n, local, &rng);
+
+        uint64_t sums[3];
+        double ns[3];
+        for (int impl = 0; impl < 3; ++impl) {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            if (impl == 0)
+                sums[impl] = run_tree(&seq, items, n, edits, ops);
+            else if (impl == 1)
+                sums[impl] = run_gap(&gap, edits, ops);
+            else
+                sums[impl] = run_vector(vec, n, edits, ops);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            ns[impl] = (double)elapsed_ns(&start, &end) / ops;
+        }
+        if ((sums[0] != sums[1]) || (sums[0] != sums[2]))
+            abort();
+
+        // Check the three agree all the way through
+        gap_move(&gap, rbs_size(&seq));
+        size_t i = 0;
+        for (rbn_t *x = rbs_at(&seq, 0); x != NULL; x = rbs_next(&seq, x), ++i) {
+            if ((item_of(x)->value != vec[i]) || (item_of(x)->value != gap.buf[i]))
+                abort();
+        }
+
+        printf("  %-6s edits: rbs_t %8.1f ns, gap buffer %8.1f ns, array %8.1f ns\n",
+               local ? "local" : "random", ns[0], ns[1], ns[2]);
+        if (local)
+            break;
+
+        // Cut a random block and paste it somewhere else, with three splits
+        // and three joins, or by copying it out and shifting what is between
+        size_t const len = rbs_size(&seq);
+        int const moves = ops / 10 + 1;
+        uint32_t *const block = malloc(sizeof(*block) * len);
+        double move_ns[2];
+        unsigned const move_seed = rng;
+        for (int impl = 0; impl < 2; ++impl) {
+            rng = move_seed;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (int m = 0; m < moves; ++m) {
+                size_t a = xorshift32(&rng) % (len + 1);
+                size_t b = xorshift32(&rng) % (len + 1);
+                if (a > b) {
+                    size_t const t = a;
+                    a = b;
+                    b = t;
+                }
+                size_t const to = xorshift32(&rng) % (len - (b - a) + 1);
+                if (impl == 0) {
+                    rbs_t cut, rest;
+                    rbs_init(&cut, &forest);
+                    rbs_init(&rest, &forest);
+                    rbs_split(&seq, a, &cut);
+                    rbs_split(&cut, b - a, &rest);
+                    rbs_concat(&seq, &rest);
+                    rbs_split(&seq, to, &rest);
+                    rbs_concat(&seq, &cut);
+                    rbs_concat(&seq, &rest);
+                } else {
+                    memcpy(block, &vec[a], sizeof(*vec) * (b - a));
+                    memmove(&vec[a], &vec[b], sizeof(*vec) * (len - b));
+                    memmove(&vec[to + (b - a)], &vec[to], sizeof(*vec) * (len - (b - a) - to));
+                    memcpy(&vec[to], block, sizeof(*vec) * (b - a));
+                }
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            move_ns[impl] = (double)elapsed_ns(&start, &end) / moves;
+        }
+        free(block);
+
+        i = 0;
+        for (rbn_t *x = rbs_at(&seq, 0); x != NULL; x = rbs_next(&seq, x), ++i) {
+            if (item_of(x)->value != vec[i])
+                abort();
+        }
+        printf("  block moves:  rbs_t %8.1f ns, array %8.1f ns\n", move_ns[0], move_ns[1]);
+    }
+
+    free(edits);
+    free(gap.buf);
+    free(vec);
+    free(items);
+
+    return 0;
+}
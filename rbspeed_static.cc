@@ -0,0 +1,133 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <ctime>
+
+#include "rbtstatic.hh"
+
+#include "rbspeed_helper.h"
+#include "rbspeed_util.h"
+#include "rbspeed_bench.h"
+
+// A table of error codes and what they map to, as it might be shipped
+struct code {
+    int32_t key;
+    int32_t value;
+};
+
+// Enough to show the difference while keeping the build quick, see rbtstatic.hh
+constexpr std::size_t NCODES = 20000;
+
+constexpr std::array<code, NCODES>
+make_codes()
+{
+    std::array<code, NCODES> a{};
+    for (std::size_t i = 0; i < NCODES; ++i) {
+        // Distinct scattered keys, in no particular order
+        a[i].key = static_cast<int32_t>((i * 2654435761u) & 0x7fffffffu);
+        a[i].value = static_cast<int32_t>(i);
+    }
+    return a;
+}
+
+constexpr std::array<code, NCODES> source = make_codes();
+
+static inline int
+codecmp(void const *const key, code const *const c)
+{
+    int32_t const k = *static_cast<int32_t const *>(key);
+    return (k > c->key) - (k < c->key);
+}
+
+constexpr rbt::static_index<code, NCODES> table(source, [](code const &l, code const &r) {
+    return l.key < r.key;
+});
+
+// Checked while compiling
+consteval bool
+table_in_order()
+{
+    int32_t prev = -1;
+    std::size_t n = 0;
+    for (code const &c : table) {
+        if (c.key <= prev)
+            return false;
+        prev = c.key;
+        ++n;
+    }
+    return n == NCODES;
+}
+static_assert(table_in_order());
+
+/*
+ * Look up error codes, about half of them present, in a table that the
+ * compiler built and in an rbt_t built from the same source when the program
+ * starts. The startup cost and memory of the tree are what the static table
+ * saves.
+ *
+ * usage: rbspeed static [lookups]
+ */
+extern "C" int
+bench_static(int argc, char **argv)
+{
+    int const ops = (argc > 1) ? atoi(argv[1]) : 10000000;
+    if (ops <= 0) {
+        fprintf(stderr, "usage: rbspeed static [lookups]\n");
+        return 1;
+    }
+    unsigned rng = time(NULL);
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    my_t *const objs = static_cast<my_t *>(malloc(sizeof(*objs) * NCODES));
+    rbt_t tree;
+    rbt_init(&tree);
+    for (std::size_t i = 0; i < NCODES; ++i) {
+        objs[i].my_key = source[i].key;
+        rbt_add(&tree, &objs[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("Ran test with %zu codes\n", NCODES);
+    printf("startup   rbt_t %8.1f us, static table none\n", elapsed_ns(&start, &end) / 1e3);
+    printf("memory    rbt_t %8zu bytes written at startup, static table %zu bytes read-only\n",
+           sizeof(*objs) * NCODES, sizeof(table));
+
+    int32_t *const keys = static_cast<int32_t *>(malloc(sizeof(*keys) * ops));
+    for (int i = 0; i < ops; ++i) {
+        unsigned const r = xorshift32(&rng);
+        keys[i] = (r & 1) ? source[xorshift32(&rng) % NCODES].key : static_cast<int32_t>(r >> 1);
+    }
+
+    size_t found[2] = { 0, 0 };
+    double ns[2];
+    for (int impl = 0; impl < 2; ++impl) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < ops; ++i) {
+            if (impl)
+                found[impl] += table.get(&keys[i], codecmp) != nullptr;
+            else
+                found[impl] += rbt_get(&tree, keys[i]) != NULL;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        ns[impl] = (double)elapsed_ns(&start, &end) / ops;
+    }
+    if (found[0] != found[1])
+        abort();
+    printf("lookup    rbt_t %8.1f ns, static table %.1f ns\n", ns[0], ns[1]);
+
+    // Ordered iteration from a lower bound
+    size_t count = 0;
+    int32_t const from = INT32_MAX / 2;
+    for (auto it = table.at(table.lower_bound(&from, codecmp)); it != table.end(); ++it) {
+        if (it->key < from)
+            abort();
+        ++count;
+    }
+    printf("%zu codes from %d on\n", count, from);
+
+    free(keys);
+    free(objs);
+
+    return 0;
+}
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "rbtstr.h"
+
+#include "rbspeed_util.h"
+#include "rbspeed_bench.h"
+
+// The key lives on the heap, as it would for most string keyed elements
+typedef struct named named_t;
+struct named {
+    rbn_t nd;
+    char *key;
+};
+
+__attribute__((pure))
+static inline char const*
+namedkey(rbn_t const*const n)
+{
+    named_t const*const o = (void *)((unsigned char *)n - offsetof(named_t, nd));
+    return o->key;
+}
+
+__attribute__((pure))
+static inline int
+namedcmp(rbn_t const*const l, rbn_t const*const r)
+{
+    return strcmp(namedkey(l), namedkey(r));
+}
+
+__attribute__((pure))
+static inline int
+namedkeycmp(void const*const key, rbn_t const*const n)
+{
+    return strcmp(key, namedkey(n));
+}
+
+static char const*const hosts[] = {
+    "www.example.com", "api.example.com", "cdn.example.net", "shop.example.org",
+    "mail.example.com", "static.example.net", "docs.example.io", "blog.example.co.uk",
+};
+static char const*const words[] = {
+    "users", "orders", "images", "static", "v1", "v2", "search", "products", "cart",
+    "account", "settings", "assets", "js", "css", "projects", "src", "include", "build",
+};
+#define PICK(a, rng) (a[xorshift32(rng) % (sizeof(a) / sizeof(a[0]))])
+
+static void
+make_key(char *const buf, size_t const len, int const paths, unsigned *const p_rng)
+{
+    if (paths) {
+        snprintf(buf, len, "/home/user%02u/%s/%s/file%u.c", xorshift32(p_rng) % 50,
+                 PICK(words, p_rng), PICK(words, p_rng), xorshift32(p_rng) % 100000);
+    } else {
+        snprintf(buf, len, "https://%s/%s/%s/%u", PICK(hosts, p_rng), PICK(words, p_rng),
+                 PICK(words, p_rng), xorshift32(p_rng) % 1000000);
+    }
+}
+
+/*
+ * Time lookups of random present keys with URL and path shaped keys, with a
+ * strcmp comparator and with the cached key bytes of rbtstr.h.
+ *
+ * usage: rbspeed strkey [num_objs]
+ */
+int
+bench_strkey(int argc, char **argv)
+{
+    int const n = (argc > 1) ? atoi(argv[1]) : 1000000;
+    if (n <= 0) {
+        fprintf(stderr, "usage: rbspeed strkey [num_objs]\n");
+        return 1;
+    }
+    int const ops = 1000000;
+    unsigned const seed = time(NULL);
+
+    named_t *const objs = malloc(sizeof(*objs) * n);
+    struct timespec start, end;
+
+    printf("Ran test with %d keys\n", n);
+
+    for (int paths = 0; paths < 2; ++paths) {
+        unsigned rng = seed;
+        char buf[128];
+        for (int i = 0; i < n; ++i) {
+            make_key(buf, sizeof(buf), paths, &rng);
+            objs[i].key = strdup(buf);
+        }
+
+        rbt_t tree;
+        rbt_init(&tree);
+        for (int i = 0; i < n; ++i)
+            rbt_base_add(&tree, &objs[i].nd, namedcmp);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < ops; ++i) {
+            named_t const*const obj = &objs[xorshift32(&rng) % n];
+            if (rbt_base_get(&tree, obj->key, namedkeycmp) == NULL)
+                abort();
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        printf("%-5s strcmp        %7.1f ns per get\n", paths ? "path" : "url",
+               (double)elapsed_ns(&start, &end) / ops);
+
+        rbst_t st;
+        rbts_init(&st);
+        for (int i = 0; i < n; ++i)
+            rbts_base_add(&st, &objs[i].nd, namedkey);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < ops; ++i) {
+            named_t const*const obj = &objs[xorshift32(&rng) % n];
+            if (rbts_base_get(&st, obj->key, namedkey) == NULL)
+                abort();
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        printf("%-5s cached bytes  %7.1f ns per get (common prefix of %zu bytes)\n",
+               paths ? "path" : "url", (double)elapsed_ns(&start, &end) / ops, st.m_skip);
+
+        for (int i = 0; i < n; ++i)
+            free(objs[i].key);
+    }
+
+    free(objs);
+
+    return 0;
+}
@@ -0,0 +1,505 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rbspeed_helper.h"
+#include "rbspeed_util.h"
+#include "rbspeed_hist.h"
+#include "rbspeed_suite.h"
+#include "rbspeed_bench.h"
+
+static void *
+rbt_create(void)
+{
+    rbt_t *const tree = malloc(sizeof(*tree));
+    rbt_init(tree);
+    return tree;
+}
+
+static void
+rbt_destroy(void *const c)
+{
+    rbt_clear(c);
+    free(c);
+}
+
+static my_t *rbt_add_op(void *const c, my_t *const obj) { return rbt_add(c, obj); }
+static my_t *rbt_get_op(void *const c, int const key) { return rbt_get(c, key); }
+static my_t *rbt_rem_op(void *const c, int const key) { return rbt_rem(c, key); }
+static my_t *rbt_lt_op(void *const c, int const key) { return rbt_lt(c, key); }
+static my_t *rbt_gt_op(void *const c, int const key) { return rbt_gt(c, key); }
+static my_t *rbt_popmin_op(void *const c) { return rbt_popmin(c); }
+static void rbt_reset_op(void *const c) { rbt_report_reset(c); }
+static void rbt_report_op(void *const c, FILE *const fp, long const nops) { rbt_report(c, fp, nops); }
+
+static long
+rbt_scan_op(void *const c, int const key, int const len)
+{
+    long sum = 0;
+    my_t *x = rbt_get(c, key);
+    if (x == NULL)
+        x = rbt_gt(c, key);
+    for (int i = 0; (i < len) && (x != NULL); ++i, x = rbt_next(c, x))
+        sum += x->my_key;
+    return sum;
+}
+
+suite_impl_t const suite_rbt = {
+    "rbt",
+    rbt_create,
+    rbt_destroy,
+    rbt_add_op,
+    rbt_get_op,
+    rbt_rem_op,
+    rbt_lt_op,
+    rbt_gt_op,
+    rbt_scan_op,
+    rbt_popmin_op,
+    rbt_reset_op,
+    rbt_report_op,
+};
+
+static suite_impl_t const*const impls[] = {
+    &suite_rbt,
+    &suite_map,
+};
+
+enum { OP_GET, OP_ADD, OP_REM, OP_LT, OP_GT, OP_NEXT, OP_POPMIN, OP_TIMER, NUM_OPS };
+
+static char const*const op_names[NUM_OPS] = {
+    "get", "add", "rem", "lt", "gt", "next", "popmin", "timer",
+};
+
+enum { DIST_UNIFORM, DIST_SEQUENTIAL, DIST_ZIPF, DIST_CLUSTERED, NUM_DISTS };
+
+static char const*const dist_names[NUM_DISTS] = {
+    "uniform", "sequential", "zipf", "clustered",
+};
+
+#define NUM_CLUSTERS 16
+#define ZIPF_THETA 0.99
+
+/*
+ * Picks slots in [0, m_nslots), where slot i holds key i. The tree starts out
+ * holding half of the slots, so lookups hit about half the time.
+ */
+typedef struct keygen keygen_t;
+struct keygen {
+    int m_dist;
+    unsigned m_rng;
+    unsigned m_nslots;
+    unsigned m_seq;
+    // zipf, after Gray et al., "Quickly generating billion-record synthetic
+    // databases"
+    double m_alpha;
+    double m_zetan;
+    double m_eta;
+    // clustered
+    unsigned m_centers[NUM_CLUSTERS];
+    unsigned m_width;
+};
+
+static double
+uniform01(unsigned *const p_rng)
+{
+    uint64_t const hi = xorshift32(p_rng) >> 8;
+    uint64_t const lo = xorshift32(p_rng) >> 8;
+    return (double)((hi << 24) | lo) / (double)(UINT64_C(1) << 48);
+}
+
+static void
+keygen_init(keygen_t *const g, int const dist, unsigned const seed, unsigned const nslots)
+{
+    *g = (keygen_t) {
+        .m_dist = dist,
+        .m_rng = seed,
+        .m_nslots = nslots,
+    };
+
+    if (dist == DIST_ZIPF) {
+        double zetan = 0;
+        for (unsigned i = 1; i <= nslots; ++i)
+            zetan += 1.0 / pow(i, ZIPF_THETA);
+        double const zeta2 = 1.0 + 1.0 / pow(2, ZIPF_THETA);
+        g->m_alpha = 1.0 / (1.0 - ZIPF_THETA);
+        g->m_zetan = zetan;
+        g->m_eta = (1.0 - pow(2.0 / nslots, 1.0 - ZIPF_THETA)) / (1.0 - zeta2 / zetan);
+    } else if (dist == DIST_CLUSTERED) {
+        for (int i = 0; i < NUM_CLUSTERS; ++i)
+            g->m_centers[i] = xorshift32(&g->m_rng) % nslots;
+        g->m_width = nslots / 256 + 1;
+    }
+}
+
+static unsigned
+keygen_next(keygen_t *const g)
+{
+    switch (g->m_dist) {
+    case DIST_SEQUENTIAL:
+        return g->m_seq++ % g->m_nslots;
+    case DIST_ZIPF: {
+        double const u = uniform01(&g->m_rng);
+        double const uz = u * g->m_zetan;
+        uint64_t rank;
+        if (uz < 1.0)
+            rank = 0;
+        else if (uz < 1.0 + pow(0.5, ZIPF_THETA))
+            rank = 1;
+        else
+            rank = (uint64_t)(g->m_nslots * pow(g->m_eta * u - g->m_eta + 1.0, g->m_alpha));
+        // Scatter the popular ranks over the key space
+        return (unsigned)((rank * UINT64_C(2654435761)) % g->m_nslots);
+    }
+    case DIST_CLUSTERED: {
+        unsigned const c = g->m_centers[xorshift32(&g->m_rng) % NUM_CLUSTERS];
+        return (c + xorshift32(&g->m_rng) % g->m_width) % g->m_nslots;
+    }
+    default:
+        return xorshift32(&g->m_rng) % g->m_nslots;
+    }
+}
+
+// Parse a mix such as "get:50,add:25,rem:25" into cumulative weights
+static int
+parse_mix(char const*const spec, unsigned *const cumul)
+{
+    unsigned weights[NUM_OPS] = { 0 };
+    char *const copy = strdup(spec);
+    int rc = 0;
+    for (char *save, *tok = strtok_r(copy, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+        char *const colon = strchr(tok, ':');
+        unsigned w = 1;
+        if (colon != NULL) {
+            *colon = '\0';
+            w = (unsigned)atoi(colon + 1);
+        }
+        int op;
+        for (op = 0; op < OP_TIMER; ++op) {
+            if (strcmp(tok, op_names[op]) == 0)
+                break;
+        }
+        if (op == OP_TIMER) {
+            fprintf(stderr, "unknown operation %s\n", tok);
+            rc = -1;
+            break;
+        }
+        weights[op] += w;
+    }
+    free(copy);
+
+    unsigned total = 0;
+    for (int op = 0; op < OP_TIMER; ++op) {
+        total += weights[op];
+        cumul[op] = total;
+    }
+    if ((rc == 0) && (total == 0)) {
+        fprintf(stderr, "empty operation mix\n");
+        rc = -1;
+    }
+
+    return rc;
+}
+
+typedef struct suite_cfg suite_cfg_t;
+struct suite_cfg {
+    int m_size;
+    long m_ops;
+    long m_warmup;
+    int m_dist;
+    int m_scanlen;
+    unsigned m_seed;
+    unsigned m_cumul[NUM_OPS];
+};
+
+static long volatile g_sink;
+
+// Run nops operations and return how many of them added or removed a key.
+// Aborts if a lookup or a remove disagrees with `present`.
+static long
+run_ops(suite_cfg_t const*const cfg, suite_impl_t const*const impl, void *const c,
+        my_t *const objs, unsigned char *const present, keygen_t *const g,
+        unsigned *const p_rng, long const nops, hist_t *const hists)
+{
+    unsigned const total = cfg->m_cumul[OP_TIMER - 1];
+    my_t scratch;
+    struct timespec start, end;
+    long sink = 0;
+    long changes = 0;
+
+    for (long i = 0; i < nops; ++i) {
+        unsigned const r = xorshift32(p_rng) % total;
+        int op = 0;
+        while (r >= cfg->m_cumul[op])
+            ++op;
+        unsigned const slot = keygen_next(g);
+        int const key = (int)slot;
+        my_t *x = NULL;
+
+        // Adding a key that is already present goes through a scratch element
+        // so that a linked one is never handed back to the container
+        my_t *const obj = present[slot] ? &scratch : &objs[slot];
+        scratch.my_key = key;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        switch (op) {
+        case OP_GET: x = impl->get(c, key); break;
+        case OP_ADD: x = impl->add(c, obj); break;
+        case OP_REM: x = impl->rem(c, key); break;
+        case OP_LT: x = impl->lt(c, key); break;
+        case OP_GT: x = impl->gt(c, key); break;
+        case OP_NEXT: sink += impl->scan(c, key, cfg->m_scanlen); break;
+        case OP_POPMIN: x = impl->popmin(c); break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        if (hists != NULL)
+            hist_record(&hists[op], elapsed_ns(&start, &end));
+
+        if (((op == OP_GET) || (op == OP_REM)) && ((x != NULL) != present[slot])) {
+            fprintf(stderr, "%s: %s of key %d disagrees with the workload\n", impl->name, op_names[op], key);
+            abort();
+        }
+        if ((op == OP_ADD) || (op == OP_REM))
+            changes += (present[slot] == (op == OP_REM));
+
+        if (op == OP_ADD) {
+            present[slot] = 1;
+        } else if (op == OP_REM) {
+            present[slot] = 0;
+        } else if ((op == OP_POPMIN) && (x != NULL)) {
+            // Keep the size steady, outside of the timed region
+            impl->add(c, x);
+        }
+        sink += (x != NULL);
+    }
+
+    g_sink += sink;
+    return changes;
+}
+
+enum { FMT_TEXT, FMT_CSV, FMT_JSON };
+
+static void
+report(int const fmt, int const first, suite_cfg_t const*const cfg, char const*const impl,
+       int const op, hist_t const*const h)
+{
+    double const mean = (double)h->sum / (double)h->count;
+    uint64_t const p50 = hist_percentile(h, 0.5);
+    uint64_t const p99 = hist_percentile(h, 0.99);
+    uint64_t const p999 = hist_percentile(h, 0.999);
+
+    switch (fmt) {
+    case FMT_CSV:
+        if (first)
+            printf("impl,dist,size,op,count,mean_ns,p50_ns,p99_ns,p999_ns,max_ns\n");
+        printf("%s,%s,%d,%s,%" PRIu64 ",%.1f,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+               impl, dist_names[cfg->m_dist], cfg->m_size, op_names[op], h->count,
+               mean, p50, p99, p999, h->max);
+        break;
+    case FMT_JSON:
+        printf("%s{\"impl\":\"%s\",\"dist\":\"%s\",\"size\":%d,\"op\":\"%s\",\"count\":%" PRIu64
+               ",\"mean_ns\":%.1f,\"p50_ns\":%" PRIu64 ",\"p99_ns\":%" PRIu64
+               ",\"p999_ns\":%" PRIu64 ",\"max_ns\":%" PRIu64 "}",
+               first ? "[\n  " : ",\n  ", impl, dist_names[cfg->m_dist], cfg->m_size,
+               op_names[op], h->count, mean, p50, p99, p999, h->max);
+        break;
+    default:
+        if (first)
+            printf("%-6s %-7s %10s %10s %8s %8s %8s %10s\n",
+                   "impl", "op", "count", "mean", "p50", "p99", "p999", "max");
+        printf("%-6s %-7s %10" PRIu64 " %10.1f %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %10" PRIu64 "\n",
+               impl, op_names[op], h->count, mean, p50, p99, p999, h->max);
+        break;
+    }
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+            "usage: rbspeed [-n size] [-o ops] [-w warmup] [-d dist] [-m mix] [-l scanlen]\n"
+            "               [-i impl[,impl]] [-f text|csv|json] [-s seed]\n"
+            "  dist: uniform, sequential, zipf, clustered\n"
+            "  mix:  comma separated op:weight, ops are get add rem lt gt next popmin\n"
+            "  impl: rbt, map\n"
+            "Latencies are in nanoseconds and include one clock_gettime, whose own\n"
+            "cost is reported as the timer row.\n");
+}
+
+/*
+ * Time every operation of a random workload against each container and
+ * report latency percentiles per operation.
+ */
+int
+bench_suite(int argc, char **argv)
+{
+    suite_cfg_t cfg = {
+        .m_size = 1 << 14,
+        .m_ops = 1000000,
+        .m_warmup = -1,
+        .m_dist = DIST_UNIFORM,
+        .m_scanlen = 16,
+        .m_seed = (unsigned)time(NULL),
+    };
+    char const *mix = "get:50,add:25,rem:25";
+    char const *impl_list = "rbt,map";
+    int fmt = FMT_TEXT;
+
+    int opt;
+    optind = 1;
+    while ((opt = getopt(argc, argv, "n:o:w:d:m:l:i:f:s:h")) != -1) {
+        switch (opt) {
+        case 'n': cfg.m_size = atoi(optarg); break;
+        case 'o': cfg.m_ops = atol(optarg); break;
+        case 'w': cfg.m_warmup = atol(optarg); break;
+        case 'l': cfg.m_scanlen = atoi(optarg); break;
+        case 's': cfg.m_seed = (unsigned)strtoul(optarg, NULL, 0); break;
+        case 'm': mix = optarg; break;
+        case 'i': impl_list = optarg; break;
+        case 'd':
+            for (cfg.m_dist = 0; cfg.m_dist < NUM_DISTS; ++cfg.m_dist) {
+                if (strcmp(optarg, dist_names[cfg.m_dist]) == 0)
+                    break;
+            }
+            if (cfg.m_dist == NUM_DISTS) {
+                usage();
+                return 1;
+            }
+            break;
+        case 'f':
+            if (strcmp(optarg, "csv") == 0) {
+                fmt = FMT_CSV;
+            } else if (strcmp(optarg, "json") == 0) {
+                fmt = FMT_JSON;
+            } else if (strcmp(optarg, "text") == 0) {
+                fmt = FMT_TEXT;
+            } else {
+                usage();
+                return 1;
+            }
+            break;
+        default:
+            usage();
+            return (opt == 'h') ? 0 : 1;
+        }
+    }
+    if ((cfg.m_size <= 0) || (cfg.m_ops <= 0) || (cfg.m_scanlen < 0) ||
+        (parse_mix(mix, cfg.m_cumul) != 0)) {
+        usage();
+        return 1;
+    }
+    if (cfg.m_warmup < 0)
+        cfg.m_warmup = cfg.m_ops / 10;
+    if (cfg.m_seed == 0)
+        cfg.m_seed = 1;
+
+    unsigned const nslots = 2u * (unsigned)cfg.m_size;
+    my_t *const objs = malloc(sizeof(*objs) * nslots);
+    unsigned char *const present = malloc(nslots);
+    unsigned *const perm = malloc(sizeof(*perm) * nslots);
+    hist_t *const hists = malloc(sizeof(*hists) * NUM_OPS);
+
+    if (fmt == FMT_TEXT) {
+        printf("size %d, %s keys, %ld ops after %ld warmup, mix %s, seed %u\n",
+               cfg.m_size, dist_names[cfg.m_dist], cfg.m_ops, cfg.m_warmup, mix, cfg.m_seed);
+    }
+
+    int first = 1;
+    char *const impls_copy = strdup(impl_list);
+    for (char *save, *name = strtok_r(impls_copy, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+        suite_impl_t const *impl = NULL;
+        for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); ++i) {
+            if (strcmp(name, impls[i]->name) == 0)
+                impl = impls[i];
+        }
+        if (impl == NULL) {
+            fprintf(stderr, "unknown implementation %s\n", name);
+            continue;
+        }
+
+        // Every implementation sees exactly the same workload
+        unsigned rng = cfg.m_seed;
+        for (unsigned i = 0; i < nslots; ++i) {
+            objs[i].my_key = (int)i;
+            present[i] = 0;
+            perm[i] = i;
+        }
+        for (unsigned i = nslots - 1; i > 0; --i) {
+            unsigned const j = xorshift32(&rng) % (i + 1);
+            unsigned const t = perm[i];
+            perm[i] = perm[j];
+            perm[j] = t;
+        }
+
+        void *const c = impl->create();
+        for (int i = 0; i < cfg.m_size; ++i) {
+            impl->add(c, &objs[perm[i]]);
+            present[perm[i]] = 1;
+        }
+
+        // The keys come from a stream of their own. Sharing the one that picks
+        // the operations would tie each operation to its key, so that adds
+        // only ever found their key present and removes found it absent.
+        keygen_t g;
+        unsigned kseed = xorshift32(&rng) ^ 0x9e3779b9u;
+        if (kseed == 0)
+            kseed = 1;
+        keygen_init(&g, cfg.m_dist, kseed, nslots);
+        for (int op = 0; op < NUM_OPS; ++op)
+            hist_init(&hists[op]);
+
+        run_ops(&cfg, impl, c, objs, present, &g, &rng, cfg.m_warmup, NULL);
+        if (impl->reset != NULL)
+            impl->reset(c);
+        long const changes = run_ops(&cfg, impl, c, objs, present, &g, &rng, cfg.m_ops, hists);
+
+        // With the keys drawn apart from the operations, about
+        // 2 * add * rem / (add + rem) in every `total` ops change the contents
+        // once it settles. Far fewer means adds keep finding their key there
+        // and removes keep missing it, and the run measured mostly lookups.
+        unsigned const wa = cfg.m_cumul[OP_ADD] - cfg.m_cumul[OP_GET];
+        unsigned const wr = cfg.m_cumul[OP_REM] - cfg.m_cumul[OP_ADD];
+        if ((wa > 0) && (wr > 0)) {
+            double const expect = 2.0 * wa * wr / (wa + wr) / cfg.m_cumul[OP_TIMER - 1] * (double)cfg.m_ops;
+            if ((expect >= 100) && ((double)changes < expect / 4)) {
+                fprintf(stderr, "%s: only %ld of about %.0f adds and removes changed the contents\n", impl->name,
+                        changes, expect);
+                abort();
+            }
+        }
+
+        struct timespec start, end;
+        for (long i = 0; i < cfg.m_ops / 10 + 1; ++i) {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            hist_record(&hists[OP_TIMER], elapsed_ns(&start, &end));
+        }
+
+        for (int op = 0; op < NUM_OPS; ++op) {
+            if (hists[op].count == 0)
+                continue;
+            report(fmt, first, &cfg, impl->name, op, &hists[op]);
+            first = 0;
+        }
+        // Only the table has room for the container's own statistics
+        if ((fmt == FMT_TEXT) && (impl->report != NULL))
+            impl->report(c, stdout, cfg.m_ops);
+
+        impl->destroy(c);
+    }
+    free(impls_copy);
+
+    if ((fmt == FMT_JSON) && !first)
+        printf("\n]\n");
+
+    free(hists);
+    free(perm);
+    free(present);
+    free(objs);
+
+    return 0;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "rbspeed_helper.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A container under test. The elements are owned by the suite and keyed by
+// my_key, a container only ever links them.
+typedef struct suite_impl suite_impl_t;
+struct suite_impl {
+    char const *name;
+    void *(*create)(void);
+    void (*destroy)(void *);
+    // Returns the element holding the key after the call
+    my_t *(*add)(void *, my_t *);
+    my_t *(*get)(void *, int);
+    my_t *(*rem)(void *, int);
+    my_t *(*lt)(void *, int);
+    my_t *(*gt)(void *, int);
+    // Walk up to len elements starting at the first one >= key
+    long (*scan)(void *, int, int);
+    my_t *(*popmin)(void *);
+    // Optional, restart and print the container's own statistics
+    void (*reset)(void *);
+    void (*report)(void *, FILE *, long);
+};
+
+extern suite_impl_t const suite_rbt;
+extern suite_impl_t const suite_map;
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "rbtree.h"
+
+#include "rbspeed_util.h"
+#include "rbspeed_bench.h"
+
+typedef struct entry entry_t;
+struct entry {
+    rbn_t nd;
+    uint32_t key;
+    int dead;
+};
+
+__attribute__((pure))
+static inline entry_t *
+entry_of(rbn_t const*const n)
+{
+    return (entry_t *)((unsigned char *)n - offsetof(entry_t, nd));
+}
+
+__attribute__((pure))
+static inline int
+entcmp(rbn_t const*const l, rbn_t const*const r)
+{
+    return (entry_of(l)->key > entry_of(r)->key) - (entry_of(l)->key < entry_of(r)->key);
+}
+
+__attribute__((pure))
+static inline int
+entkeycmp(void const*const key, rbn_t const*const r)
+{
+    uint32_t const k = *(uint32_t const*)key;
+    return (k > entry_of(r)->key) - (k < entry_of(r)->key);
+}
+
+static int
+is_dead(rbn_t const*const x, void *const ctx)
+{
+    (void)ctx;
+    return entry_of(x)->dead;
+}
+
+static void
+count_removed(rbn_t *const x, void *const ctx)
+{
+    (void)x;
+    ++*(size_t *)ctx;
+}
+
+static void
+fill(rbt_t *const tree, entry_t *const objs, int const n)
+{
+    rbt_init(tree);
+    for (int i = 0; i < n; ++i)
+        rbt_base_add(tree, &objs[i].nd, entcmp);
+}
+
+/*
+ * Remove a random fraction of a tree built from random inserts: by finding
+ * each victim with rbt_base_next and removing it by key with rbt_base_rem, by
+ * deleting victims in place as rbt_base_next finds them, and with
+ * rbt_base_remove_if, which rebuilds the survivors once enough has gone.
+ *
+ * usage: rbspeed sweep [num_objs]
+ */
+int
+bench_sweep(int argc, char **argv)
+{
+    int const n = (argc > 1) ? atoi(argv[1]) : 1000000;
+    if (n <= 0) {
+        fprintf(stderr, "usage: rbspeed sweep [num_objs]\n");
+        return 1;
+    }
+    unsigned rng = time(NULL);
+
+    entry_t *const objs = malloc(sizeof(*objs) * n);
+    // Distinct keys, shuffled
+    for (int i = 0; i < n; ++i)
+        objs[i].key = (uint32_t)i * 2654435761u;
+    for (int i = n - 1; i > 0; --i) {
+        int const j = xorshift32(&rng) % (i + 1);
+        uint32_t const k = objs[i].key;
+        objs[i].key = objs[j].key;
+        objs[j].key = k;
+    }
+    uint32_t *const victims = malloc(sizeof(*victims) * n);
+    struct timespec start, end;
+
+    printf("Ran test with a tree of size %d, rbt_base_remove_if rebuilds past 1/%d\n", n,
+           RBT_REMOVE_IF_REBUILD);
+    static int const pcts[] = { 1, 5, 10, 20, 30, 50, 70, 90 };
+    for (size_t pi = 0; pi < sizeof(pcts) / sizeof(pcts[0]); ++pi) {
+        size_t want = 0;
+        for (int i = 0; i < n; ++i) {
+            objs[i].dead = (xorshift32(&rng) % 100) < (unsigned)pcts[pi];
+            want += objs[i].dead;
+        }
+
+        double ms[3];
+        for (int variant = 0; variant < 3; ++variant) {
+            rbt_t tree;
+            fill(&tree, objs, n);
+            size_t removed = 0;
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            if (variant == 0) {
+                size_t nv = 0;
+                for (rbn_t *x = rbt_base_min(&tree); x != NULL; x = rbt_base_next(&tree, x, entcmp)) {
+                    if (is_dead(x, NULL))
+                        victims[nv++] = entry_of(x)->key;
+                }
+                for (size_t i = 0; i < nv; ++i)
+                    removed += (rbt_base_rem(&tree, &victims[i], entkeycmp) != NULL);
+            } else if (variant == 1) {
+                rbn_t *x = rbt_base_min(&tree);
+                while (x != NULL) {
+                    rbn_t *const next = rbt_base_next(&tree, x, entcmp);
+                    if (is_dead(x, NULL)) {
+                        rb_base_delete(&tree, x);
+                        ++removed;
+                    }
+                    x = next;
+                }
+            } else {
+                rbt_base_remove_if(&tree, is_dead, count_removed, &removed);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+
+            if ((removed != want) || (rbt_size(&tree) != n - want))
+                abort();
+            ms[variant] = elapsed_ns(&start, &end) / 1e6;
+        }
+        printf("  %2d%% removed: rbt_base_rem %8.1f ms, in place %8.1f ms, rbt_base_remove_if %8.1f ms\n",
+               pcts[pi], ms[0], ms[1], ms[2]);
+    }
+
+    free(victims);
+    free(objs);
+
+    return 0;
+}
@@ -0,0 +1,438 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "rbmerkle.h"
+
+#include "rbspeed_util.h"
+#include "rbspeed_bench.h"
+
+typedef struct record record_t;
+struct record {
+    rbmn_t mn;
+    int64_t key;
+    uint64_t value;
+    int touched;
+};
+
+// Keys are below 2^62, so these stand for open bounds
+#define KEY_LOW INT64_MIN
+#define KEY_HIGH INT64_MAX
+
+__attribute__((pure))
+static inline record_t *
+record_of(rbn_t const*const n)
+{
+    return (record_t *)((unsigned char *)rbm_of(n) - offsetof(record_t, mn));
+}
+
+__attribute__((pure))
+static int
+reccmp(rbn_t const*const l, rbn_t const*const r)
+{
+    return (record_of(l)->key > record_of(r)->key) - (record_of(l)->key < record_of(r)->key);
+}
+
+__attribute__((pure))
+static int
+reckeycmp(void const*const key, rbn_t const*const r)
+{
+    int64_t const k = *(int64_t const*)key;
+    return (k > record_of(r)->key) - (k < record_of(r)->key);
+}
+
+__attribute__((const))
+static uint64_t
+mix(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9u;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebu;
+    return z ^ (z >> 31);
+}
+
+__attribute__((pure))
+static uint64_t
+recdigest(rbn_t const*const n)
+{
+    return mix(mix((uint64_t)record_of(n)->key) ^ record_of(n)->value);
+}
+
+static void
+diff_count(rbn_t *const a, rbn_t *const b, void *const ctx)
+{
+    (void)a;
+    (void)b;
+    ++*(size_t *)ctx;
+}
+
+enum { OP_QUIT, OP_SCAN, OP_SUMMARY };
+
+struct header {
+    uint32_t op;
+    uint32_t count;
+};
+
+// The standby's view of a range, asking for the primary's
+struct query {
+    int64_t lo;
+    int64_t hi;
+    uint64_t count;
+    uint64_t sum;
+};
+
+// Followed by the (key, digest) pairs in the range when the two differ and
+// have no more than RBM_DIFF_LEAF elements between them
+struct summary {
+    uint64_t count;
+    uint64_t sum;
+    int64_t median;
+};
+
+struct pair {
+    int64_t key;
+    uint64_t digest;
+};
+
+struct link {
+    int fd;
+    size_t bytes;
+    size_t round_trips;
+};
+
+static void
+send_all(struct link *const l, void const *buf, size_t len)
+{
+    l->bytes += len;
+    while (len > 0) {
+        ssize_t const r = write(l->fd, buf, len);
+        if (r <= 0) {
+            perror("write");
+            exit(1);
+        }
+        buf = (unsigned char const*)buf + r;
+        len -= r;
+    }
+}
+
+static void
+recv_all(struct link *const l, void *buf, size_t len)
+{
+    l->bytes += len;
+    while (len > 0) {
+        ssize_t const r = read(l->fd, buf, len);
+        if (r <= 0) {
+            perror("read");
+            exit(1);
+        }
+        buf = (unsigned char *)buf + r;
+        len -= r;
+    }
+}
+
+// Replies are gathered and sent in one go
+struct outbuf {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+};
+
+static void
+out_put(struct outbuf *const o, void const*const p, size_t const len)
+{
+    if (o->len + len > o->cap) {
+        o->cap = (o->len + len) * 2;
+        o->data = realloc(o->data, o->cap);
+    }
+    memcpy(o->data + o->len, p, len);
+    o->len += len;
+}
+
+static void
+serve(rbt_t *const tree, int const fd)
+{
+    struct link l = { fd, 0, 0 };
+    struct outbuf out = { NULL, 0, 0 };
+    struct query *qs = NULL;
+    size_t qcap = 0;
+    for (;;) {
+        struct header h;
+        recv_all(&l, &h, sizeof(h));
+        out.len = 0;
+        if (h.op == OP_QUIT) {
+            break;
+        } else if (h.op == OP_SCAN) {
+            uint64_t const n = rbt_size(tree);
+            out_put(&out, &n, sizeof(n));
+            for (rbn_t *x = rbt_base_min(tree); x != NULL; x = rbt_base_next(tree, x, reccmp)) {
+                struct pair const p = { record_of(x)->key, rbm_of(x)->digest };
+                out_put(&out, &p, sizeof(p));
+            }
+        } else {
+            if (h.count > qcap) {
+                qcap = h.count;
+                qs = realloc(qs, sizeof(*qs) * qcap);
+            }
+            recv_all(&l, qs, sizeof(*qs) * h.count);
+            for (uint32_t i = 0; i < h.count; ++i) {
+                size_t alo, ahi;
+                uint64_t const slo = rbm_base_prefix(tree, &qs[i].lo, reckeycmp, &alo);
+                uint64_t const shi = rbm_base_prefix(tree, &qs[i].hi, reckeycmp, &ahi);
+                struct summary s = { ahi - alo, shi - slo, 0 };
+                if (s.count > 0)
+                    s.median = record_of(rbm_select(tree, alo + s.count / 2))->key;
+                out_put(&out, &s, sizeof(s));
+                if (((s.count != qs[i].count) || (s.sum != qs[i].sum)) && (s.count + qs[i].count <= RBM_DIFF_LEAF)) {
+                    rbn_t *x = rbm_select(tree, alo);
+                    for (uint64_t k = 0; k < s.count; ++k, x = rbt_base_next(tree, x, reccmp)) {
+                        struct pair const p = { record_of(x)->key, rbm_of(x)->digest };
+                        out_put(&out, &p, sizeof(p));
+                    }
+                }
+            }
+        }
+        send_all(&l, out.data, out.len);
+    }
+    free(qs);
+    free(out.data);
+}
+
+// Merge the primary's pairs with the standby's run of n elements from x
+static size_t
+merge_count(rbt_t *const tree, rbn_t *x, size_t const n, struct pair const*const ps, size_t const np)
+{
+    size_t found = 0;
+    size_t i = 0, j = 0;
+    while ((i < np) || (j < n)) {
+        int cmp = (i == np) ? 1 : (j == n) ? -1 : (ps[i].key > record_of(x)->key) - (ps[i].key < record_of(x)->key);
+        if (cmp != 0)
+            ++found;
+        else
+            found += ps[i].digest != rbm_of(x)->digest;
+        if (cmp <= 0)
+            ++i;
+        if (cmp >= 0) {
+            ++j;
+            x = rbt_base_next(tree, x, reccmp);
+        }
+    }
+    return found;
+}
+
+// Fetch every pair from the primary and compare
+static size_t
+sync_scan(rbt_t *const tree, struct link *const l)
+{
+    struct header const h = { OP_SCAN, 0 };
+    send_all(l, &h, sizeof(h));
+    uint64_t np;
+    recv_all(l, &np, sizeof(np));
+    struct pair *const ps = malloc(sizeof(*ps) * (np ? np : 1));
+    recv_all(l, ps, sizeof(*ps) * np);
+    ++l->round_trips;
+    size_t const found = merge_count(tree, rbt_base_min(tree), rbt_size(tree), ps, np);
+    free(ps);
+    return found;
+}
+
+// Compare range sums with the primary a level at a time, splitting the ranges
+// that differ
+static size_t
+sync_ranges(rbt_t *const tree, struct link *const l)
+{
+    size_t cap = 64;
+    struct query *qs = malloc(sizeof(*qs) * cap);
+    struct query *next = malloc(sizeof(*next) * cap);
+    size_t *los = malloc(sizeof(*los) * cap);
+    size_t nq = 1;
+    qs[0].lo = KEY_LOW;
+    qs[0].hi = KEY_HIGH;
+    size_t found = 0;
+    while (nq > 0) {
+        for (size_t i = 0; i < nq; ++i) {
+            size_t hi;
+            uint64_t const slo = rbm_base_prefix(tree, &qs[i].lo, reckeycmp, &los[i]);
+            uint64_t const shi = rbm_base_prefix(tree, &qs[i].hi, reckeycmp, &hi);
+            qs[i].count = hi - los[i];
+            qs[i].sum = shi - slo;
+        }
+        struct header const h = { OP_SUMMARY, nq };
+        send_all(l, &h, sizeof(h));
+        send_all(l, qs, sizeof(*qs) * nq);
+        ++l->round_trips;
+
+        size_t nn = 0;
+        for (size_t i = 0; i < nq; ++i) {
+            struct summary s;
+            recv_all(l, &s, sizeof(s));
+            if ((s.count == qs[i].count) && (s.sum == qs[i].sum))
+                continue;
+            if (s.count + qs[i].count <= RBM_DIFF_LEAF) {
+                struct pair ps[RBM_DIFF_LEAF];
+                recv_all(l, ps, sizeof(ps[0]) * s.count);
+                rbn_t *const x = (qs[i].count > 0) ? rbm_select(tree, los[i]) : NULL;
+                found += merge_count(tree, x, qs[i].count, ps, s.count);
+                continue;
+            }
+            int64_t const mid = (s.count >= qs[i].count) ? s.median :
+                                record_of(rbm_select(tree, los[i] + qs[i].count / 2))->key;
+            if (nn + 2 > cap) {
+                cap *= 2;
+                qs = realloc(qs, sizeof(*qs) * cap);
+                next = realloc(next, sizeof(*next) * cap);
+                los = realloc(los, sizeof(*los) * cap);
+            }
+            next[nn].lo = qs[i].lo;
+            next[nn++].hi = mid;
+            next[nn].lo = mid;
+            next[nn++].hi = qs[i].hi;
+        }
+        struct query *const t = qs;
+        qs = next;
+        next = t;
+        nq = nn;
+    }
+    free(los);
+    free(next);
+    free(qs);
+    return found;
+}
+
+static record_t *
+fill(rbt_t *const tree, int const n, unsigned *const p_rng)
+{
+    record_t *const recs = malloc(sizeof(*recs) * n);
+    for (int i = 0; i < n; ++i) {
+        recs[i].key = (int64_t)(mix(i) >> 2);
+        recs[i].value = mix(recs[i].key + 1);
+        recs[i].touched = 0;
+    }
+    // Shuffled, so that each side has its own shape
+    for (int i = n - 1; i > 0; --i) {
+        int const j = xorshift32(p_rng) % (i + 1);
+        record_t const t = recs[i];
+        recs[i] = recs[j];
+        recs[j] = t;
+    }
+    rbm_init(tree);
+    for (int i = 0; i < n; ++i) {
+        if (rbm_base_add(tree, &recs[i].mn, reccmp, recdigest) != &recs[i].mn.nd)
+            abort();
+    }
+    return recs;
+}
+
+/*
+ * Bring a standby replica up to date with a primary in another process over a
+ * socket, once by streaming every (key, digest) pair from the primary and once
+ * by comparing range sums (see rbmerkle.h) a tree level at a time, after the
+ * standby has drifted by 1, 100 and 10000 changes. The differences are only
+ * counted, not applied. rbt_base_diff on the two trees in one process is timed
+ * for comparison.
+ *
+ * usage: rbspeed sync [num_objs] [diffs]
+ */
+int
+bench_sync(int argc, char **argv)
+{
+    int const n = (argc > 1) ? atoi(argv[1]) : 1000000;
+    int const only = (argc > 2) ? atoi(argv[2]) : 0;
+    if ((n <= 0) || (only < 0) || (only > n)) {
+        fprintf(stderr, "usage: rbspeed sync [num_objs] [diffs]\n");
+        return 1;
+    }
+    unsigned rng = time(NULL);
+    struct timespec start, end;
+
+    rbt_t primary, standby;
+    record_t *const precs = fill(&primary, n, &rng);
+    record_t *const srecs = fill(&standby, n, &rng);
+    record_t *const extra = malloc(sizeof(*extra) * n);
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        perror("socketpair");
+        return 1;
+    }
+    pid_t const pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        serve(&primary, fds[1]);
+        _exit(0);
+    }
+    close(fds[1]);
+
+    printf("Ran test with trees of size %d\n", n);
+    static int const steps[] = { 1, 100, 10000 };
+    int const nsteps = only ? 1 : (int)(sizeof(steps) / sizeof(steps[0]));
+    int applied = 0, added = 0;
+    for (int si = 0; si < nsteps; ++si) {
+        int const want = only ? only : (steps[si] < n ? steps[si] : n);
+        // Delete, change or add records on the standby until it is `want` off
+        while (applied < want) {
+            record_t *const r = &srecs[xorshift32(&rng) % n];
+            if (r->touched)
+                continue;
+            r->touched = 1;
+            switch (applied % 3) {
+            case 0:
+                rb_base_delete(&standby, &r->mn.nd);
+                break;
+            case 1:
+                ++r->value;
+                rbm_base_update(&standby, &r->mn, recdigest);
+                break;
+            default:
+                extra[added].key = (int64_t)(mix(n + added) >> 2);
+                extra[added].value = 0;
+                if (rbm_base_add(&standby, &extra[added].mn, reccmp, recdigest) != &extra[added].mn.nd)
+                    abort();
+                ++added;
+                break;
+            }
+            ++applied;
+        }
+
+        size_t found[3];
+        double ms[3];
+        struct link links[2] = { { fds[0], 0, 0 }, { fds[0], 0, 0 } };
+        for (int impl = 0; impl < 3; ++impl) {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            if (impl == 0) {
+                found[impl] = sync_scan(&standby, &links[impl]);
+            } else if (impl == 1) {
+                found[impl] = sync_ranges(&standby, &links[impl]);
+            } else {
+                found[impl] = 0;
+                rbt_base_diff(&primary, &standby, reccmp, diff_count, &found[impl]);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            ms[impl] = elapsed_ns(&start, &end) / 1e6;
+            if (found[impl] != (size_t)want)
+                abort();
+        }
+        printf("  %5d differences: full scan %10zu bytes %3zu round trips %8.2f ms, "
+               "range sums %8zu bytes %3zu round trips %8.2f ms, in process %8.2f ms\n", want, links[0].bytes,
+               links[0].round_trips, ms[0], links[1].bytes, links[1].round_trips, ms[1], ms[2]);
+    }
+
+    struct link l = { fds[0], 0, 0 };
+    struct header const h = { OP_QUIT, 0 };
+    send_all(&l, &h, sizeof(h));
+    waitpid(pid, NULL, 0);
+    close(fds[0]);
+
+    free(extra);
+    free(srecs);
+    free(precs);
+
+    return 0;
+}
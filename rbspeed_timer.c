@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "rbtimer.h"
+
+#include "rbspeed_util.h"
+#include "rbspeed_bench.h"
+
+// Ticks a timer is armed for, rearms move it out by the same
+#define TIMEOUT 10000
+
+struct timer_run {
+    rbt_t q;
+    rbtm_t *timers;
+    uint64_t now;
+    size_t fired;
+};
+
+// An expired timer is for a connection that gets a new one straight away
+static void
+fire(rbtm_t *const tm, void *const ctx)
+{
+    struct timer_run *const r = ctx;
+    ++r->fired;
+    rbtm_arm(&r->q, tm, r->now + TIMEOUT);
+}
+
+static size_t
+expire_by_popmin(struct timer_run *const r)
+{
+    size_t n = 0;
+    while (rbtm_next_expiry(&r->q) <= r->now) {
+        rbn_t *const x = rbt_base_popmin(&r->q);
+        fire((void *)((unsigned char *)x - offsetof(rbtm_t, nd)), r);
+        ++n;
+    }
+    return n;
+}
+
+/*
+ * Model the timeouts of a server: a fixed population of timers where each
+ * tick some are pushed out by activity (60%), some cancelled (30%) and some
+ * armed afresh (10%), and whatever is due is expired every `period` ticks.
+ * Expiry is run with rbtm_expire, which splits the due timers off in one go,
+ * and with a loop over rbt_base_popmin.
+ *
+ * usage: rbspeed timer [num_timers] [ticks] [period]
+ */
+int
+bench_timer(int argc, char **argv)
+{
+    int const n = (argc > 1) ? atoi(argv[1]) : 1000000;
+    int const ticks = (argc > 2) ? atoi(argv[2]) : 20000;
+    int const period = (argc > 3) ? atoi(argv[3]) : 10;
+    if ((n <= 0) || (ticks <= 0) || (period <= 0)) {
+        fprintf(stderr, "usage: rbspeed timer [num_timers] [ticks] [period]\n");
+        return 1;
+    }
+    int const churn = (n / 1000 > 0) ? n / 1000 : 1;
+    unsigned const seed = time(NULL);
+
+    struct timer_run r;
+    r.timers = malloc(sizeof(*r.timers) * n);
+    struct timespec start, end;
+
+    printf("Ran test with %d timers, %d ticks, %d changes per tick, expiring every %d ticks\n",
+           n, ticks, churn, period);
+
+    for (int split = 0; split < 2; ++split) {
+        unsigned rng = seed;
+        rbt_init(&r.q);
+        r.now = 0;
+        r.fired = 0;
+        for (int i = 0; i < n; ++i) {
+            rbtm_init(&r.timers[i]);
+            rbtm_arm(&r.q, &r.timers[i], xorshift32(&rng) % TIMEOUT);
+        }
+
+        uint64_t arm_ns = 0;
+        uint64_t expire_ns = 0;
+        size_t batches = 0;
+        for (int t = 1; t <= ticks; ++t) {
+            r.now = t;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (int j = 0; j < churn; ++j) {
+                rbtm_t *const tm = &r.timers[xorshift32(&rng) % n];
+                unsigned const what = xorshift32(&rng) % 10;
+                if (what < 6)
+                    rbtm_arm(&r.q, tm, r.now + TIMEOUT);
+                else if (what < 9)
+                    rbtm_cancel(&r.q, tm);
+                else
+                    rbtm_arm(&r.q, tm, r.now + 1 + xorshift32(&rng) % TIMEOUT);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            arm_ns += elapsed_ns(&start, &end);
+
+            if (t % period != 0)
+                continue;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            if (split)
+                rbtm_expire(&r.q, r.now, fire, &r);
+            else
+                expire_by_popmin(&r);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            expire_ns += elapsed_ns(&start, &end);
+            ++batches;
+        }
+
+        printf("%-7s arm/cancel %6.1f ns/op, expiry %7.1f ns per timer fired "
+               "(%zu fired, %.1f per batch, %zu armed at the end)\n",
+               split ? "split" : "popmin", (double)arm_ns / ((double)ticks * churn),
+               (r.fired > 0) ? (double)expire_ns / (double)r.fired : 0.0, r.fired,
+               (double)r.fired / (double)batches, rbt_size(&r.q));
+    }
+
+    free(r.timers);
+
+    return 0;
+}
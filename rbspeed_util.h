@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+static inline unsigned
+xorshift32(unsigned *const p_rng)
+{
+    unsigned x = *p_rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *p_rng = x;
+    return x;
+}
+
+static inline uint64_t
+elapsed_ns(struct timespec const*const start, struct timespec const*const end)
+{
+    return (end->tv_sec - start->tv_sec)*UINT64_C(1000000000) + (end->tv_nsec - start->tv_nsec);
+}
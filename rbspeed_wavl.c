@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "rbspeed_helper.h"
+#include "rbspeed_util.h"
+#include "rbspeed_bench.h"
+
+// The two engines have different tree types, so each goes through a void *.
+// init empties the tree and returns the rbt_t that lookups are made on.
+typedef struct engine engine_t;
+struct engine {
+    char const *name;
+    rbt_t *(*init)(void *);
+    my_t *(*add)(void *, my_t *);
+    my_t *(*rem)(void *, int);
+    my_t *(*popmin)(void *);
+};
+
+static rbt_t *
+rb_e_init(void *const t)
+{
+    rbt_init(t);
+    return t;
+}
+
+static my_t *
+rb_e_add(void *const t, my_t *const obj)
+{
+    return rbt_add(t, obj);
+}
+
+static my_t *
+rb_e_rem(void *const t, int const key)
+{
+    return rbt_rem(t, key);
+}
+
+static my_t *
+rb_e_popmin(void *const t)
+{
+    return rbt_popmin(t);
+}
+
+static rbt_t *
+wavl_e_init(void *const t)
+{
+    wavl_setup(t);
+    return wavl_tree(t);
+}
+
+static my_t *
+wavl_e_add(void *const t, my_t *const obj)
+{
+    return wavl_add(t, obj);
+}
+
+static my_t *
+wavl_e_rem(void *const t, int const key)
+{
+    return wavl_rem(t, key);
+}
+
+static my_t *
+wavl_e_popmin(void *const t)
+{
+    return wavl_popmin(t);
+}
+
+static engine_t const engines[] = {
+    { "red-black", rb_e_init, rb_e_add, rb_e_rem, rb_e_popmin },
+    { "wavl", wavl_e_init, wavl_e_add, wavl_e_rem, wavl_e_popmin },
+};
+
+static void
+print_result(char const*const what, engine_t const*const e, struct timespec const*const start,
+             struct timespec const*const end, long const ops, rbt_t *const tree)
+{
+    printf("%-8s %-10s %8.1f ns/op", what, e->name, (double)elapsed_ns(start, end) / (double)ops);
+    if (tree->m_size > 0) {
+        unsigned height;
+        double const mean = rbt_mean_depth(tree, &height);
+        printf("  height %3u  mean depth %6.2f", height, mean);
+    }
+    printf("\n");
+}
+
+/*
+ * Compare the red-black and the weak AVL engine on the same key sequences:
+ * inserts into an empty tree, mixed inserts, removes and lookups on a tree
+ * of half the keys, and draining a full tree through popmin.
+ *
+ * usage: rbspeed wavl [num_objs]
+ */
+int
+bench_wavl(int argc, char **argv)
+{
+    int const n = (argc > 1) ? atoi(argv[1]) : 1000000;
+    if (n <= 0) {
+        fprintf(stderr, "usage: rbspeed wavl [num_objs]\n");
+        return 1;
+    }
+    unsigned const seed = time(NULL);
+
+    my_t *const objs = malloc(sizeof(*objs) * n);
+    bool *const present = malloc(sizeof(*present) * n);
+    // An odd multiplier permutes the 31 bit keys, so they are unique, and a
+    // shuffle takes away the regular spacing of the insertion order
+    unsigned rng = seed;
+    for (int i = 0; i < n; ++i)
+        objs[i].my_key = (int)(((unsigned)i * 2654435761u) & 0x7fffffffu);
+    for (int i = n - 1; i > 0; --i) {
+        int const j = xorshift32(&rng) % (i + 1);
+        int const k = objs[i].my_key;
+        objs[i].my_key = objs[j].my_key;
+        objs[j].my_key = k;
+    }
+
+    printf("Ran test with a tree of size %d\n", n);
+
+    // A tree for each engine, in the order of engines[]
+    rbt_t rb;
+    wavl_t *const wavl = wavl_create();
+    void *const trees[] = { &rb, wavl };
+    struct timespec start, end;
+    for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); ++e) {
+        engine_t const*const eng = &engines[e];
+        void *const t = trees[e];
+
+        rbt_t *tree = eng->init(t);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < n; ++i)
+            eng->add(t, &objs[i]);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        print_result("insert", eng, &start, &end, n, tree);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        while (eng->popmin(t) != NULL)
+            ;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        print_result("drain", eng, &start, &end, n, tree);
+
+        rng = seed;
+        tree = eng->init(t);
+        for (int i = 0; i < n; ++i) {
+            present[i] = (i % 2 == 0);
+            if (present[i])
+                eng->add(t, &objs[i]);
+        }
+        // Two of every three operations flip a random key in or out
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < n; ++i) {
+            int const j = xorshift32(&rng) % n;
+            if (i % 3 == 0) {
+                if ((rbt_get(tree, objs[j].my_key) != NULL) != present[j])
+                    abort();
+            } else if (present[j]) {
+                eng->rem(t, objs[j].my_key);
+                present[j] = false;
+            } else {
+                eng->add(t, &objs[j]);
+                present[j] = true;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        print_result("mixed", eng, &start, &end, n, tree);
+    }
+
+    wavl_free(wavl);
+    free(present);
+    free(objs);
+
+    return 0;
+}
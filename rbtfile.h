@@ -0,0 +1,293 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rbtree.h"
+
+/*
+ * On-disk format for the elements of a tree, in key order:
+ *
+ *   "RBTD"  4 byte magic
+ *   u32     format version
+ *   u64     number of records
+ *   then for each record a LEB128 length followed by that many bytes
+ *
+ * All integers are little endian. What goes into a record is entirely up to
+ * the caller's encoder and decoder.
+ */
+#define RBT_FILE_MAGIC "RBTD"
+#define RBT_FILE_VERSION 1
+#define RBT_FILE_HDRLEN 16
+
+// Encodes the element into the buffer and returns the length of the record.
+// If that is larger than the buffer it will be called again with enough room.
+typedef size_t (*rbtenc_t)(rbn_t const*, void *, size_t, void *);
+// Creates an element from a record and returns its node, or NULL on failure
+typedef rbn_t *(*rbtdec_t)(void const*, size_t, void *);
+
+typedef struct rbt_file_reader rbtfr_t;
+
+struct rbt_file_reader {
+    unsigned char const *m_pos;
+    unsigned char const *m_end;
+    void *m_map;
+    size_t m_maplen;
+    uint64_t m_count;
+};
+
+static inline void
+rbt_file_put64(unsigned char *const p, uint64_t const v)
+{
+    for (int i = 0; i < 8; ++i)
+        p[i] = (unsigned char)(v >> (8 * i));
+}
+
+__attribute__((pure))
+static inline uint64_t
+rbt_file_get64(unsigned char const*const p)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i)
+        v |= (uint64_t)p[i] << (8 * i);
+    return v;
+}
+
+// Returns the number of bytes consumed, or 0 if the length is malformed or
+// doesn't fit in a size_t
+static inline size_t
+rbt_file_getlen(unsigned char const*const p, unsigned char const*const end, size_t *const p_len)
+{
+    size_t len = 0;
+    *p_len = 0;
+    for (size_t i = 0, shift = 0; (shift < sizeof(size_t) * CHAR_BIT) && (p + i < end); ++i, shift += 7) {
+        size_t const v = p[i] & 0x7f;
+        if (((v << shift) >> shift) != v)
+            return 0;
+        len |= v << shift;
+        if ((p[i] & 0x80) == 0) {
+            *p_len = len;
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Write every element of the tree in key order. Returns 0 on success, or -1
+ * with errno set. The stream is flushed but not closed.
+ *
+ * Records are gathered into a block before being handed to stdio, as a pair of
+ * fwrite calls per element costs more than encoding it.
+ */
+static inline int
+rbt_base_dump(rbt_t const*const tree, FILE *const fp, rbtenc_t const enc, void *const ctx)
+{
+    unsigned char block[16384];
+    size_t used = RBT_FILE_HDRLEN;
+    memcpy(block, RBT_FILE_MAGIC, 4);
+    block[4] = RBT_FILE_VERSION;
+    block[5] = block[6] = block[7] = 0;
+    rbt_file_put64(&block[8], tree->m_size);
+
+    unsigned char stackbuf[256];
+    unsigned char *buf = stackbuf;
+    size_t cap = sizeof(stackbuf);
+
+    int rc = 0;
+    for (rbn_t *x = tree->m_min; x != &tree->m_nil; x = tree_successor(tree, x)) {
+        size_t len = enc(x, buf, cap, ctx);
+        if (len > cap) {
+            unsigned char *const nbuf = (buf == stackbuf) ? malloc(len) : realloc(buf, len);
+            if (nbuf == NULL) {
+                rc = -1;
+                break;
+            }
+            buf = nbuf;
+            cap = len;
+            len = enc(x, buf, cap, ctx);
+        }
+
+        unsigned char lenbuf[10];
+        size_t nlen = 0;
+        size_t v = len;
+        do {
+            lenbuf[nlen++] = (unsigned char)((v & 0x7f) | ((v > 0x7f) ? 0x80 : 0));
+            v >>= 7;
+        } while (v != 0);
+
+        if (used + nlen + len > sizeof(block)) {
+            if (fwrite(block, used, 1, fp) != 1) {
+                rc = -1;
+                break;
+            }
+            used = 0;
+        }
+
+        if (nlen + len > sizeof(block)) {
+            // Too big to gather, write it straight through
+            if ((fwrite(lenbuf, nlen, 1, fp) != 1) || (fwrite(buf, len, 1, fp) != 1)) {
+                rc = -1;
+                break;
+            }
+        } else {
+            memcpy(&block[used], lenbuf, nlen);
+            memcpy(&block[used + nlen], buf, len);
+            used += nlen + len;
+        }
+    }
+
+    if (buf != stackbuf)
+        free(buf);
+
+    if ((rc == 0) && (used > 0) && (fwrite(block, used, 1, fp) != 1))
+        rc = -1;
+
+    if ((rc == 0) && (fflush(fp) != 0))
+        rc = -1;
+
+    return rc;
+}
+
+static inline void
+rbt_file_close(rbtfr_t *const r)
+{
+    if (r->m_map != NULL)
+        munmap(r->m_map, r->m_maplen);
+    r->m_map = NULL;
+}
+
+/*
+ * Map a dump for reading. The framing of every record is checked up front so
+ * that nothing past this point can fail. Returns 0 on success, or -1 with
+ * errno set (EINVAL for a malformed file).
+ */
+static inline int
+rbt_file_open(rbtfr_t *const r, int const fd)
+{
+    *r = (rbtfr_t) { 0 };
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        return -1;
+    if ((st.st_size < RBT_FILE_HDRLEN) || ((uint64_t)st.st_size > SIZE_MAX)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    r->m_maplen = (size_t)st.st_size;
+    void *const map = mmap(NULL, r->m_maplen, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        return -1;
+    r->m_map = map;
+    madvise(map, r->m_maplen, MADV_SEQUENTIAL);
+
+    unsigned char const*const base = map;
+    r->m_end = base + r->m_maplen;
+    r->m_pos = base + RBT_FILE_HDRLEN;
+    r->m_count = rbt_file_get64(&base[8]);
+
+    uint64_t n = 0;
+    unsigned char const *p = r->m_pos;
+    if ((memcmp(base, RBT_FILE_MAGIC, 4) == 0) && (base[4] == RBT_FILE_VERSION) &&
+        (base[5] == 0) && (base[6] == 0) && (base[7] == 0)) {
+        while (p < r->m_end) {
+            size_t len;
+            size_t const used = rbt_file_getlen(p, r->m_end, &len);
+            if ((used == 0) || (len > (size_t)(r->m_end - p - used)))
+                break;
+            p += used + len;
+            ++n;
+        }
+    }
+
+    if ((p != r->m_end) || (n != r->m_count)) {
+        rbt_file_close(r);
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+// Returns the next record, which stays valid until the reader is closed
+static inline void const*
+rbt_file_next(rbtfr_t *const r, size_t *const p_len)
+{
+    if (r->m_pos >= r->m_end) {
+        *p_len = 0;
+        return NULL;
+    }
+
+    size_t const used = rbt_file_getlen(r->m_pos, r->m_end, p_len);
+    void const*const rec = r->m_pos + used;
+    r->m_pos += used + *p_len;
+
+    return rec;
+}
+
+// Hands out the decoded nodes, which are chained through lc
+static inline rbn_t *
+rb_load_next(void *const ctx)
+{
+    rbn_t **const p_head = ctx;
+    rbn_t *const x = *p_head;
+    *p_head = x->lc;
+    return x;
+}
+
+/*
+ * Reload an empty tree from a dump written by rbt_base_dump. The records are
+ * already sorted so the tree is built in O(n) without calling a comparator.
+ * Returns 0 on success, or -1 with errno set, in which case the tree is left
+ * untouched.
+ *
+ * `dec` may return NULL if it can't make an element, for instance when it runs
+ * out of memory. Every record is decoded before the tree is built, so then the
+ * elements made so far are handed to `destroy`, if it isn't NULL, and errno is
+ * ENOMEM.
+ */
+static inline int
+rbt_base_load(rbt_t *const tree, int const fd, rbtdec_t const dec, rbtvisit_t const destroy,
+              void *const ctx)
+{
+    rbtfr_t r;
+    if (rbt_file_open(&r, fd) != 0)
+        return -1;
+
+    rbn_t *head = NULL;
+    rbn_t **p_tail = &head;
+    for (uint64_t i = 0; i < r.m_count; ++i) {
+        size_t len;
+        void const*const rec = rbt_file_next(&r, &len);
+        rbn_t *const x = dec(rec, len, ctx);
+        if (x == NULL) {
+            *p_tail = NULL;
+            while (head != NULL) {
+                rbn_t *const next = head->lc;
+                if (destroy != NULL)
+                    destroy(head, ctx);
+                head = next;
+            }
+            rbt_file_close(&r);
+            errno = ENOMEM;
+            return -1;
+        }
+        *p_tail = x;
+        p_tail = &x->lc;
+    }
+    rbt_file_close(&r);
+
+    rbt_base_build(tree, r.m_count, rb_load_next, &head);
+
+    return 0;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "rbtree.h"
+
+/*
+ * Timers kept in an rbt_t ordered by expiry, with timers due at the same time
+ * fired in the order they were armed. The handle is embedded in the caller's
+ * object like a node. An armed handle is its own position in the queue, so
+ * cancelling it is a delete with no lookup, and rearming it leaves it where it
+ * is when the new expiry still falls between its neighbours.
+ */
+typedef struct rbt_timer rbtm_t;
+struct rbt_timer {
+    rbn_t nd;
+    uint64_t expires;
+};
+
+// Called for each expired timer, which is already disarmed and may be armed
+// again from the callback
+typedef void (*rbtfire_t)(rbtm_t *, void *);
+
+__attribute__((pure))
+static inline int
+rbtm_cmp(rbn_t const*const ln, rbn_t const*const rn)
+{
+    rbtm_t const*const l = (void *)((unsigned char *)ln - offsetof(rbtm_t, nd));
+    rbtm_t const*const r = (void *)((unsigned char *)rn - offsetof(rbtm_t, nd));
+    return (l->expires > r->expires) - (l->expires < r->expires);
+}
+
+__attribute__((pure))
+static inline int
+rbtm_keycmp(void const*const key, rbn_t const*const rn)
+{
+    uint64_t const l = *(uint64_t const*)key;
+    rbtm_t const*const r = (void *)((unsigned char *)rn - offsetof(rbtm_t, nd));
+    return (l > r->expires) - (l < r->expires);
+}
+
+static inline void
+rbtm_init(rbtm_t *const tm)
+{
+    tm->nd.p = NULL;
+    tm->nd.lc = NULL;
+    tm->nd.rc = NULL;
+    tm->expires = 0;
+}
+
+__attribute__((pure))
+static inline int
+rbtm_armed(rbtm_t const*const tm)
+{
+    return tm->nd.p != NULL;
+}
+
+static inline void
+rbtm_cancel(rbt_t *const q, rbtm_t *const tm)
+{
+    if (rbtm_armed(tm))
+        rb_base_delete(q, &tm->nd);
+}
+
+// Arm the timer, or move it if it is already armed
+static inline void
+rbtm_arm(rbt_t *const q, rbtm_t *const tm, uint64_t const expires)
+{
+    tm->expires = expires;
+    // It goes after any timer due at the same time either way
+    if (rbtm_armed(tm))
+        rbt_base_rekey(q, &tm->nd, rbtm_cmp);
+    else
+        rbt_base_add_multi(q, &tm->nd, rbtm_cmp);
+}
+
+// Expiry of the earliest timer, or UINT64_MAX if none is armed
+__attribute__((pure))
+static inline uint64_t
+rbtm_next_expiry(rbt_t const*const q)
+{
+    rbn_t const*const x = rbt_base_min(q);
+    if (x == NULL)
+        return UINT64_MAX;
+
+    rbtm_t const*const tm = (void const*)((unsigned char const*)x - offsetof(rbtm_t, nd));
+    return tm->expires;
+}
+
+/*
+ * Fire every timer due at or before `now`, earliest first. They are split off
+ * the queue in one go before the first callback runs, so a timer armed from a
+ * callback waits for the next call even if it is already due. Returns the
+ * number fired.
+ */
+static inline size_t
+rbtm_expire(rbt_t *const q, uint64_t const now, rbtfire_t const fire, void *const ctx)
+{
+    size_t n = 0;
+    rbn_t *next;
+    for (rbn_t *x = rbt_base_split_le(q, &now, rbtm_keycmp); x != NULL; x = next) {
+        next = x->lc;
+        x->lc = NULL;
+        fire((void *)((unsigned char *)x - offsetof(rbtm_t, nd)), ctx);
+        ++n;
+    }
+
+    return n;
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "rbtree.h"
+
+/*
+ * Visit a range of a tree from several threads at once. The range is cut at
+ * the nodes of the top few levels of the tree, so that each piece is one of
+ * those nodes followed by the subtree below it in key order. There are several
+ * pieces per thread and the threads take the next one as they finish, which
+ * evens out the subtrees that are up to twice as deep as others. The pieces
+ * are walked along the parent links, so the comparator is only used to find
+ * the ends of the range.
+ *
+ * The tree must not be modified while this runs.
+ */
+#define RBT_PAR_PIECES_PER_THREAD 8
+// Pieces are cut from no more than this many levels
+#define RBT_PAR_MAX_LEVELS 12
+
+// Folds the state of a piece into the state of the pieces before it
+typedef void (*rbtreduce_t)(void *, void const*);
+
+typedef struct rbt_par_run rbtpr_t;
+struct rbt_par_run {
+    rbt_t *m_tree;
+    rbn_t **m_bounds;           // piece i is from m_bounds[i] up to m_bounds[i + 1]
+    size_t m_pieces;
+    size_t m_next;              // next piece to be taken
+    rbtvisit_t m_visit;
+    unsigned char *m_states;    // per piece when reducing, otherwise shared
+    size_t m_size;
+};
+
+static inline void *
+rb_par_worker(void *const arg)
+{
+    rbtpr_t *const r = arg;
+    rbt_t *const tree = r->m_tree;
+
+    size_t i;
+    while ((i = __atomic_fetch_add(&r->m_next, 1, __ATOMIC_RELAXED)) < r->m_pieces) {
+        void *const state = r->m_states + i * r->m_size;
+        rbn_t *const end = r->m_bounds[i + 1];
+        for (rbn_t *x = r->m_bounds[i]; x != end; x = tree_successor(tree, x))
+            r->m_visit(x, state);
+    }
+
+    return NULL;
+}
+
+/*
+ * Store the nodes of the top `levels` levels of the tree that come after
+ * `first` and before the first element not less than `hi`, in key order, and
+ * return how many there are.
+ */
+static inline size_t
+rb_par_cuts(rbt_t const*const tree, void const*const lo, void const*const hi,
+            rbtkeycmp_t const cmpfunc, rbn_t const*const first, unsigned const levels, rbn_t **const out)
+{
+    rbn_t *stack[RBT_PAR_MAX_LEVELS];
+    unsigned depth[RBT_PAR_MAX_LEVELS];
+    unsigned sp = 0;
+    size_t n = 0;
+    rbn_t *x = tree->m_top;
+    unsigned d = 0;
+
+    // In-order walk that doesn't go below the top levels
+    for (;;) {
+        while ((x != &tree->m_nil) && (d < levels)) {
+            stack[sp] = x;
+            depth[sp++] = d;
+            x = x->lc;
+            ++d;
+        }
+        if (sp == 0)
+            break;
+        x = stack[--sp];
+        d = depth[sp];
+        if ((x != first) && ((lo == NULL) || (cmpfunc(lo, x) <= 0)) &&
+            ((hi == NULL) || (cmpfunc(hi, x) > 0))) {
+            out[n++] = x;
+        }
+        x = x->rc;
+        ++d;
+    }
+
+    return n;
+}
+
+/*
+ * Call `visit` on each element from the first not less than `lo` up to but not
+ * including the first not less than `hi`, using up to `nthreads` threads
+ * including the caller's. A NULL `lo` or `hi` leaves that end of the range
+ * open.
+ *
+ * Without `reduce` every call gets `state`, from whichever thread, and the
+ * visitor has to look after its own synchronization. With `reduce` each piece
+ * gets its own copy of the `size` bytes at `state`, which should hold the
+ * identity of the reduction, and once every piece is done they are folded into
+ * `state` in key order. That gives the same result as a sequential walk for
+ * any associative reduction, such as concatenation, which isn't commutative.
+ *
+ * Returns 0, or -1 with errno set if there wasn't memory for the pieces, in
+ * which case nothing was visited. If threads can't be started the remaining
+ * work is done by those that could.
+ */
+static inline int
+rbt_base_parallel_for_each(rbt_t *const tree, void const*const lo, void const*const hi,
+                           rbtkeycmp_t const cmpfunc, rbtvisit_t const visit, void *const state,
+                           size_t const size, rbtreduce_t const reduce, unsigned nthreads)
+{
+    rbn_t *const first = (lo != NULL) ? rbt_base_lower_bound(tree, lo, cmpfunc) : rbt_base_min(tree);
+    rbn_t *const end = (hi != NULL) ? rbt_base_lower_bound(tree, hi, cmpfunc) : NULL;
+    if ((first == NULL) || ((hi != NULL) && (cmpfunc(hi, first) <= 0)))
+        return 0;
+
+    if (nthreads == 0)
+        nthreads = 1;
+    unsigned levels = 0;
+    while ((levels < RBT_PAR_MAX_LEVELS) &&
+           ((size_t)1 << levels) < (size_t)nthreads * RBT_PAR_PIECES_PER_THREAD)
+        ++levels;
+    if (nthreads == 1)
+        levels = 0;
+
+    rbn_t **const bounds = malloc(sizeof(*bounds) * (((size_t)1 << levels) + 1));
+    if (bounds == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    bounds[0] = first;
+    size_t const pieces = 1 + rb_par_cuts(tree, lo, hi, cmpfunc, first, levels, bounds + 1);
+    bounds[pieces] = (end != NULL) ? end : &tree->m_nil;
+
+    unsigned char *states = state;
+    if (reduce != NULL) {
+        states = malloc(size * pieces);
+        if (states == NULL) {
+            free(bounds);
+            errno = ENOMEM;
+            return -1;
+        }
+        for (size_t i = 0; i < pieces; ++i)
+            memcpy(states + i * size, state, size);
+    }
+
+    rbtpr_t r = {
+        .m_tree = tree,
+        .m_bounds = bounds,
+        .m_pieces = pieces,
+        .m_next = 0,
+        .m_visit = visit,
+        .m_states = states,
+        .m_size = (reduce != NULL) ? size : 0,
+    };
+
+    if (nthreads > pieces)
+        nthreads = pieces;
+    pthread_t *const threads = (nthreads > 1) ? malloc(sizeof(*threads) * (nthreads - 1)) : NULL;
+    unsigned started = 0;
+    if (threads != NULL) {
+        while ((started < nthreads - 1) &&
+               (pthread_create(&threads[started], NULL, rb_par_worker, &r) == 0))
+            ++started;
+    }
+    rb_par_worker(&r);
+    for (unsigned i = 0; i < started; ++i)
+        pthread_join(threads[i], NULL);
+    free(threads);
+
+    if (reduce != NULL) {
+        for (size_t i = 0; i < pieces; ++i)
+            reduce(state, states + i * size);
+        free(states);
+    }
+    free(bounds);
+
+    return 0;
+}
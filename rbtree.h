@@ -7,6 +7,31 @@
 
 #include "rbttype.h"
 
+/*
+ * Counters are bumped through this so that they vanish when RBT_STATS is not
+ * defined. Lookups take a const tree, the counters are the one thing they may
+ * still write to.
+ */
+#ifdef RBT_STATS
+#define RBT_STAT_ADD(tree, field, n) (((rbt_t *)(tree))->m_stats.field += (n))
+#else
+#define RBT_STAT_ADD(tree, field, n) ((void)0)
+#endif
+
+// For lookups that count, which stop being pure once the counters are in
+#ifdef RBT_STATS
+#define RBT_PURE
+#else
+#define RBT_PURE __attribute__((pure))
+#endif
+
+// wavl_init gives the sentinel rank -1, which the red-black mutators here
+// would take for a color. Trees from wavltree.h have to use its own.
+#define RB_ASSERT_NOT_WAVL(tree) assert((tree)->m_nil.color == BLACK)
+
+// Deeper than any tree that fits in memory can get
+#define RBT_MAX_DEPTH 128
+
 __attribute__((pure))
 static inline size_t
 rbt_size(rbt_t const*const p_tree)
@@ -14,132 +39,168 @@ rbt_size(rbt_t const*const p_tree)
     return p_tree->m_size;
 }
 
+/*
+ * Rotate at x, with the child on side !d taking x's place and x moving down to
+ * side d. So d = 0 is a left rotation and d = 1 a right rotation:
+ *
+ *        R                R
+ *       / \              / \
+ *      z   x            z   y
+ *         / \     ->       / \
+ *        y   c            a   x
+ *       / \                  / \
+ *      a   b                b   c
+ *
+ * is a right rotation at x.
+ */
 static inline void
-right_rotate(rbt_t *const T, rbn_t *const x)
+rb_rotate(rbt_t *const T, rbn_t *const x, int const d)
 {
-    /*
-     * Right Rotate with the pivot point as the branch leading to x
-     *
-     *        R                R
-     *       / \              / \
-     *      z   x            z   y
-     *         / \     ->       / \
-     *        y   c            a   x
-     *       / \                  / \
-     *      a   b                b   c
-     *
-     */
-    rbn_t *const y = x->lc;
-    x->lc = y->rc;
-    if (y->rc != &T->m_nil) {
-        y->rc->p = x;
+    if (d)
+        RBT_STAT_ADD(T, rotr, 1);
+    else
+        RBT_STAT_ADD(T, rotl, 1);
+    rbn_t *const y = x->ch[!d];
+    x->ch[!d] = y->ch[d];
+    if (y->ch[d] != &T->m_nil) {
+        y->ch[d]->p = x;
     }
     y->p = x->p;
     if (x->p == &T->m_nil) {
         T->m_top = y;
-    } else if (x == x->p->lc) {
-        x->p->lc = y;
     } else {
-        x->p->rc = y;
+        x->p->ch[x == x->p->rc] = y;
     }
-    y->rc = x;
+    y->ch[d] = x;
     x->p = y;
+
+    if (T->m_aug != NULL) {
+        T->m_aug(x, &T->m_nil);
+        T->m_aug(y, &T->m_nil);
+    }
 }
 
+// Bring the subtree summaries up to date from x towards the top. Once one
+// comes out the same, so do all of those above it.
 static inline void
-left_rotate(rbt_t *const T, rbn_t *const x)
+rb_aug_path(rbt_t *const tree, rbn_t *x)
 {
-    /*
-     * Left Rotate with the pivot point as the branch leading to x
-     *
-     *        R              R
-     *       / \            / \
-     *      x   z          y   z
-     *     / \       ->   / \
-     *    a   y          x   c
-     *       / \        / \
-     *      b   c      a   b
-     *
-     */
-    rbn_t *const y = x->rc;
-    x->rc = y->lc;
-    if (y->lc != &T->m_nil) {
-        y->lc->p = x;
-    }
-    y->p = x->p;
-    if (x->p == &T->m_nil) {
-        T->m_top = y;
-    } else if (x == x->p->lc) {
-        x->p->lc = y;
-    } else {
-        x->p->rc = y;
+    for (; x != &tree->m_nil; x = x->p) {
+        if (!tree->m_aug(x, &tree->m_nil))
+            break;
     }
-    y->lc = x;
-    x->p = y;
 }
 
 static inline void
-rb_insert_fixup(rbt_t *const tree, rbn_t *z)
+right_rotate(rbt_t *const T, rbn_t *const x)
 {
-    while (z->p->color == RED) {
+    rb_rotate(T, x, 1);
+}
 
-        if (z->p == z->p->p->lc) {
-            rbn_t *const y = z->p->p->rc;
-            if (y->color == RED) {
-                /* case 1 */
-                z->p->color = BLACK;
-                y->color = BLACK;
-                z->p->p->color = RED;
-                z = z->p->p;
-            } else {
-                if (z == z->p->rc) {
-                    /* case 2 */
-                    z = z->p;
-                    left_rotate(tree, z);
-                }
-                /* case 3 */
-                z->p->color = BLACK;
-                z->p->p->color = RED;
-                right_rotate(tree, z->p->p);
-            }
+static inline void
+left_rotate(rbt_t *const T, rbn_t *const x)
+{
+    rb_rotate(T, x, 0);
+}
+
+// Resolve a red z under a red parent, which may leave the top red. The two
+// mirrored halves are one, with d the side of the parent under the grandparent.
+static inline void
+rb_insert_repair(rbt_t *const tree, rbn_t *z)
+{
+    while (z->p->color == RED) {
+        RBT_STAT_ADD(tree, ins_fixups, 1);
+
+        rbn_t *const g = z->p->p;
+        int const d = (z->p == g->rc);
+        rbn_t *const y = g->ch[!d];
+        if (y->color == RED) {
+            /* case 1 */
+            RBT_STAT_ADD(tree, recolors, 3);
+            z->p->color = BLACK;
+            y->color = BLACK;
+            g->color = RED;
+            z = g;
         } else {
-            rbn_t *const y = z->p->p->lc;
-            if (y->color == RED) {
-                /* case 1 */
-                z->p->color = BLACK;
-                y->color = BLACK;
-                z->p->p->color = RED;
-                z = z->p->p;
-            } else {
-                if (z == z->p->lc) {
-                    /* case 2 */
-                    z = z->p;
-                    right_rotate(tree, z);
-                }
-                /* case 3 */
-                z->p->color = BLACK;
-                z->p->p->color = RED;
-                left_rotate(tree, z->p->p);
+            if (z == z->p->ch[!d]) {
+                /* case 2 */
+                z = z->p;
+                rb_rotate(tree, z, d);
             }
+            /* case 3 */
+            RBT_STAT_ADD(tree, recolors, 2);
+            z->p->color = BLACK;
+            g->color = RED;
+            rb_rotate(tree, g, !d);
         }
     }
+}
+
+static inline void
+rb_insert_fixup(rbt_t *const tree, rbn_t *const z)
+{
+    rb_insert_repair(tree, z);
+    RBT_STAT_ADD(tree, recolors, tree->m_top->color != BLACK);
     tree->m_top->color = BLACK;
 }
 
-static inline rbn_t *
-rbt_base_add(rbt_t *const tree, rbn_t *const z, rbtcmp_t const cmpfunc)
+/*
+ * Link z in as a child of y, which the caller found with a descent. As z lands
+ * next to its in-order neighbour, the min and max can be kept without calling
+ * the comparator.
+ */
+static inline void
+rb_attach_node(rbt_t *const tree, rbn_t *const z, rbn_t *const y, int const left)
 {
-    z->p = &tree->m_nil;
+    z->p = y;
     z->lc = &tree->m_nil;
     z->rc = &tree->m_nil;
     z->color = RED;
 
+    if (y == &tree->m_nil) {
+        tree->m_top = z;
+        tree->m_min = z;
+        tree->m_max = z;
+    } else if (left) {
+        y->lc = z;
+        if (y == tree->m_min)
+            tree->m_min = z;
+    } else {
+        y->rc = z;
+        if (y == tree->m_max)
+            tree->m_max = z;
+    }
+}
+
+// Link z in as a child of y and rebalance
+static inline void
+rb_link_node(rbt_t *const tree, rbn_t *const z, rbn_t *const y, int const left)
+{
+    RB_ASSERT_NOT_WAVL(tree);
+    rb_attach_node(tree, z, y, left);
+    if (tree->m_aug != NULL) {
+        tree->m_aug(z, &tree->m_nil);
+        rb_aug_path(tree, y);
+    }
+    rb_insert_fixup(tree, z);
+
+    ++tree->m_size;
+    ++tree->m_gen;
+}
+
+static inline rbn_t *
+rbt_base_add(rbt_t *const tree, rbn_t *const z, rbtcmp_t const cmpfunc)
+{
     rbn_t *y = &tree->m_nil;
     rbn_t *x = tree->m_top;
+    int cmp = 0;
     /* find insertion point into the tree, or an existing element */
+    RBT_STAT_ADD(tree, descents, 1);
     while (x != &tree->m_nil) {
         y = x;
-        int const cmp = cmpfunc(z, x);
+        RBT_STAT_ADD(tree, depth, 1);
+        RBT_STAT_ADD(tree, cmps, 1);
+        cmp = cmpfunc(z, x);
         if (cmp < 0)
             x = x->lc;
         else if (cmp > 0)
@@ -148,46 +209,82 @@ rbt_base_add(rbt_t *const tree, rbn_t *const z, rbtcmp_t const cmpfunc)
             return x;
     }
 
-    /* Once we decide to insert, fixup the max/min */
-    if ((tree->m_min == &tree->m_nil) ||
-        (cmpfunc(z, tree->m_min) < 0)) {
-        tree->m_min = z;
-    }
-
-    if ((tree->m_max == &tree->m_nil) ||
-        (cmpfunc(z, tree->m_max) > 0)) {
-        tree->m_max = z;
-    }
+    rb_link_node(tree, z, y, cmp < 0);
 
+    return z;
+}
 
-    z->p = y;
-    if (y == &tree->m_nil) {
-        tree->m_top = z;
-    } else {
-        int const cmp = cmpfunc(z, y);
+/*
+ * Look up a key and return its element. On a miss `make` is called to build
+ * one, which is linked in where the descent ended, so there is no second pass
+ * over the tree and nothing is constructed for a hit. Returns NULL only if
+ * `make` does.
+ */
+static inline rbn_t *
+rbt_base_find_or_insert(rbt_t *const tree, void const*const key, rbtkeycmp_t const cmpfunc,
+                        rbtmake_t const make, void *const ctx)
+{
+    rbn_t *y = &tree->m_nil;
+    rbn_t *x = tree->m_top;
+    int cmp = 0;
+    RBT_STAT_ADD(tree, descents, 1);
+    while (x != &tree->m_nil) {
+        y = x;
+        RBT_STAT_ADD(tree, depth, 1);
+        RBT_STAT_ADD(tree, cmps, 1);
+        cmp = cmpfunc(key, x);
         if (cmp < 0)
-            y->lc = z;
+            x = x->lc;
+        else if (cmp > 0)
+            x = x->rc;
         else
-            y->rc = z;
+            return x;
     }
 
-    rb_insert_fixup(tree, z);
+    rbn_t *const z = make(key, ctx);
+    if (z == NULL)
+        return NULL;
+    assert(cmpfunc(key, z) == 0);
 
-    ++tree->m_size;
-    ++tree->m_gen;
+    rb_link_node(tree, z, y, cmp < 0);
 
     return z;
 }
 
-__attribute__((pure))
+/*
+ * Insert an element even if others with an equal key are already in the tree.
+ * It goes after all of them, so equal elements stay in insertion order.
+ */
+static inline void
+rbt_base_add_multi(rbt_t *const tree, rbn_t *const z, rbtcmp_t const cmpfunc)
+{
+    rbn_t *y = &tree->m_nil;
+    rbn_t *x = tree->m_top;
+    int cmp = 0;
+    RBT_STAT_ADD(tree, descents, 1);
+    while (x != &tree->m_nil) {
+        y = x;
+        RBT_STAT_ADD(tree, depth, 1);
+        RBT_STAT_ADD(tree, cmps, 1);
+        cmp = cmpfunc(z, x);
+        x = (cmp < 0) ? x->lc : x->rc;
+    }
+
+    rb_link_node(tree, z, y, cmp < 0);
+}
+
+RBT_PURE
 static inline rbn_t *
 rb_find_node_by_key(rbt_t const*const tree, void const*const key, rbtkeycmp_t const cmpfunc)
 {
     rbn_t *x = tree->m_top;
+    RBT_STAT_ADD(tree, descents, 1);
     for (;;) {
         if (x == &tree->m_nil)
             return NULL;
 
+        RBT_STAT_ADD(tree, depth, 1);
+        RBT_STAT_ADD(tree, cmps, 1);
         int const cmp = cmpfunc(key, x);
         if (cmp < 0)
             x = x->lc;
@@ -199,7 +296,7 @@ rb_find_node_by_key(rbt_t const*const tree, void const*const key, rbtkeycmp_t co
 }
 
 // Gets the pointer associated with a key.
-__attribute__((pure))
+RBT_PURE
 static inline rbn_t *
 rbt_base_get(rbt_t const*const tree, void const*const key, rbtkeycmp_t const cmpfunc)
 {
@@ -210,6 +307,75 @@ rbt_base_get(rbt_t const*const tree, void const*const key, rbtkeycmp_t const cmp
     return x;
 }
 
+/*
+ * Integer keys. Rather than a three way comparator `keyfunc` returns the key of
+ * an element, and comparing keys directly gives the direction at each node as
+ * a bit that indexes the children. These descents don't stop at an equal key,
+ * they keep going to the bottom remembering the last node where they turned
+ * left, which is the first element not less than the key. That is a level more
+ * on average for a hit, but there is no branch to mispredict apart from the
+ * loop exit.
+ *
+ * This pays off while the tree is mostly in cache. Once most levels miss, the
+ * branchy descents of the comparator based functions do better, since the CPU
+ * starts loading the child it guesses before the comparison is done, where
+ * here each load has to wait for the one before it.
+ */
+RBT_PURE
+static inline rbn_t *
+rb_int_lower_bound(rbt_t const*const tree, int64_t const key, rbtintkey_t const keyfunc)
+{
+    rbn_t *y = NULL;
+    rbn_t *x = tree->m_top;
+    RBT_STAT_ADD(tree, descents, 1);
+    while (x != &tree->m_nil) {
+        RBT_STAT_ADD(tree, depth, 1);
+        RBT_STAT_ADD(tree, cmps, 1);
+        int const right = key > keyfunc(x);
+        y = right ? y : x;
+        x = x->ch[right];
+    }
+
+    return y;
+}
+
+RBT_PURE
+static inline rbn_t *
+rbt_base_get_int(rbt_t const*const tree, int64_t const key, rbtintkey_t const keyfunc)
+{
+    rbn_t *const y = rb_int_lower_bound(tree, key, keyfunc);
+    if ((y == NULL) || (keyfunc(y) != key))
+        return NULL;
+
+    return y;
+}
+
+// Add an element unless one with an equal key is present, which is returned
+static inline rbn_t *
+rbt_base_add_int(rbt_t *const tree, rbn_t *const z, rbtintkey_t const keyfunc)
+{
+    int64_t const key = keyfunc(z);
+    rbn_t *e = NULL;
+    rbn_t *y = &tree->m_nil;
+    rbn_t *x = tree->m_top;
+    int right = 0;
+    RBT_STAT_ADD(tree, descents, 1);
+    while (x != &tree->m_nil) {
+        y = x;
+        RBT_STAT_ADD(tree, depth, 1);
+        RBT_STAT_ADD(tree, cmps, 1);
+        right = key > keyfunc(x);
+        e = right ? e : x;
+        x = x->ch[right];
+    }
+    if ((e != NULL) && (keyfunc(e) == key))
+        return e;
+
+    rb_link_node(tree, z, y, !right);
+
+    return z;
+}
+
 static inline void
 rb_transplant(rbt_t *const tree, rbn_t *const u, rbn_t *const v)
 {
@@ -243,67 +409,84 @@ tree_maximum(rbt_t const*const T, rbn_t *x)
     return x;
 }
 
+// In-order neighbours found by walking the links, returns m_nil at either end
+__attribute__((pure))
+static inline rbn_t *
+tree_successor(rbt_t const*const T, rbn_t *x)
+{
+    if (x->rc != &T->m_nil)
+        return tree_minimum(T, x->rc);
+
+    rbn_t *y = x->p;
+    while ((y != &T->m_nil) && (x == y->rc)) {
+        x = y;
+        y = y->p;
+    }
+
+    return y;
+}
+
+__attribute__((pure))
+static inline rbn_t *
+tree_predecessor(rbt_t const*const T, rbn_t *x)
+{
+    if (x->lc != &T->m_nil)
+        return tree_maximum(T, x->lc);
+
+    rbn_t *y = x->p;
+    while ((y != &T->m_nil) && (x == y->lc)) {
+        x = y;
+        y = y->p;
+    }
+
+    return y;
+}
+
+// Push the extra black on x up the tree. As on insertion the mirrored halves are
+// folded, with d the side x is on.
 static inline void
 rb_delete_fixup(rbt_t *const tree, rbn_t *x)
 {
     while ((x != tree->m_top) && (x->color == BLACK)) {
-        if (x == x->p->lc) {
-            rbn_t *w = x->p->rc;
-            if (w->color == RED) {
-                w->color = BLACK;
-                x->p->color = RED;
-                left_rotate(tree, x->p);
-                w = x->p->rc;
-            }
-            if ((w->lc->color == BLACK) && (w->rc->color == BLACK)) {
-                w->color = RED;
-                x = x->p;
-            } else {
-                if (w->rc->color == BLACK) {
-                    w->lc->color = BLACK;
-                    w->color = RED;
-                    right_rotate(tree, w);
-                    w = x->p->rc;
-                }
-                w->color = x->p->color;
-                x->p->color = BLACK;
-                w->rc->color = BLACK;
-                left_rotate(tree, x->p);
-                x = tree->m_top;
-            }
+        RBT_STAT_ADD(tree, del_fixups, 1);
+        int const d = (x != x->p->lc);
+        rbn_t *w = x->p->ch[!d];
+        if (w->color == RED) {
+            RBT_STAT_ADD(tree, recolors, 2);
+            w->color = BLACK;
+            x->p->color = RED;
+            rb_rotate(tree, x->p, d);
+            w = x->p->ch[!d];
+        }
+        if ((w->lc->color == BLACK) && (w->rc->color == BLACK)) {
+            RBT_STAT_ADD(tree, recolors, 1);
+            w->color = RED;
+            x = x->p;
         } else {
-            rbn_t *w = x->p->lc;
-            if (w->color == RED) {
-                w->color = BLACK;
-                x->p->color = RED;
-                right_rotate(tree, x->p);
-                w = x->p->lc;
-            }
-            if ((w->rc->color == BLACK) && (w->lc->color == BLACK)) {
+            if (w->ch[!d]->color == BLACK) {
+                RBT_STAT_ADD(tree, recolors, 2);
+                w->ch[d]->color = BLACK;
                 w->color = RED;
-                x = x->p;
-            } else {
-                if (w->lc->color == BLACK) {
-                    w->rc->color = BLACK;
-                    w->color = RED;
-                    left_rotate(tree, w);
-                    w = x->p->lc;
-                }
-                w->color = x->p->color;
-                x->p->color = BLACK;
-                w->lc->color = BLACK;
-                right_rotate(tree, x->p);
-                x = tree->m_top;
+                rb_rotate(tree, w, !d);
+                w = x->p->ch[!d];
             }
+            RBT_STAT_ADD(tree, recolors, 3);
+            w->color = x->p->color;
+            x->p->color = BLACK;
+            w->ch[!d]->color = BLACK;
+            rb_rotate(tree, x->p, d);
+            x = tree->m_top;
         }
     }
 
+    RBT_STAT_ADD(tree, recolors, x->color != BLACK);
     x->color = BLACK;
 }
 
 static inline void
 rb_base_delete(rbt_t *const tree, rbn_t *const z)
 {
+    RB_ASSERT_NOT_WAVL(tree);
     if (z == tree->m_min) {
         tree->m_min = (z->rc != &tree->m_nil) ? z->rc : z->p;
     }
@@ -337,6 +520,19 @@ rb_base_delete(rbt_t *const tree, rbn_t *const z)
         y->color = z->color;
     }
 
+    // x->p is the lowest node whose children changed, even when x is m_nil.
+    // When y took z's place, everything up to it has to be redone, as what is
+    // above was summed up with z.
+    if (tree->m_aug != NULL) {
+        rbn_t *a = x->p;
+        if (y != z) {
+            for (; a != y; a = a->p)
+                tree->m_aug(a, &tree->m_nil);
+            tree->m_aug(y, &tree->m_nil);
+            a = y->p;
+        }
+        rb_aug_path(tree, a);
+    }
     if (y_orig_color == BLACK)
         rb_delete_fixup(tree, x);
 
@@ -411,110 +607,178 @@ rbt_base_max(rbt_t const*const tree)
     return tree->m_max;
 }
 
+/*
+ * Bound queries. Each is a single descent that remembers the last node on the
+ * correct side of the key, so they also do the right thing when the tree
+ * holds several elements with equal keys.
+ */
+
+// Last element less than the key
 static inline rbn_t *
 rbt_base_lt(rbt_t const*const tree, void const*const key, rbtkeycmp_t const cmpfunc)
 {
-    rbn_t *x = tree->m_top;
-    rbn_t *y = x;
-    if (x == &tree->m_nil)
+    if (tree->m_min == &tree->m_nil)
         return NULL;
 
-    int cmp = cmpfunc(key, tree->m_min);
     // If all elements in the tree are greater than or equal to the key, return
     // NULL
-    if (cmp <= 0) {
+    RBT_STAT_ADD(tree, cmps, 1);
+    if (cmpfunc(key, tree->m_min) <= 0)
         return NULL;
-    }
 
+    rbn_t *y = NULL;
+    rbn_t *x = tree->m_top;
+    RBT_STAT_ADD(tree, descents, 1);
     while (x != &tree->m_nil) {
-        y = x;
-        cmp = cmpfunc(key, x);
-        if (cmp < 0) {
-            x = x->lc;
-        } else if (cmp > 0) {
+        RBT_STAT_ADD(tree, depth, 1);
+        RBT_STAT_ADD(tree, cmps, 1);
+        if (cmpfunc(key, x) > 0) {
+            y = x;
             x = x->rc;
         } else {
-            return NULL;
-        }
-    }
-
-    assert(x == &tree->m_nil);
-    for (;;) {
-        cmp = cmpfunc(key, y);
-        if (cmp > 0) {
-            // y is less than key, done!
-            break;
+            x = x->lc;
         }
-        y = y->p;
     }
 
     return y;
 }
 
+// First element greater than the key, this is also the upper bound
 static inline rbn_t *
 rbt_base_gt(rbt_t const*const tree, void const*const key, rbtkeycmp_t const cmpfunc)
 {
-    rbn_t *x = tree->m_top;
-    rbn_t *y = x;
-    if (x == &tree->m_nil) {
+    if (tree->m_max == &tree->m_nil)
         return NULL;
-    }
 
-    int cmp = cmpfunc(key, tree->m_max);
     // If all elements in the tree are less than or equal to the key, return
     // NULL
-    if (cmp >= 0) {
+    RBT_STAT_ADD(tree, cmps, 1);
+    if (cmpfunc(key, tree->m_max) >= 0)
         return NULL;
-    }
 
+    rbn_t *y = NULL;
+    rbn_t *x = tree->m_top;
+    RBT_STAT_ADD(tree, descents, 1);
     while (x != &tree->m_nil) {
-        y = x;
-        cmp = cmpfunc(key, x);
-        if (cmp < 0) {
+        RBT_STAT_ADD(tree, depth, 1);
+        RBT_STAT_ADD(tree, cmps, 1);
+        if (cmpfunc(key, x) < 0) {
+            y = x;
             x = x->lc;
-        } else if (cmp > 0) {
-            x = x->rc;
         } else {
-            return NULL;
+            x = x->rc;
         }
     }
 
-    assert(x == &tree->m_nil);
-    for (;;) {
-        cmp = cmpfunc(key, y);
-        if (cmp < 0) {
-            // y is greater than key, done!
-            break;
+    return y;
+}
+
+// First element not less than the key. With duplicates this is the earliest
+// inserted of the equal elements.
+static inline rbn_t *
+rbt_base_lower_bound(rbt_t const*const tree, void const*const key, rbtkeycmp_t const cmpfunc)
+{
+    rbn_t *y = NULL;
+    rbn_t *x = tree->m_top;
+    RBT_STAT_ADD(tree, descents, 1);
+    while (x != &tree->m_nil) {
+        RBT_STAT_ADD(tree, depth, 1);
+        RBT_STAT_ADD(tree, cmps, 1);
+        if (cmpfunc(key, x) <= 0) {
+            y = x;
+            x = x->lc;
+        } else {
+            x = x->rc;
         }
-        y = y->p;
     }
+
     return y;
 }
 
-__attribute__((pure))
 static inline rbn_t *
-rbt_base_next(rbt_t *const tree, rbn_t *const x, rbtcmp_t const cmpfunc)
+rbt_base_upper_bound(rbt_t const*const tree, void const*const key, rbtkeycmp_t const cmpfunc)
 {
-    rbn_t *y = NULL;
+    return rbt_base_gt(tree, key, cmpfunc);
+}
 
-    if (x->rc != &tree->m_nil) {
-        y = tree_minimum(tree, x->rc);
-    } else {
-        // No right child, we need to traverse up the tree until we find a
-        // larger node
-        y = x;
-        for (;;) {
-            y = y->p;
-            if (y == &tree->m_nil) {
-                break;
-            }
-            int cmp = cmpfunc(x, y);
-            if (cmp < 0) {
-                break;
-            }
-        }
+/*
+ * The elements equal to the key are those from *p_first up to but not
+ * including *p_end, which is NULL at the end of the tree. Returns 1 if there
+ * are any. Two descents, however many duplicates there are.
+ */
+static inline int
+rbt_base_equal_range(rbt_t const*const tree, void const*const key, rbtkeycmp_t const cmpfunc,
+                     rbn_t **const p_first, rbn_t **const p_end)
+{
+    rbn_t *const first = rbt_base_lower_bound(tree, key, cmpfunc);
+    if ((first == NULL) || (cmpfunc(key, first) != 0)) {
+        *p_first = *p_end = first;
+        return 0;
+    }
+
+    *p_first = first;
+    *p_end = rbt_base_upper_bound(tree, key, cmpfunc);
+    return 1;
+}
+
+// Number of elements equal to the key. The nodes don't keep subtree sizes so
+// this is O(log n + k) for k duplicates.
+static inline size_t
+rbt_base_count(rbt_t const*const tree, void const*const key, rbtkeycmp_t const cmpfunc)
+{
+    rbn_t *first, *end;
+    if (!rbt_base_equal_range(tree, key, cmpfunc, &first, &end))
+        return 0;
+
+    size_t count = 0;
+    for (rbn_t *x = first; (x != end) && (x != &tree->m_nil); x = tree_successor(tree, x))
+        ++count;
+
+    return count;
+}
+
+// Remove the earliest inserted element equal to the key
+static inline rbn_t *
+rbt_base_rem_one(rbt_t *const tree, void const*const key, rbtkeycmp_t const cmpfunc)
+{
+    rbn_t *const x = rbt_base_lower_bound(tree, key, cmpfunc);
+    if ((x == NULL) || (cmpfunc(key, x) != 0))
+        return NULL;
+
+    rb_base_delete(tree, x);
+
+    return x;
+}
+
+// Remove every element equal to the key, handing each to `removed` once it is
+// out of the tree. Returns how many there were.
+static inline size_t
+rbt_base_rem_all(rbt_t *const tree, void const*const key, rbtkeycmp_t const cmpfunc,
+                 rbtvisit_t const removed, void *const ctx)
+{
+    size_t count = 0;
+    rbn_t *x = rbt_base_lower_bound(tree, key, cmpfunc);
+    while ((x != NULL) && (cmpfunc(key, x) == 0)) {
+        rbn_t *const next = tree_successor(tree, x);
+        rb_base_delete(tree, x);
+        if (removed != NULL)
+            removed(x, ctx);
+        ++count;
+        x = (next == &tree->m_nil) ? NULL : next;
     }
 
+    return count;
+}
+
+// The comparator is no longer needed to step through the tree, the parent
+// links are enough. It is kept so existing callers don't have to change.
+__attribute__((pure))
+static inline rbn_t *
+rbt_base_next(rbt_t *const tree, rbn_t *const x, rbtcmp_t const cmpfunc)
+{
+    (void)cmpfunc;
+    rbn_t *const y = tree_successor(tree, x);
+
     if (y == &tree->m_nil) {
         return NULL;
     }
@@ -526,25 +790,8 @@ __attribute__((pure))
 static inline rbn_t *
 rbt_base_prev(rbt_t *const tree, rbn_t *const x, rbtcmp_t const cmpfunc)
 {
-    rbn_t *y = &tree->m_nil;
-
-    if (x->lc != &tree->m_nil) {
-        y = tree_maximum(tree, x->lc);
-    } else {
-        // No left child, we need to traverse up the tree until we find a
-        // smaller node
-        y = x;
-        for (;;) {
-            y = y->p;
-            if (y == &tree->m_nil) {
-                break;
-            }
-            int cmp = cmpfunc(x, y);
-            if (cmp > 0) {
-                break;
-            }
-        }
-    }
+    (void)cmpfunc;
+    rbn_t *const y = tree_predecessor(tree, x);
 
     if (y == &tree->m_nil) {
         return NULL;
@@ -553,3 +800,1427 @@ rbt_base_prev(rbt_t *const tree, rbn_t *const x, rbtcmp_t const cmpfunc)
     return y;
 }
 
+/*
+ * Cursor relative operations. A cursor is any node in the tree, and these
+ * work from it instead of descending from the top. Inserting next to a cursor
+ * doesn't call the comparator, so the caller must make sure the new element
+ * really belongs there.
+ */
+
+// Link z just before the cursor, or at the end of the tree if it is NULL
+static inline void
+rbt_base_insert_before(rbt_t *const tree, rbn_t *const cursor, rbn_t *const z)
+{
+    if (cursor == NULL) {
+        rb_link_node(tree, z, tree->m_max, 0);
+    } else if (cursor->lc == &tree->m_nil) {
+        rb_link_node(tree, z, cursor, 1);
+    } else {
+        rb_link_node(tree, z, tree_maximum(tree, cursor->lc), 0);
+    }
+}
+
+// Link z just after the cursor, or at the start of the tree if it is NULL
+static inline void
+rbt_base_insert_after(rbt_t *const tree, rbn_t *const cursor, rbn_t *const z)
+{
+    if (cursor == NULL) {
+        rb_link_node(tree, z, tree->m_min, 1);
+    } else if (cursor->rc == &tree->m_nil) {
+        rb_link_node(tree, z, cursor, 0);
+    } else {
+        rb_link_node(tree, z, tree_minimum(tree, cursor->rc), 1);
+    }
+}
+
+// Unlink the cursor and return the element that followed it, if any
+static inline rbn_t *
+rbt_base_remove_at(rbt_t *const tree, rbn_t *const cursor)
+{
+    rbn_t *const y = tree_successor(tree, cursor);
+    rb_base_delete(tree, cursor);
+
+    return (y == &tree->m_nil) ? NULL : y;
+}
+
+/*
+ * Find the element with the key starting from the cursor. It climbs only as
+ * far as the first ancestor whose subtree must hold the key and descends from
+ * there, so the cost grows with the distance from the cursor rather than with
+ * the size of the tree.
+ */
+static inline rbn_t *
+rbt_base_finger(rbt_t const*const tree, rbn_t *const cursor, void const*const key,
+                rbtkeycmp_t const cmpfunc)
+{
+    rbn_t *x = cursor;
+    RBT_STAT_ADD(tree, cmps, 1);
+    int const dir = cmpfunc(key, x);
+    if (dir == 0)
+        return x;
+
+    // Every step up through a link on the near side of the key widens the
+    // range covered by x. Stop below the first parent that is past the key.
+    while (x->p != &tree->m_nil) {
+        rbn_t *const p = x->p;
+        if ((dir > 0) ? (x == p->lc) : (x == p->rc)) {
+            RBT_STAT_ADD(tree, cmps, 1);
+            int const cmp = cmpfunc(key, p);
+            if (cmp == 0)
+                return p;
+            if ((cmp < 0) == (dir > 0))
+                break;
+        }
+        x = p;
+    }
+
+    RBT_STAT_ADD(tree, descents, 1);
+    while (x != &tree->m_nil) {
+        RBT_STAT_ADD(tree, depth, 1);
+        RBT_STAT_ADD(tree, cmps, 1);
+        int const cmp = cmpfunc(key, x);
+        if (cmp < 0)
+            x = x->lc;
+        else if (cmp > 0)
+            x = x->rc;
+        else
+            return x;
+    }
+
+    return NULL;
+}
+
+/*
+ * Move z to where its key now belongs, after the caller has changed it. If it
+ * still sorts between its neighbours nothing moves, and only the summaries of
+ * an augmented tree are brought up to date. Otherwise it is unlinked
+ * and, like rbt_base_finger, the search for its new place climbs only from
+ * its old neighbour to the first ancestor whose subtree must hold it. Equal
+ * keys are allowed, z goes after any element that compares equal as with
+ * rbt_base_add_multi.
+ */
+static inline void
+rbt_base_rekey(rbt_t *const tree, rbn_t *const z, rbtcmp_t const cmpfunc)
+{
+    rbn_t *const nil = &tree->m_nil;
+    rbn_t *const prev = tree_predecessor(tree, z);
+    rbn_t *const next = tree_successor(tree, z);
+    RBT_STAT_ADD(tree, cmps, (prev != nil) + (next != nil));
+    int const left = (prev != nil) && (cmpfunc(prev, z) > 0);
+    if (!left && ((next == nil) || (cmpfunc(z, next) < 0))) {
+        // The summaries may depend on the key
+        if (tree->m_aug != NULL)
+            rb_aug_path(tree, z);
+        tree->m_gen++;
+        return;
+    }
+
+    rb_base_delete(tree, z);
+
+    rbn_t *x = left ? prev : next;
+    while (x->p != nil) {
+        rbn_t *const p = x->p;
+        if (left ? (x == p->rc) : (x == p->lc)) {
+            RBT_STAT_ADD(tree, cmps, 1);
+            if ((cmpfunc(z, p) >= 0) == left)
+                break;
+        }
+        x = p;
+    }
+
+    rbn_t *y = nil;
+    int cmp = 0;
+    RBT_STAT_ADD(tree, descents, 1);
+    while (x != nil) {
+        y = x;
+        RBT_STAT_ADD(tree, depth, 1);
+        RBT_STAT_ADD(tree, cmps, 1);
+        cmp = cmpfunc(z, x);
+        x = (cmp < 0) ? x->lc : x->rc;
+    }
+
+    rb_link_node(tree, z, y, cmp < 0);
+}
+
+/*
+ * Traversals of the whole tree. None of them recurse or call the comparator,
+ * they walk the parent links instead. The visitor must not modify the tree,
+ * except in the post-order walk which has finished with a node by the time it
+ * is visited, so the visitor may free it.
+ */
+static inline void
+rbt_base_inorder(rbt_t *const tree, rbtvisit_t const visit, void *const ctx)
+{
+    rbn_t *x = tree->m_min;
+    while (x != &tree->m_nil) {
+        rbn_t *const next = tree_successor(tree, x);
+        visit(x, ctx);
+        x = next;
+    }
+}
+
+static inline void
+rbt_base_preorder(rbt_t *const tree, rbtvisit_t const visit, void *const ctx)
+{
+    rbn_t *x = tree->m_top;
+    while (x != &tree->m_nil) {
+        visit(x, ctx);
+
+        if (x->lc != &tree->m_nil) {
+            x = x->lc;
+        } else if (x->rc != &tree->m_nil) {
+            x = x->rc;
+        } else {
+            // Climb until we arrive from the left at a node that has a right
+            // subtree still to be visited
+            while ((x->p != &tree->m_nil) &&
+                   ((x == x->p->rc) || (x->p->rc == &tree->m_nil))) {
+                x = x->p;
+            }
+            x = (x->p != &tree->m_nil) ? x->p->rc : &tree->m_nil;
+        }
+    }
+}
+
+// First node in post-order of the subtree under x
+__attribute__((pure))
+static inline rbn_t *
+tree_postorder_first(rbt_t const*const T, rbn_t *x)
+{
+    for (;;) {
+        if (x->lc != &T->m_nil) {
+            x = x->lc;
+        } else if (x->rc != &T->m_nil) {
+            x = x->rc;
+        } else {
+            return x;
+        }
+    }
+}
+
+// Node following x in post-order, m_nil after the top of the tree
+__attribute__((pure))
+static inline rbn_t *
+tree_postorder_next(rbt_t const*const T, rbn_t *const x)
+{
+    rbn_t *const y = x->p;
+    if ((y != &T->m_nil) && (x == y->lc) && (y->rc != &T->m_nil))
+        return tree_postorder_first(T, y->rc);
+
+    return y;
+}
+
+static inline void
+rbt_base_postorder(rbt_t *const tree, rbtvisit_t const visit, void *const ctx)
+{
+    if (tree->m_top == &tree->m_nil)
+        return;
+
+    rbn_t *x = tree_postorder_first(tree, tree->m_top);
+    while (x != &tree->m_nil) {
+        rbn_t *const next = tree_postorder_next(tree, x);
+        visit(x, ctx);
+        x = next;
+    }
+}
+
+static inline void
+rb_aug_visit(rbn_t *const x, void *const ctx)
+{
+    rbt_t *const tree = ctx;
+    tree->m_aug(x, &tree->m_nil);
+}
+
+/*
+ * Keep a summary of each subtree in the elements, such as its size, with
+ * `aug` recomputing a node's from its children's and returning whether it
+ * changed. It is run over the whole tree now, then on the nodes whose subtrees
+ * change as elements are linked in, deleted and rotated, up from the change
+ * until a summary comes out the same, which adds up to O(log n) calls to each
+ * insert and delete. A caller that already knows how a change will affect the
+ * summaries on its path, such as a size going up by one, can update them on
+ * the way down and leave only the rotations. Pass NULL to stop.
+ *
+ * Everything that inserts or deletes single elements keeps the summaries, as
+ * do joining and splitting, and rbt_base_remove_if, which doesn't rebuild
+ * while they are kept. Bulk building, the relaxed mutators and the WAVL engine
+ * don't.
+ */
+static inline void
+rbt_base_augment(rbt_t *const tree, rbtaug_t const aug)
+{
+    tree->m_aug = aug;
+    if (aug != NULL)
+        rbt_base_postorder(tree, rb_aug_visit, tree);
+}
+
+/*
+ * Empty the tree in a single pass without any rebalancing or comparator calls,
+ * every node is unlinked and handed to `destroy` exactly once, in order. If
+ * `destroy` is NULL the nodes are simply forgotten.
+ *
+ * Rather than a post-order walk, which has to come back up through every
+ * parent after its subtrees were visited, the left child of the current node
+ * is hoisted above it until the current node is the smallest one left. This
+ * only ever moves downwards and touches each node while it is still in cache.
+ */
+static inline void
+rbt_base_clear(rbt_t *const tree, rbtvisit_t const destroy, void *const ctx)
+{
+    rbn_t *x = (destroy != NULL) ? tree->m_top : &tree->m_nil;
+    while (x != &tree->m_nil) {
+        if (x->lc != &tree->m_nil) {
+            rbn_t *const y = x->lc;
+            x->lc = y->rc;
+            y->rc = x;
+            x = y;
+        } else {
+            rbn_t *const next = x->rc;
+            x->p = NULL;
+            x->lc = NULL;
+            x->rc = NULL;
+            destroy(x, ctx);
+            x = next;
+        }
+    }
+
+    tree->m_top = &tree->m_nil;
+    tree->m_min = &tree->m_nil;
+    tree->m_max = &tree->m_nil;
+    tree->m_size = 0;
+    tree->m_gen++;
+}
+
+static inline rbn_t *
+rb_build_subtree(rbt_t *const tree, size_t const n, unsigned const depth,
+        uint64_t const redmask, rbtgen_t const gen, void *const ctx)
+{
+    if (n == 0)
+        return &tree->m_nil;
+
+    size_t const nl = (n - 1) / 2;
+    rbn_t *const lc = rb_build_subtree(tree, nl, depth + 1, redmask, gen, ctx);
+    rbn_t *const x = gen(ctx);
+    rbn_t *const rc = rb_build_subtree(tree, n - 1 - nl, depth + 1, redmask, gen, ctx);
+
+    x->lc = lc;
+    x->rc = rc;
+    if (lc != &tree->m_nil)
+        lc->p = x;
+    if (rc != &tree->m_nil)
+        rc->p = x;
+    x->color = ((redmask >> depth) & 1) ? RED : BLACK;
+
+    return x;
+}
+
+/*
+ * Build an empty tree out of `n` nodes that `gen` produces in ascending order,
+ * without comparing anything. Splitting at the median leaves every level full
+ * except possibly the last one, which is colored red and the rest black.
+ */
+static inline void
+rbt_base_build(rbt_t *const tree, size_t const n, rbtgen_t const gen, void *const ctx)
+{
+    RB_ASSERT_NOT_WAVL(tree);
+    assert(tree->m_top == &tree->m_nil);
+
+    unsigned full = 0;
+    while (((size_t)2 << full) - 1 <= n)
+        ++full;
+    uint64_t const redmask = (n > ((size_t)1 << full) - 1) ? UINT64_C(1) << full : 0;
+
+    rbn_t *const top = rb_build_subtree(tree, n, 0, redmask, gen, ctx);
+    if (top != &tree->m_nil) {
+        top->p = &tree->m_nil;
+        tree->m_min = tree_minimum(tree, top);
+        tree->m_max = tree_maximum(tree, top);
+    }
+
+    tree->m_top = top;
+    tree->m_size = n;
+    tree->m_gen++;
+}
+
+/*
+ * Join a < k < b, two subtrees with the given black heights (counting black
+ * nodes, not m_nil), into one that becomes the top of the tree. Returns its
+ * black height. Only the nodes down one spine of the taller subtree are
+ * visited, so the cost is the difference in black height plus the fixup.
+ */
+static inline unsigned
+rb_join(rbt_t *const tree, rbn_t *const a, unsigned ha, rbn_t *const k, rbn_t *const b, unsigned hb)
+{
+    RB_ASSERT_NOT_WAVL(tree);
+    rbn_t *const nil = &tree->m_nil;
+
+    // With black tops neither side can put a red node under k
+    if (a->color == RED) {
+        a->color = BLACK;
+        ++ha;
+    }
+    if (b->color == RED) {
+        b->color = BLACK;
+        ++hb;
+    }
+
+    if (ha == hb) {
+        k->p = nil;
+        k->lc = a;
+        k->rc = b;
+        k->color = BLACK;
+        a->p = k;
+        b->p = k;
+        tree->m_top = k;
+        if (tree->m_aug != NULL)
+            tree->m_aug(k, nil);
+        return ha + 1;
+    }
+
+    // Find the black node of matching height down the inner spine of the
+    // taller side and put k in its place as a red node
+    rbn_t *const t = (ha > hb) ? a : b;
+    unsigned const want = (ha > hb) ? hb : ha;
+    unsigned h = (ha > hb) ? ha : hb;
+    rbn_t *y = nil;
+    rbn_t *c = t;
+    while ((c->color == RED) || (h > want)) {
+        h -= (c->color == BLACK);
+        y = c;
+        c = (ha > hb) ? c->rc : c->lc;
+    }
+
+    t->p = nil;
+    tree->m_top = t;
+    k->p = y;
+    k->color = RED;
+    if (ha > hb) {
+        y->rc = k;
+        k->lc = c;
+        k->rc = b;
+    } else {
+        y->lc = k;
+        k->lc = a;
+        k->rc = c;
+    }
+    k->lc->p = k;
+    k->rc->p = k;
+
+    // Everything above k grew, so the summaries are brought up to date before
+    // the rotations, which rely on their children's
+    if (tree->m_aug != NULL) {
+        for (rbn_t *x = k; x != nil; x = x->p)
+            tree->m_aug(x, nil);
+    }
+    rb_insert_repair(tree, k);
+    unsigned const height = ((ha > hb) ? ha : hb) + (tree->m_top->color == RED);
+    tree->m_top->color = BLACK;
+
+    return height;
+}
+
+/*
+ * Take every element that compares less than or equal to the key out of the
+ * tree, in O(log n) plus the number taken. They come back in ascending order
+ * as a NULL terminated list linked through `lc`, with `p` and `rc` NULL as
+ * though each had been deleted. The rest of the tree is put back together by
+ * joining the pieces along the search path.
+ */
+static inline rbn_t *
+rbt_base_split_le(rbt_t *const tree, void const*const key, rbtkeycmp_t const cmpfunc)
+{
+    rbn_t *const nil = &tree->m_nil;
+    rbn_t *path[RBT_MAX_DEPTH];
+    unsigned heights[RBT_MAX_DEPTH];
+    unsigned char taken[RBT_MAX_DEPTH];
+
+    unsigned h = 0;
+    for (rbn_t const *x = tree->m_top; x != nil; x = x->lc)
+        h += (x->color == BLACK);
+
+    unsigned n = 0;
+    int found = 0;
+    RBT_STAT_ADD(tree, descents, 1);
+    for (rbn_t *x = tree->m_top; x != nil; ++n) {
+        assert(n < RBT_MAX_DEPTH);
+        RBT_STAT_ADD(tree, depth, 1);
+        RBT_STAT_ADD(tree, cmps, 1);
+        path[n] = x;
+        heights[n] = h;
+        taken[n] = (cmpfunc(key, x) >= 0);
+        h -= (x->color == BLACK);
+        if (taken[n]) {
+            found = 1;
+            x = x->rc;
+        } else {
+            x = x->lc;
+        }
+    }
+
+    if (!found)
+        return NULL;
+
+    // What is taken is each node taken on the path, after its left subtree.
+    // The walk keeps its own stack so that each node is finished with when it
+    // is listed, and it fetches right children on the way down as they are
+    // needed next, rather than chasing one pointer at a time.
+    rbn_t *head = NULL;
+    rbn_t **tail = &head;
+    size_t count = 0;
+    rbn_t *stack[RBT_MAX_DEPTH];
+    for (unsigned i = 0; i < n; ++i) {
+        if (!taken[i])
+            continue;
+
+        unsigned sp = 0;
+        rbn_t *x = path[i]->lc;
+        for (;;) {
+            for (; x != nil; x = x->lc) {
+                __builtin_prefetch(x->rc);
+                stack[sp++] = x;
+            }
+            rbn_t *const y = (sp > 0) ? stack[--sp] : path[i];
+            x = y->rc;
+            *tail = y;
+            tail = &y->lc;
+            y->p = NULL;
+            y->rc = NULL;
+            ++count;
+            if (y == path[i])
+                break;
+        }
+    }
+    *tail = NULL;
+
+    // Join what is left bottom up, each piece being a node kept on the path and
+    // its right subtree, with everything below it on the left
+    rbn_t *top = nil;
+    unsigned th = 0;
+    for (unsigned i = n; i-- > 0; ) {
+        if (taken[i])
+            continue;
+        rbn_t *const x = path[i];
+        rbn_t *const b = x->rc;
+        th = rb_join(tree, top, th, x, b, heights[i] - (x->color == BLACK));
+        top = tree->m_top;
+    }
+
+    tree->m_top = top;
+    if (top == nil) {
+        tree->m_min = nil;
+        tree->m_max = nil;
+    } else {
+        top->p = nil;
+        tree->m_min = tree_minimum(tree, top);
+    }
+    tree->m_size -= count;
+    tree->m_gen++;
+
+    return head;
+}
+
+#ifndef RBT_REMOVE_IF_REBUILD
+// rbt_base_remove_if rebuilds once more than 1/RBT_REMOVE_IF_REBUILD of the
+// tree has gone
+#define RBT_REMOVE_IF_REBUILD 32
+#endif
+
+// Add z to a tree being built from an ascending stream. slot_l[h] and
+// slot_k[h] hold a perfect black subtree of height h and the node after it,
+// waiting for a subtree of the same height to go on the other side. Like a
+// binary counter, each full slot carries into the next one up.
+static inline void
+rb_stream_push(rbt_t *const tree, rbn_t **const slot_l, rbn_t **const slot_k, rbn_t *const z)
+{
+    rbn_t *t = &tree->m_nil;
+    unsigned h = 0;
+    for (; slot_k[h] != NULL; ++h) {
+        assert(h + 1 < RBT_MAX_DEPTH);
+        rbn_t *const k = slot_k[h];
+        k->lc = slot_l[h];
+        k->rc = t;
+        k->color = BLACK;
+        k->lc->p = k;
+        k->rc->p = k;
+        slot_k[h] = NULL;
+        t = k;
+    }
+    slot_l[h] = t;
+    slot_k[h] = z;
+}
+
+// Fill the stack of an in-order walk that is about to reach x: x and above it
+// each ancestor whose left subtree it is in. Returns the depth.
+static inline unsigned
+rb_walk_stack(rbt_t *const tree, rbn_t **const stack, rbn_t *x)
+{
+    unsigned sp = 0;
+    for (rbn_t *c = x; x != &tree->m_nil; c = x, x = x->p) {
+        if ((c == x) || (c == x->lc)) {
+            assert(sp < RBT_MAX_DEPTH);
+            stack[sp++] = x;
+        }
+    }
+    for (unsigned i = 0; i < sp / 2; ++i) {
+        rbn_t *const t = stack[i];
+        stack[i] = stack[sp - 1 - i];
+        stack[sp - 1 - i] = t;
+    }
+
+    return sp;
+}
+
+/*
+ * Remove every element that `pred` matches, handing each to `removed` once it
+ * is out of the tree. Returns how many there were.
+ *
+ * The sweep goes in order with its own stack rather than climbing parent
+ * links, and deletes matches where it finds them while they are sparse. Once
+ * the deletes add up to a fair part of the tree it stops rebalancing and
+ * rebuilds in the same pass instead: everything before the sweep is joined
+ * back together along the path to it, and from there on each node is finished
+ * with when the sweep reaches it. Survivors are linked up into perfect
+ * subtrees as they come, which are joined at the end, and matches are handed
+ * to `removed` on the spot, so it must not look at the tree. A tree keeping
+ * subtree summaries is never rebuilt.
+ */
+static inline size_t
+rbt_base_remove_if(rbt_t *const tree, rbtpred_t const pred, rbtvisit_t const removed, void *const ctx)
+{
+    rbn_t *const nil = &tree->m_nil;
+    size_t const limit = (tree->m_aug != NULL) ? SIZE_MAX : tree->m_size / RBT_REMOVE_IF_REBUILD;
+    size_t count = 0;
+
+    // The sweep keeps its own stack of the nodes it has yet to reach whose
+    // left subtrees it is in
+    rbn_t *stack[RBT_MAX_DEPTH];
+    unsigned sp = 0;
+    rbn_t *x = nil;
+    rbn_t *y = tree->m_top;
+    for (;;) {
+        for (; y != nil; y = y->lc) {
+            assert(sp < RBT_MAX_DEPTH);
+            __builtin_prefetch(y->rc);
+            stack[sp++] = y;
+        }
+        if (sp == 0)
+            break;
+        rbn_t *const z = stack[--sp];
+        y = z->rc;
+        if (!pred(z, ctx))
+            continue;
+        if (count >= limit) {
+            x = z;
+            break;
+        }
+
+        // Deleting can rotate what is on the stack, so it is found again from
+        // the next node up
+        rbn_t *const next = (y != nil) ? tree_minimum(tree, y) : ((sp > 0) ? stack[sp - 1] : nil);
+        rb_base_delete(tree, z);
+        if (removed != NULL)
+            removed(z, ctx);
+        ++count;
+        sp = rb_walk_stack(tree, stack, next);
+        y = nil;
+    }
+    if (x == nil)
+        return count;
+
+    // The stack holds what comes after x, the first match left, outside its
+    // right subtree. What comes before it hangs off the path down to it.
+    rbn_t *path[RBT_MAX_DEPTH];
+    unsigned heights[RBT_MAX_DEPTH];
+    unsigned n = 0;
+    for (rbn_t *a = x; a != nil; a = a->p) {
+        assert(n < RBT_MAX_DEPTH);
+        path[n++] = a;
+    }
+    unsigned h = 0;
+    for (rbn_t const *a = tree->m_top; a != nil; a = a->lc)
+        h += (a->color == BLACK);
+    for (unsigned i = n; i-- > 0; ) {
+        heights[i] = h;
+        h -= (path[i]->color == BLACK);
+    }
+
+    // Everything before x is the left subtree of x and of each ancestor that x
+    // is on the right of, which join up bottom first
+    rbn_t *before = x->lc;
+    unsigned bh = heights[0] - (x->color == BLACK);
+    before->p = nil;
+    for (unsigned i = 1; i < n; ++i) {
+        if (path[i - 1] != path[i]->rc)
+            continue;
+        rbn_t *const a = path[i];
+        bh = rb_join(tree, a->lc, heights[i] - (a->color == BLACK), a, before, bh);
+        before = tree->m_top;
+    }
+
+    x->p = NULL;
+    x->lc = NULL;
+    x->rc = NULL;
+    if (removed != NULL)
+        removed(x, ctx);
+    size_t dropped = 1;
+
+    // The first survivor is kept aside to join the two halves with
+    rbn_t *mid = NULL;
+    rbn_t *slot_l[RBT_MAX_DEPTH];
+    rbn_t *slot_k[RBT_MAX_DEPTH] = { NULL };
+    for (;;) {
+        for (; y != nil; y = y->lc) {
+            assert(sp < RBT_MAX_DEPTH);
+            __builtin_prefetch(y->rc);
+            stack[sp++] = y;
+        }
+        if (sp == 0)
+            break;
+        rbn_t *const z = stack[--sp];
+        y = z->rc;
+        if (pred(z, ctx)) {
+            z->p = NULL;
+            z->lc = NULL;
+            z->rc = NULL;
+            if (removed != NULL)
+                removed(z, ctx);
+            ++dropped;
+        } else if (mid == NULL) {
+            mid = z;
+        } else {
+            rb_stream_push(tree, slot_l, slot_k, z);
+        }
+    }
+
+    // Join the slots from the bottom up, each holding everything before what
+    // is joined so far
+    rbn_t *after = nil;
+    unsigned ah = 0;
+    for (unsigned i = 0; i < RBT_MAX_DEPTH; ++i) {
+        if (slot_k[i] == NULL)
+            continue;
+        ah = rb_join(tree, slot_l[i], i, slot_k[i], after, ah);
+        after = tree->m_top;
+    }
+
+    rbn_t *top = before;
+    if (mid != NULL) {
+        rb_join(tree, before, bh, mid, after, ah);
+        top = tree->m_top;
+    }
+
+    tree->m_top = top;
+    if (top == nil) {
+        tree->m_min = nil;
+        tree->m_max = nil;
+    } else {
+        // Left alone, what was under x can have a red top
+        top->p = nil;
+        top->color = BLACK;
+        tree->m_min = tree_minimum(tree, top);
+        tree->m_max = tree_maximum(tree, top);
+    }
+    tree->m_size -= dropped;
+    tree->m_gen++;
+
+    return count + dropped;
+}
+
+/*
+ * Relaxed balancing. The *_relaxed mutators keep the tree a correct search
+ * tree but leave the rebalancing for later, recording what is wrong in the
+ * upper bits of `color`:
+ *
+ *  - A deleted black node's weight is handed to whatever took its place. A
+ *    node can end up heavier than black (excess weight), and when the spot is
+ *    empty the weight is kept on the parent's edge to that m_nil.
+ *  - Inserts are plain red leaves and may sit under a red parent.
+ *  - Every node on the path from a violation to the top is marked dirty.
+ *
+ * Counting red as 0, black as 1 plus its excess, and each m_nil as 1 plus the
+ * weight on its edge, every path from the top down weighs the same. That
+ * makes it a chromatic tree, and rbt_base_rebalance repairs it with the local
+ * steps of one, each keeping the weights of the paths: a red-red pair is
+ * recolored or rotated away much as in an insert, and excess weight is moved
+ * up or worked off much as a double black in a delete. The highest violation
+ * goes first, so what is above it is sound and one of the steps applies.
+ *
+ * Lookups and traversals work as usual throughout. The regular mutators must
+ * not be used while rbt_base_pending() is true.
+ */
+#define RB_DIRTY 0x2
+#define RB_EXCESS_SHIFT 4
+#define RB_LNIL_SHIFT 12
+#define RB_RNIL_SHIFT 20
+#define RB_FIELD_MASK 0x7fu
+
+__attribute__((pure))
+static inline unsigned
+rb_field(rbn_t const*const x, unsigned const shift)
+{
+    return ((unsigned)x->color >> shift) & RB_FIELD_MASK;
+}
+
+static inline void
+rb_set_field(rbn_t *const x, unsigned const shift, unsigned const v)
+{
+    assert(v <= RB_FIELD_MASK);
+    x->color = (int)(((unsigned)x->color & ~(RB_FIELD_MASK << shift)) | (v << shift));
+}
+
+__attribute__((pure))
+static inline unsigned
+rb_weight(rbn_t const*const x)
+{
+    return (x->color & RED) ? 0 : 1 + rb_field(x, RB_EXCESS_SHIFT);
+}
+
+static inline void
+rb_add_weight(rbn_t *const x, unsigned const w)
+{
+    unsigned const nw = rb_weight(x) + w;
+    x->color &= ~RED;
+    rb_set_field(x, RB_EXCESS_SHIFT, nw - 1);
+}
+
+// Whether x itself breaks a rule, as opposed to something below it
+__attribute__((pure))
+static inline int
+rb_relax_violation(rbn_t const*const x)
+{
+    return ((x->color & RED) && (x->p->color & RED)) ||
+        ((unsigned)x->color & ((RB_FIELD_MASK << RB_EXCESS_SHIFT) |
+                               (RB_FIELD_MASK << RB_LNIL_SHIFT) |
+                               (RB_FIELD_MASK << RB_RNIL_SHIFT)));
+}
+
+static inline void
+rb_relax_mark(rbt_t *const tree, rbn_t *x)
+{
+    while ((x != &tree->m_nil) && !(x->color & RB_DIRTY)) {
+        x->color |= RB_DIRTY;
+        x = x->p;
+    }
+}
+
+// Clear dirty marks from x upwards for as long as nothing is left below
+static inline void
+rb_relax_settle(rbt_t *const tree, rbn_t *x)
+{
+    while (x != &tree->m_nil) {
+        if (rb_relax_violation(x) || (x->lc->color & RB_DIRTY) || (x->rc->color & RB_DIRTY))
+            break;
+        x->color &= ~RB_DIRTY;
+        x = x->p;
+    }
+}
+
+__attribute__((pure))
+static inline int
+rbt_base_pending(rbt_t const*const tree)
+{
+    return (tree->m_top->color & RB_DIRTY) != 0;
+}
+
+static inline rbn_t *
+rbt_base_add_relaxed(rbt_t *const tree, rbn_t *const z, rbtcmp_t const cmpfunc)
+{
+    RB_ASSERT_NOT_WAVL(tree);
+    rbn_t *y = &tree->m_nil;
+    rbn_t *x = tree->m_top;
+    int cmp = 0;
+    while (x != &tree->m_nil) {
+        y = x;
+        cmp = cmpfunc(z, x);
+        if (cmp < 0)
+            x = x->lc;
+        else if (cmp > 0)
+            x = x->rc;
+        else
+            return x;
+    }
+
+    z->p = y;
+    z->lc = &tree->m_nil;
+    z->rc = &tree->m_nil;
+    z->color = RED;
+
+    if (y == &tree->m_nil) {
+        tree->m_top = z;
+        tree->m_min = z;
+        tree->m_max = z;
+        z->color = BLACK;
+    } else {
+        // Take over any weight left on the edge
+        unsigned const shift = (cmp < 0) ? RB_LNIL_SHIFT : RB_RNIL_SHIFT;
+        unsigned const w = rb_field(y, shift);
+        rb_set_field(y, shift, 0);
+        if (w > 0)
+            rb_add_weight(z, w);
+
+        if (cmp < 0) {
+            y->lc = z;
+            if (y == tree->m_min)
+                tree->m_min = z;
+        } else {
+            y->rc = z;
+            if (y == tree->m_max)
+                tree->m_max = z;
+        }
+
+        if (rb_relax_violation(z))
+            rb_relax_mark(tree, z);
+        else if (w > 0)
+            rb_relax_settle(tree, y);
+    }
+
+    ++tree->m_size;
+    ++tree->m_gen;
+
+    return z;
+}
+
+static inline void
+rbt_base_delete_relaxed(rbt_t *const tree, rbn_t *const z)
+{
+    RB_ASSERT_NOT_WAVL(tree);
+    rbn_t *const nil = &tree->m_nil;
+
+    if (z == tree->m_min)
+        tree->m_min = tree_successor(tree, z);
+    if (z == tree->m_max)
+        tree->m_max = tree_predecessor(tree, z);
+
+    // x takes the place of the node that leaves its spot, xp and xleft say
+    // where that is in case x is m_nil
+    rbn_t *x;
+    rbn_t *xp;
+    int xleft;
+    unsigned w;
+    if ((z->lc == nil) || (z->rc == nil)) {
+        x = (z->lc == nil) ? z->rc : z->lc;
+        w = rb_weight(z) + ((x == nil) ? rb_field(z, RB_RNIL_SHIFT) : 0);
+        xp = z->p;
+        xleft = (xp != nil) && (z == xp->lc);
+        rb_transplant(tree, z, x);
+    } else {
+        rbn_t *const y = tree_minimum(tree, z->rc);
+        x = y->rc;
+        w = rb_weight(y) + ((x == nil) ? rb_field(y, RB_RNIL_SHIFT) : 0);
+        if (y->p == z) {
+            xp = y;
+            xleft = 0;
+        } else {
+            xp = y->p;
+            xleft = 1;
+            rb_transplant(tree, y, x);
+            y->rc = z->rc;
+            y->rc->p = y;
+        }
+        rb_transplant(tree, z, y);
+        y->lc = z->lc;
+        y->lc->p = y;
+        // z had two children, so this brings no edge weights along
+        y->color = z->color;
+    }
+
+    if (x != nil) {
+        if (w > 0)
+            rb_add_weight(x, w);
+        if (rb_relax_violation(x))
+            rb_relax_mark(tree, x);
+    } else if ((xp != nil) && (w > 0)) {
+        unsigned const shift = xleft ? RB_LNIL_SHIFT : RB_RNIL_SHIFT;
+        rb_set_field(xp, shift, rb_field(xp, shift) + w);
+        rb_relax_mark(tree, xp);
+    }
+
+    // The top can always be black, that weighs every path the same
+    tree->m_top->color &= ~RED;
+
+    z->p = NULL;
+    z->rc = NULL;
+    z->lc = NULL;
+
+    tree->m_size--;
+    tree->m_gen++;
+}
+
+static inline rbn_t *
+rbt_base_rem_relaxed(rbt_t *const tree, void const*const key, rbtkeycmp_t const cmpfunc)
+{
+    rbn_t *const x = rb_find_node_by_key(tree, key, cmpfunc);
+    if (x == NULL)
+        return NULL;
+
+    rbt_base_delete_relaxed(tree, x);
+
+    return x;
+}
+
+// The weight of p's child on side d, which for m_nil includes the edge
+__attribute__((pure))
+static inline unsigned
+rb_relax_slot(rbt_t const*const tree, rbn_t const*const p, int const d)
+{
+    if (p->ch[d] == &tree->m_nil)
+        return 1 + rb_field(p, d ? RB_RNIL_SHIFT : RB_LNIL_SHIFT);
+    return rb_weight(p->ch[d]);
+}
+
+static inline void
+rb_set_weight(rbn_t *const x, unsigned const w)
+{
+    if (w == 0) {
+        rb_set_field(x, RB_EXCESS_SHIFT, 0);
+        x->color |= RED;
+    } else {
+        x->color &= ~RED;
+        rb_set_field(x, RB_EXCESS_SHIFT, w - 1);
+    }
+}
+
+// Take one off the weight of p's child on side d
+static inline void
+rb_relax_lighten(rbt_t *const tree, rbn_t *const p, int const d)
+{
+    if (p->ch[d] == &tree->m_nil) {
+        unsigned const shift = d ? RB_RNIL_SHIFT : RB_LNIL_SHIFT;
+        assert(rb_field(p, shift) > 0);
+        rb_set_field(p, shift, rb_field(p, shift) - 1);
+    } else {
+        assert(rb_weight(p->ch[d]) > 0);
+        rb_set_weight(p->ch[d], rb_weight(p->ch[d]) - 1);
+    }
+}
+
+// rb_rotate, moving the weight on an edge to m_nil along with the edge
+static inline void
+rb_relax_rotate(rbt_t *const tree, rbn_t *const x, int const d)
+{
+    rbn_t *const y = x->ch[!d];
+    if (y->ch[d] == &tree->m_nil) {
+        unsigned const from = d ? RB_RNIL_SHIFT : RB_LNIL_SHIFT;
+        rb_set_field(x, d ? RB_LNIL_SHIFT : RB_RNIL_SHIFT, rb_field(y, from));
+        rb_set_field(y, from, 0);
+    }
+    rb_rotate(tree, x, d);
+}
+
+// Mark x if something is wrong at or below it, and clear the mark otherwise
+static inline void
+rb_relax_remark(rbt_t const*const tree, rbn_t *const x)
+{
+    if (x == &tree->m_nil)
+        return;
+    if (rb_relax_violation(x) || ((x->lc->color | x->rc->color) & RB_DIRTY))
+        x->color |= RB_DIRTY;
+    else
+        x->color &= ~RB_DIRTY;
+}
+
+// Redo the marks after a step that changed the top three levels of the
+// subtree at x, which has taken the place of a marked node
+static inline void
+rb_relax_redone(rbt_t *const tree, rbn_t *const x)
+{
+    for (int k = 0; k < 2; ++k) {
+        rbn_t *const c = x->ch[k];
+        if (c != &tree->m_nil) {
+            rb_relax_remark(tree, c->lc);
+            rb_relax_remark(tree, c->rc);
+            rb_relax_remark(tree, c);
+        }
+    }
+    rb_relax_remark(tree, x);
+    if (!(x->color & RB_DIRTY))
+        rb_relax_settle(tree, x->p);
+}
+
+/*
+ * x is red under a red parent, and the grandparent is black with nothing
+ * wrong at it. As in an insert, a red uncle takes the black from the
+ * grandparent, which can leave that red under a red, and otherwise one or two
+ * rotations finish it.
+ */
+static inline void
+rb_relax_red(rbt_t *const tree, rbn_t *const x)
+{
+    rbn_t *const p = x->p;
+    rbn_t *const g = p->p;
+    int const d = (p == g->rc);
+    rbn_t *const u = g->ch[!d];
+    if ((u != &tree->m_nil) && (u->color & RED)) {
+        // Keep the top black, which adds one to every path
+        if (g != tree->m_top)
+            rb_set_weight(g, 0);
+        rb_set_weight(p, 1);
+        rb_set_weight(u, 1);
+        rb_relax_redone(tree, g);
+        return;
+    }
+
+    rbn_t *top = p;
+    if (x == p->ch[!d]) {
+        rb_relax_rotate(tree, p, d);
+        top = x;
+    }
+    rb_relax_rotate(tree, g, !d);
+    rb_set_weight(top, 1);
+    rb_set_weight(g, 0);
+    rb_relax_redone(tree, top);
+}
+
+/*
+ * p's child on side d weighs 2 or more, and nothing is wrong above p or at p
+ * itself, which may be red. As with the double black of a delete, one is
+ * moved up to p from both children, or taken off with one or two rotations
+ * that make a red node black. A red sibling is first rotated up, or, under a
+ * red p, is a red-red pair that goes first.
+ */
+static inline void
+rb_relax_heavy(rbt_t *const tree, rbn_t *const p, int const d)
+{
+    rbn_t *const nil = &tree->m_nil;
+    rbn_t *const s = p->ch[!d];
+    unsigned const wp = rb_weight(p);
+    unsigned const ws = rb_relax_slot(tree, p, !d);
+    if (ws == 0) {
+        if (wp == 0) {
+            rb_relax_red(tree, s);
+            return;
+        }
+        // Go on under a now red p, or this would just rotate back from s
+        rb_relax_rotate(tree, p, d);
+        rb_set_weight(s, wp);
+        rb_set_weight(p, 0);
+        rb_relax_redone(tree, s);
+        rb_relax_heavy(tree, p, d);
+        return;
+    }
+
+    // A m_nil sibling weighs at least as much as the heavy child
+    rbn_t *const far = (s != nil) ? s->ch[!d] : nil;
+    rbn_t *const near = (s != nil) ? s->ch[d] : nil;
+    int const far_red = (far != nil) && (far->color & RED);
+    int const near_red = (near != nil) && (near->color & RED);
+    if ((ws >= 2) || (!far_red && !near_red)) {
+        rb_relax_lighten(tree, p, d);
+        rb_relax_lighten(tree, p, !d);
+        rb_set_weight(p, wp + 1);
+        rb_relax_redone(tree, p);
+        return;
+    }
+
+    rbn_t *top = s;
+    if (far_red) {
+        rb_set_weight(far, 1);
+    } else {
+        rb_relax_rotate(tree, s, !d);
+        top = near;
+    }
+    rb_relax_rotate(tree, p, d);
+    rb_set_weight(top, wp);
+    rb_set_weight(p, 1);
+    rb_relax_lighten(tree, p, d);
+    rb_relax_redone(tree, top);
+}
+
+/*
+ * Repair violations left by the relaxed mutators, taking at most `budget`
+ * steps. Each step recolors or rotates a few nodes around one violation, so
+ * apart from the walk down the marked path to find it, a step costs O(1).
+ * Returns whether work is still pending.
+ */
+static inline int
+rbt_base_rebalance(rbt_t *const tree, size_t const budget)
+{
+    RB_ASSERT_NOT_WAVL(tree);
+    size_t spent = 0;
+
+    while (rbt_base_pending(tree) && (spent < budget)) {
+        // Take the highest violation, so that everything above it is sound
+        rbn_t *x = tree->m_top;
+        while (!rb_relax_violation(x)) {
+            if (x->lc->color & RB_DIRTY)
+                x = x->lc;
+            else if (x->rc->color & RB_DIRTY)
+                x = x->rc;
+            else
+                break;
+        }
+        if (!rb_relax_violation(x)) {
+            // Whatever was wrong here went away with a delete
+            rb_relax_settle(tree, x);
+            continue;
+        }
+
+        if ((x->color & RED) && (x->p->color & RED)) {
+            rb_relax_red(tree, x);
+        } else if (rb_field(x, RB_EXCESS_SHIFT) > 0) {
+            if (x == tree->m_top) {
+                // Nothing above cares how heavy the whole tree is
+                rb_set_field(x, RB_EXCESS_SHIFT, 0);
+                rb_relax_redone(tree, x);
+            } else {
+                rb_relax_heavy(tree, x->p, x == x->p->rc);
+            }
+        } else {
+            rb_relax_heavy(tree, x, rb_field(x, RB_LNIL_SHIFT) == 0);
+        }
+        ++spent;
+    }
+
+    return rbt_base_pending(tree);
+}
+
+static inline rbn_t *
+rb_relayout_node(rbt_t *const tree, unsigned char *const dst, rbn_t *const x, rbtmove_t const movefunc)
+{
+    rbn_t *const lc = x->lc;
+    rbn_t *const rc = x->rc;
+    int const color = x->color;
+
+    rbn_t *const y = movefunc(dst, x);
+    y->lc = lc;
+    y->rc = rc;
+    y->color = color;
+
+    if (x == tree->m_min)
+        tree->m_min = y;
+    if (x == tree->m_max)
+        tree->m_max = y;
+
+    return y;
+}
+
+/*
+ * Move every element of the tree into `buf`, one element every `stride` bytes,
+ * in breadth-first order so that the top levels of the tree share cache lines
+ * and the nodes visited by a descent sit close together.
+ *
+ * The copies are linked as they are placed, so the buffer doubles as the BFS
+ * queue and no extra memory is needed. The storage of the old elements belongs
+ * to the caller once this returns.
+ */
+static inline void
+rbt_base_relayout(rbt_t *const tree, void *const buf, size_t const stride, rbtmove_t const movefunc)
+{
+    if (tree->m_top == &tree->m_nil)
+        return;
+
+    unsigned char *const base = buf;
+    rbn_t *const top = rb_relayout_node(tree, base, tree->m_top, movefunc);
+    top->p = &tree->m_nil;
+    tree->m_top = top;
+
+    // Every element is moved into the same layout, so the node lives at the
+    // same offset within each slot.
+    size_t const offset = (size_t)((unsigned char *)top - base);
+    size_t tail = 1;
+
+    for (size_t head = 0; head < tail; ++head) {
+        rbn_t *const y = (rbn_t *)(base + head * stride + offset);
+        if (y->lc != &tree->m_nil) {
+            rbn_t *const c = rb_relayout_node(tree, base + tail++ * stride, y->lc, movefunc);
+            c->p = y;
+            y->lc = c;
+        }
+        if (y->rc != &tree->m_nil) {
+            rbn_t *const c = rb_relayout_node(tree, base + tail++ * stride, y->rc, movefunc);
+            c->p = y;
+            y->rc = c;
+        }
+    }
+
+    assert(tail == tree->m_size);
+    tree->m_gen++;
+}
+
+static inline rbn_t *
+rb_clone_node(rbt_t *const dst, rbt_t const*const src, rbn_t const*const x, rbtcopy_t const copy,
+              void *const ctx)
+{
+    rbn_t *const y = copy(x, ctx);
+    if (y == NULL)
+        return NULL;
+
+    y->lc = &dst->m_nil;
+    y->rc = &dst->m_nil;
+    y->color = x->color;
+#if UINTPTR_MAX == 0xffffffffffffffffull
+    y->reserved = x->reserved;
+#endif
+    if (x == src->m_min)
+        dst->m_min = y;
+    if (x == src->m_max)
+        dst->m_max = y;
+
+    return y;
+}
+
+/*
+ * Fill the empty tree `dst` with copies of the elements of `src` made by
+ * `copy`, linked into the same shape with the same colors, so there are no
+ * comparisons or rotations. The two trees are walked in pre-order side by side
+ * along the parent links, and a right child that hasn't been copied yet is
+ * still m_nil in `dst`, which is all the state the walk needs.
+ *
+ * Returns 0, or -1 if `copy` fails. Then `dst` is left empty and the copies
+ * made so far are handed to `destroy`, if it isn't NULL.
+ */
+static inline int
+rbt_base_clone(rbt_t *const dst, rbt_t const*const src, rbtcopy_t const copy, rbtvisit_t const destroy,
+               void *const ctx)
+{
+    RB_ASSERT_NOT_WAVL(src);
+    assert(dst->m_top == &dst->m_nil);
+
+    rbn_t const*const snil = &src->m_nil;
+    rbn_t *const dnil = &dst->m_nil;
+    if (src->m_top == snil)
+        return 0;
+
+    rbn_t const *x = src->m_top;
+    rbn_t *y = rb_clone_node(dst, src, x, copy, ctx);
+    if (y == NULL)
+        return -1;
+    y->p = dnil;
+    dst->m_top = y;
+
+    for (;;) {
+        rbn_t const *next;
+        if (x->lc != snil) {
+            next = x->lc;
+        } else {
+            // Climb to the nearest node with a right subtree still to copy
+            while ((x->rc == snil) || (y->rc != dnil)) {
+                if (x == src->m_top) {
+                    dst->m_size = src->m_size;
+                    dst->m_gen++;
+                    return 0;
+                }
+                x = x->p;
+                y = y->p;
+            }
+            next = x->rc;
+        }
+
+        rbn_t *const c = rb_clone_node(dst, src, next, copy, ctx);
+        if (c == NULL) {
+            rbt_base_clear(dst, destroy, ctx);
+            return -1;
+        }
+        c->p = y;
+        if (next == x->lc)
+            y->lc = c;
+        else
+            y->rc = c;
+        x = next;
+        y = c;
+    }
+}
+
+struct rb_clone_buf {
+    unsigned char *m_pos;
+    size_t m_stride;
+    rbtmove_t m_copy;
+};
+
+static inline rbn_t *
+rb_clone_to_buf(rbn_t const*const x, void *const ctx)
+{
+    struct rb_clone_buf *const b = ctx;
+    rbn_t *const y = b->m_copy(b->m_pos, (rbn_t *)x);
+    b->m_pos += b->m_stride;
+    return y;
+}
+
+/*
+ * The same, with the copies placed one every `stride` bytes of `buf`, which
+ * must have room for all of them, in pre-order. `copyfunc` copies the object
+ * embedding the node into the storage it's given, leaving the original alone.
+ */
+static inline void
+rbt_base_clone_into(rbt_t *const dst, rbt_t const*const src, void *const buf, size_t const stride,
+                    rbtmove_t const copyfunc)
+{
+    struct rb_clone_buf b = {
+        .m_pos = buf,
+        .m_stride = stride,
+        .m_copy = copyfunc,
+    };
+    int const rc = rbt_base_clone(dst, src, rb_clone_to_buf, NULL, &b);
+    assert(rc == 0);
+    (void)rc;
+}
+
+#ifdef RBT_STATS
+// Copy out the hot path counters gathered since init or the last reset
+static inline void
+rbt_stats(rbt_t const*const tree, rbt_stats_t *const p_stats)
+{
+    *p_stats = tree->m_stats;
+}
+
+static inline void
+rbt_stats_reset(rbt_t *const tree)
+{
+    tree->m_stats = (rbt_stats_t) { 0 };
+}
+#endif
+
+typedef struct red_black_tree_shape rbt_shape_t;
+
+struct red_black_tree_shape {
+    unsigned height;                // nodes on the longest path, 0 when empty
+    unsigned black_height;          // black nodes on any path down from the top
+    size_t depth[RBT_MAX_DEPTH];    // number of nodes at each depth
+};
+
+/*
+ * Profile the shape of the tree. This walks every node so it is meant for
+ * diagnostics, not the hot path. It is available with or without RBT_STATS.
+ */
+static inline void
+rbt_shape(rbt_t const*const tree, rbt_shape_t *const p_shape)
+{
+    rbn_t const*const nil = &tree->m_nil;
+    *p_shape = (rbt_shape_t) { 0 };
+
+    for (rbn_t const *x = tree->m_top; x != nil; x = x->lc)
+        p_shape->black_height += (x->color == BLACK);
+
+    // Pre-order walk that tracks the depth as it moves
+    rbn_t const *x = tree->m_top;
+    unsigned d = 0;
+    while (x != nil) {
+        assert(d < RBT_MAX_DEPTH);
+        ++p_shape->depth[d];
+        if (d + 1 > p_shape->height)
+            p_shape->height = d + 1;
+
+        if (x->lc != nil) {
+            x = x->lc;
+            ++d;
+        } else if (x->rc != nil) {
+            x = x->rc;
+            ++d;
+        } else {
+            // Climb until coming up from a left child that has a right sibling
+            for (;;) {
+                rbn_t const*const p = x->p;
+                if (p == nil) {
+                    x = nil;
+                    break;
+                }
+                if ((x == p->lc) && (p->rc != nil)) {
+                    x = p->rc;
+                    break;
+                }
+                x = p;
+                --d;
+            }
+        }
+    }
+}
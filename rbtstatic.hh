@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstddef>
+#include <array>
+#include <algorithm>
+#include <bit>
+
+/*
+ * Ordered tables that are built entirely by the compiler. The elements are
+ * sorted and laid out as an implicit tree in breadth-first order (element k
+ * has children 2k and 2k + 1), so a table declared constexpr sits in read-only
+ * data with no pointers, nothing runs at startup and none of its pages are
+ * ever written.
+ *
+ *     constexpr rbt::static_index<code_t, 3> codes({{ ... }}, code_less);
+ *
+ * Lookups take a comparator in the rbtkeycmp_t mould, with the key first and
+ * the element second. The descent picks a child by index from the comparison
+ * and only compares for equality once at the bottom.
+ *
+ * Building sorts with std::sort during constant evaluation, which GCC counts
+ * against -fconstexpr-ops-limit. Tables of some tens of thousands of elements
+ * fit under the default limit and take seconds to compile; larger ones need
+ * the limit raised, and a hundred thousand took about 50 s.
+ */
+namespace rbt {
+
+// Compares a key with an element, as rbtkeycmp_t does with a node
+template <typename T>
+using static_keycmp_t = int (*)(void const *, T const *);
+
+template <typename T, std::size_t N>
+class static_index {
+public:
+    class iterator {
+    public:
+        constexpr T const &operator*() const { return m_idx->m_elems[m_k]; }
+        constexpr T const *operator->() const { return &m_idx->m_elems[m_k]; }
+        constexpr iterator &operator++()
+        {
+            m_k = m_idx->next(m_k);
+            return *this;
+        }
+        constexpr bool operator==(iterator const &) const = default;
+
+    private:
+        friend class static_index;
+        constexpr iterator(static_index const *const idx, std::size_t const k) : m_idx(idx), m_k(k) {}
+
+        static_index const *m_idx;
+        std::size_t m_k;                // 0 at the end
+    };
+
+    // Order the elements by `less`, which must be usable in a constant
+    // expression. Equal elements are a compile error.
+    template <typename Less>
+    consteval static_index(std::array<T, N> const &elems, Less const less) : m_elems{}
+    {
+        std::array<T, N> sorted = elems;
+        std::sort(sorted.begin(), sorted.end(), less);
+        for (std::size_t i = 1; i < N; ++i) {
+            if (!less(sorted[i - 1], sorted[i]))
+                throw "rbt::static_index: two elements are equal";
+        }
+        std::size_t i = 0;
+        place(sorted, 1, i);
+    }
+
+    constexpr std::size_t size() const { return N; }
+
+    // First element not less than the key, or nullptr
+    constexpr T const *lower_bound(void const *const key, static_keycmp_t<T> const cmp) const
+    {
+        std::size_t k = 1;
+        while (k <= N)
+            k = 2 * k + (cmp(key, &m_elems[k]) > 0);
+        // Drop the right turns taken after the last left one, and that one
+        k >>= std::countr_one(k) + 1;
+        return (k == 0) ? nullptr : &m_elems[k];
+    }
+
+    constexpr T const *get(void const *const key, static_keycmp_t<T> const cmp) const
+    {
+        T const *const x = lower_bound(key, cmp);
+        return ((x != nullptr) && (cmp(key, x) == 0)) ? x : nullptr;
+    }
+
+    constexpr iterator begin() const
+    {
+        std::size_t k = (N > 0) ? 1 : 0;
+        while ((k != 0) && (2 * k <= N))
+            k = 2 * k;
+        return iterator(this, k);
+    }
+
+    constexpr iterator end() const { return iterator(this, 0); }
+
+    // Iterate onwards from an element of the table, such as a lower bound
+    constexpr iterator at(T const *const x) const
+    {
+        return iterator(this, (x != nullptr) ? static_cast<std::size_t>(x - m_elems) : 0);
+    }
+
+private:
+    // Fill the subtree under k in order from sorted[i] on
+    constexpr void place(std::array<T, N> const &sorted, std::size_t const k, std::size_t &i)
+    {
+        if (k > N)
+            return;
+        place(sorted, 2 * k, i);
+        m_elems[k] = sorted[i++];
+        place(sorted, 2 * k + 1, i);
+    }
+
+    // In-order successor of k, 0 after the last
+    constexpr std::size_t next(std::size_t k) const
+    {
+        if (2 * k + 1 <= N) {
+            k = 2 * k + 1;
+            while (2 * k <= N)
+                k = 2 * k;
+            return k;
+        }
+        // Climb past the nodes we are the right subtree of, then one more
+        k >>= std::countr_one(k) + 1;
+        return k;
+    }
+
+    T m_elems[N + 1];                   // m_elems[0] is unused
+};
+
+}
@@ -0,0 +1,242 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include "rbtree.h"
+
+/*
+ * String keys ordered as by strcmp, with comparisons settled from a few bytes
+ * cached in the node's `reserved` field (on 64-bit) rather than by following
+ * the node to its string.
+ *
+ * Keys such as URLs and paths share long prefixes, so the first bytes of a key
+ * say little. Instead a descent keeps track of how many leading bytes the key
+ * has in common with the nearest elements passed on either side. Every element
+ * between those two shares at least that much with the key too, so the
+ * comparison can start there. Each node caches the three bytes of its key at
+ * the depth it had in common with its neighbours when it was added, along
+ * with that offset. When the descent already knows the key matches that far,
+ * the cached bytes settle the comparison unless they tie. After rotations a
+ * node may cache a deeper offset than a later descent can vouch for, in which
+ * case it's compared in full, so the cache is only ever a shortcut.
+ *
+ * The tree also keeps the prefix that all its keys share, up to RBTS_MAX_SKIP
+ * bytes, which lets every descent start past it and turns away keys without it
+ * at once. Removing keys never lengthens it again.
+ *
+ * The elements are in `m_tree` in strcmp order, so the rbt_base_* functions
+ * that don't add elements work with a strcmp based comparator. Elements must
+ * only be added through rbts_base_add so that their cached bytes are set.
+ */
+#if UINTPTR_MAX == 0xffffffffffffffffull
+#define RBTS_PREFIX_CACHE 1
+#endif
+
+#define RBTS_MAX_SKIP 52
+// Offsets past this are cached as this, which is still a valid place to look
+#define RBTS_MAX_OFFSET 255
+
+// Returns the key string of an element
+typedef char const *(*rbtstrkey_t)(rbn_t const*);
+
+typedef struct red_black_string_tree rbst_t;
+struct red_black_string_tree {
+    rbt_t m_tree;
+    size_t m_skip;                      // length of the prefix all keys share
+    char m_common[RBTS_MAX_SKIP];
+};
+
+static inline void
+rbts_init(rbst_t *const t)
+{
+    rbt_init(&t->m_tree);
+    t->m_skip = 0;
+}
+
+// Compare two strings known to agree before offset i, setting the length of
+// their common prefix
+static inline int
+rbts_strcmp(char const*const a, char const*const b, size_t i, size_t *const p_lcp)
+{
+    while ((a[i] == b[i]) && (a[i] != '\0'))
+        ++i;
+    *p_lcp = i;
+    return ((unsigned char)a[i] > (unsigned char)b[i]) - ((unsigned char)a[i] < (unsigned char)b[i]);
+}
+
+/*
+ * Compare the key with x, given that every element x could be shares the
+ * first m bytes with the key, and set their common prefix.
+ */
+static inline int
+rbts_cmp(rbst_t const*const t, char const*const key, size_t const m, rbn_t const*const x,
+         rbtstrkey_t const getkey, size_t *const p_lcp)
+{
+    RBT_STAT_ADD(&t->m_tree, cmps, 1);
+#ifdef RBTS_PREFIX_CACHE
+    uint32_t const c = (uint32_t)x->reserved;
+    size_t const o = c >> 24;
+    if (o <= m) {
+        for (int j = 0; j < 3; ++j) {
+            unsigned char const kb = (unsigned char)key[o + j];
+            unsigned char const xb = (unsigned char)(c >> (16 - 8 * j));
+            if ((kb != xb) || (kb == '\0')) {
+                *p_lcp = o + j;
+                return (kb > xb) - (kb < xb);
+            }
+        }
+        return rbts_strcmp(key, getkey(x), o + 3, p_lcp);
+    }
+#endif
+    return rbts_strcmp(key, getkey(x), m, p_lcp);
+}
+
+// Cache the bytes of the key of x from offset m
+static inline void
+rbts_cache(rbn_t *const x, size_t m, rbtstrkey_t const getkey)
+{
+#ifdef RBTS_PREFIX_CACHE
+    if (m > RBTS_MAX_OFFSET)
+        m = RBTS_MAX_OFFSET;
+    char const*const key = getkey(x);
+    uint32_t c = (uint32_t)m << 24;
+    for (int j = 0; j < 3; ++j) {
+        unsigned char const b = (unsigned char)key[m + j];
+        c |= (uint32_t)b << (16 - 8 * j);
+        if (b == '\0')
+            break;
+    }
+    x->reserved = (int)c;
+#else
+    (void)x;
+    (void)m;
+    (void)getkey;
+#endif
+}
+
+// Cache the bytes from offset m if they are cached from anywhere else
+static inline void
+rbts_recache(rbn_t *const x, size_t const m, rbtstrkey_t const getkey)
+{
+#ifdef RBTS_PREFIX_CACHE
+    size_t const o = (uint32_t)x->reserved >> 24;
+    if (o != ((m < RBTS_MAX_OFFSET) ? m : RBTS_MAX_OFFSET))
+        rbts_cache(x, m, getkey);
+#else
+    (void)x;
+    (void)m;
+    (void)getkey;
+#endif
+}
+
+// Length of the part of the common prefix the key shares
+__attribute__((pure))
+static inline size_t
+rbts_shared(rbst_t const*const t, char const*const key)
+{
+    size_t i = 0;
+    while ((i < t->m_skip) && (key[i] == t->m_common[i]))
+        ++i;
+    return i;
+}
+
+/*
+ * Descend towards the key, returning the element with an equal key or NULL.
+ * The last node visited, the direction from it and the prefix the key shares
+ * with the elements around that spot are left for an insertion.
+ *
+ * With `repair` set the nodes passed have their cached bytes moved to where
+ * this descent found them to differ from their neighbours, which fixes up the
+ * nodes rotations have moved since they were added.
+ */
+static inline rbn_t *
+rbts_descend(rbst_t const*const t, char const*const key, rbtstrkey_t const getkey, int const repair,
+             rbn_t **const p_y, int *const p_cmp, size_t *const p_m)
+{
+    rbt_t const*const tree = &t->m_tree;
+    size_t lo = t->m_skip;
+    size_t hi = t->m_skip;
+    rbn_t *y = (rbn_t *)&tree->m_nil;
+    rbn_t *x = tree->m_top;
+    int cmp = 0;
+    RBT_STAT_ADD(tree, descents, 1);
+    while (x != &tree->m_nil) {
+        y = x;
+        RBT_STAT_ADD(tree, depth, 1);
+        size_t const m = (lo < hi) ? lo : hi;
+        size_t lcp;
+        cmp = rbts_cmp(t, key, m, x, getkey, &lcp);
+        if (repair && (cmp != 0))
+            rbts_recache(x, (lcp < m) ? lcp : m, getkey);
+        if (cmp < 0) {
+            hi = lcp;
+            x = x->lc;
+        } else if (cmp > 0) {
+            lo = lcp;
+            x = x->rc;
+        } else {
+            return x;
+        }
+    }
+
+    *p_y = y;
+    *p_cmp = cmp;
+    *p_m = (lo < hi) ? lo : hi;
+    return NULL;
+}
+
+// Add an element, or return the one already present with an equal key
+static inline rbn_t *
+rbts_base_add(rbst_t *const t, rbn_t *const z, rbtstrkey_t const getkey)
+{
+    char const*const key = getkey(z);
+
+    if (t->m_tree.m_size == 0) {
+        size_t const len = strlen(key);
+        t->m_skip = (len < RBTS_MAX_SKIP) ? len : RBTS_MAX_SKIP;
+        memcpy(t->m_common, key, t->m_skip);
+    } else {
+        t->m_skip = rbts_shared(t, key);
+    }
+
+    rbn_t *y;
+    int cmp;
+    size_t m;
+    rbn_t *const x = rbts_descend(t, key, getkey, 1, &y, &cmp, &m);
+    if (x != NULL)
+        return x;
+
+    rbts_cache(z, m, getkey);
+    rb_link_node(&t->m_tree, z, y, cmp < 0);
+
+    return z;
+}
+
+RBT_PURE
+static inline rbn_t *
+rbts_base_get(rbst_t const*const t, char const*const key, rbtstrkey_t const getkey)
+{
+    // A key that leaves the common prefix can't be in the tree
+    if (rbts_shared(t, key) < t->m_skip)
+        return NULL;
+
+    rbn_t *y;
+    int cmp;
+    size_t m;
+    return rbts_descend(t, key, getkey, 0, &y, &cmp, &m);
+}
+
+static inline rbn_t *
+rbts_base_rem(rbst_t *const t, char const*const key, rbtstrkey_t const getkey)
+{
+    rbn_t *const x = rbts_base_get(t, key, getkey);
+
+    if (x == NULL) {
+        return NULL;
+    }
+
+    rb_base_delete(&t->m_tree, x);
+
+    return x;
+}
@@ -10,8 +10,15 @@ typedef struct red_black_tree_node rbn_t;
 
 struct red_black_tree_node {
     rbn_t *p;
-    rbn_t *lc;
-    rbn_t *rc;
+    // The children can also be indexed by direction, 0 for left and 1 for
+    // right, which lets a descent pick one without a branch
+    union {
+        struct {
+            rbn_t *lc;
+            rbn_t *rc;
+        };
+        rbn_t *ch[2];
+    };
     int color;
 #if UINTPTR_MAX == 0xffffffffffffffffull
     // It's sort of pointless to include this but it's good to be explicit that
@@ -24,6 +31,45 @@ struct red_black_tree_node {
 
 typedef int (*rbtcmp_t)(rbn_t const*, rbn_t const*);
 typedef int (*rbtkeycmp_t)(void const*, rbn_t const*);
+// Moves the object embedding the node into the destination storage and returns
+// the node embedded in the copy.
+typedef rbn_t *(*rbtmove_t)(void *, rbn_t *);
+// Called for each node of a traversal along with the caller's context
+typedef void (*rbtvisit_t)(rbn_t *, void *);
+// Produces the next node of an ascending sequence
+typedef rbn_t *(*rbtgen_t)(void *);
+// Constructs the element for a key along with the caller's context, returns
+// NULL if it can't
+typedef rbn_t *(*rbtmake_t)(void const*, void *);
+// Copies the object embedding the node along with the caller's context and
+// returns the node embedded in the copy, or NULL if it can't
+typedef rbn_t *(*rbtcopy_t)(rbn_t const*, void *);
+// Returns the key of an element for trees with integer keys
+typedef int64_t (*rbtintkey_t)(rbn_t const*);
+// Decides whether a node matches along with the caller's context
+typedef int (*rbtpred_t)(rbn_t const*, void *);
+// Recomputes what a node keeps about its subtree from its children, given the
+// sentinel that stands in for empty subtrees, and returns whether it changed
+typedef int (*rbtaug_t)(rbn_t *, rbn_t const*);
+// Returns the hash of a key, or of the key of an element
+typedef size_t (*rbtkeyhash_t)(void const*);
+typedef size_t (*rbthash_t)(rbn_t const*);
+
+#ifdef RBT_STATS
+// Hot path counters, only compiled in when RBT_STATS is defined
+typedef struct red_black_tree_stats rbt_stats_t;
+
+struct red_black_tree_stats {
+    uint64_t cmps;          // comparator calls
+    uint64_t descents;      // searches from the top of the tree
+    uint64_t depth;         // nodes visited by those searches
+    uint64_t rotl;          // left rotations
+    uint64_t rotr;          // right rotations
+    uint64_t ins_fixups;    // rb_insert_fixup iterations
+    uint64_t del_fixups;    // rb_delete_fixup iterations
+    uint64_t recolors;      // color changes made while rebalancing
+};
+#endif
 
 typedef struct red_black_tree rbt_t;
 
@@ -34,6 +80,10 @@ struct red_black_tree {
     rbn_t *m_min;
     rbn_t *m_max;
     unsigned m_gen; /* generation is used for iterators */
+    rbtaug_t m_aug;         // subtree summaries, see rbt_base_augment
+#ifdef RBT_STATS
+    rbt_stats_t m_stats;
+#endif
 };
 
 static inline void
@@ -51,6 +101,7 @@ rbt_init(rbt_t *const p_tree)
         .m_min = &p_tree->m_nil,
         .m_max = &p_tree->m_nil,
         .m_gen = 0,
+        .m_aug = NULL,
     };
 }
 
@@ -11,6 +11,8 @@
 #include <errno.h>
 
 #include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "test_rbtree.h"
 
@@ -39,6 +41,61 @@ randuniform(unsigned *const p_rng)
     return 1.0f * xorshift32(p_rng) / UINT_MAX;
 }
 
+/* Check the red black properties below x, returns the black height */
+static int
+check_subtree(rbt_t const*const tree, rbn_t const*const x, size_t *const p_count)
+{
+    if (x == &tree->m_nil)
+        return 1;
+
+    if (x->lc != &tree->m_nil)
+        assert_ptr_equal(x->lc->p, x);
+    if (x->rc != &tree->m_nil)
+        assert_ptr_equal(x->rc->p, x);
+
+    if (x->color == RED) {
+        assert_int_equal(x->lc->color, BLACK);
+        assert_int_equal(x->rc->color, BLACK);
+    } else {
+        assert_int_equal(x->color, BLACK);
+    }
+
+    int const lh = check_subtree(tree, x->lc, p_count);
+    int const rh = check_subtree(tree, x->rc, p_count);
+    assert_int_equal(lh, rh);
+    ++*p_count;
+
+    return lh + (x->color == BLACK);
+}
+
+static void
+check_tree(rbt_t *const tree)
+{
+    size_t count = 0;
+    assert_int_equal(tree->m_top->color, BLACK);
+    check_subtree(tree, tree->m_top, &count);
+    assert_int_equal(count, rbt_size(tree));
+
+    if (count == 0) {
+        assert_ptr_equal(tree->m_top, &tree->m_nil);
+        assert_null(rbt_min(tree));
+        assert_null(rbt_max(tree));
+        return;
+    }
+
+    assert_ptr_equal(tree->m_top->p, &tree->m_nil);
+    assert_ptr_equal(tree->m_min, tree_minimum(tree, tree->m_top));
+    assert_ptr_equal(tree->m_max, tree_maximum(tree, tree->m_top));
+
+    test_obj_t *prev = rbt_min(tree);
+    for (size_t i = 1; i < count; ++i) {
+        test_obj_t *const obj = rbt_next(tree, prev);
+        assert_true(obj->key > prev->key);
+        prev = obj;
+    }
+    assert_null(rbt_next(tree, prev));
+}
+
 static void
 test_basic_functionality(void **state)
 {
@@ -214,6 +271,13 @@ test_find_nearest(void **state)
     assert_int_equal(obj->key, 3);
     obj = rbt_gt(&tree1, 5);
     assert_int_equal(obj->key, 6);
+    // A key that is present gives its neighbours
+    obj = rbt_lt(&tree1, 3);
+    assert_int_equal(obj->key, 0);
+    obj = rbt_gt(&tree1, 3);
+    assert_int_equal(obj->key, 6);
+    assert_null(rbt_lt(&tree1, 0));
+    assert_null(rbt_gt(&tree1, 27));
 
     while (rbt_size(&tree1) > 0) {
         test_free(rbt_popmax(&tree1));
@@ -259,6 +323,2027 @@ test_next_and_prev(void **state)
     }
 }
 
+static void
+test_relayout(void **state)
+{
+    (void)state;
+    unsigned rng = time(NULL);
+
+    rbt_t tree;
+    rbt_init(&tree);
+
+    int const n = 1000;
+    test_obj_t **const old = test_malloc(sizeof(*old) * n);
+    int count = 0;
+    for (int i = 0; i < n; ++i) {
+        test_obj_t *const obj = test_malloc(sizeof(*obj));
+        obj->key = randnum(&rng, 100000);
+        if (rbt_add(&tree, obj) != obj) {
+            test_free(obj);
+            continue;
+        }
+        old[count++] = obj;
+    }
+    check_tree(&tree);
+
+    test_obj_t *const buf = test_malloc(sizeof(*buf) * count);
+    rbt_relayout(&tree, buf);
+
+    // Everything reachable from the tree now lives in the buffer
+    for (int i = 0; i < count; ++i) {
+        test_obj_t *const obj = rbt_get(&tree, old[i]->key);
+        assert_true(obj >= buf && obj < buf + count);
+        test_free(old[i]);
+    }
+    check_tree(&tree);
+
+    // The buffer is in breadth first order
+    assert_ptr_equal(tree.m_top, &buf[0].nd);
+    assert_true(buf[0].nd.lc == &buf[1].nd || buf[0].nd.rc == &buf[1].nd);
+
+    while (rbt_size(&tree) > 0) {
+        rbt_popmin(&tree);
+    }
+    check_tree(&tree);
+
+    test_free(buf);
+    test_free(old);
+}
+
+static void
+record_key(rbn_t *const x, void *const ctx)
+{
+    test_obj_t *const obj = (void *)((unsigned char *)x - offsetof(test_obj_t, nd));
+    int **const p_out = ctx;
+    *(*p_out)++ = obj->key;
+}
+
+static void
+check_postorder(rbn_t *const x, void *const ctx)
+{
+    rbt_t *const tree = ctx;
+    test_obj_t *const obj = (void *)((unsigned char *)x - offsetof(test_obj_t, nd));
+
+    // Both children must have been visited already
+    if (x->lc != &tree->m_nil) {
+        test_obj_t const*const l = (void *)((unsigned char *)x->lc - offsetof(test_obj_t, nd));
+        assert_int_equal(l->data1[0], 1);
+    }
+    if (x->rc != &tree->m_nil) {
+        test_obj_t const*const r = (void *)((unsigned char *)x->rc - offsetof(test_obj_t, nd));
+        assert_int_equal(r->data1[0], 1);
+    }
+    obj->data1[0] = 1;
+}
+
+static void
+destroy_obj(rbn_t *const x, void *const ctx)
+{
+    size_t *const p_count = ctx;
+    ++*p_count;
+    assert_null(x->p);
+    test_free((unsigned char *)x - offsetof(test_obj_t, nd));
+}
+
+static void
+test_traversal(void **state)
+{
+    (void)state;
+    unsigned rng = time(NULL);
+
+    rbt_t tree;
+    rbt_init(&tree);
+
+    int keys[500];
+    int seen[500];
+    int count = 0;
+    for (int i = 0; i < 500; ++i) {
+        test_obj_t *const obj = test_malloc(sizeof(*obj));
+        obj->key = randnum(&rng, 100000);
+        obj->data1[0] = 0;
+        if (rbt_add(&tree, obj) != obj) {
+            test_free(obj);
+            continue;
+        }
+        keys[count++] = obj->key;
+    }
+
+    // in-order visits the keys sorted
+    int *out = seen;
+    rbt_base_inorder(&tree, record_key, &out);
+    assert_int_equal(out - seen, count);
+    for (int i = 1; i < count; ++i) {
+        assert_true(seen[i - 1] < seen[i]);
+    }
+
+    // pre-order starts at the top and visits everything once
+    out = seen;
+    rbt_base_preorder(&tree, record_key, &out);
+    assert_int_equal(out - seen, count);
+    assert_ptr_equal(rbt_get(&tree, seen[0]), (unsigned char *)tree.m_top - offsetof(test_obj_t, nd));
+    for (int i = 0; i < count; ++i) {
+        assert_non_null(rbt_get(&tree, keys[i]));
+        int found = 0;
+        for (int j = 0; j < count; ++j) {
+            found += (seen[j] == keys[i]);
+        }
+        assert_int_equal(found, 1);
+    }
+
+    // post-order visits children before their parent and ends at the top
+    rbt_base_postorder(&tree, check_postorder, &tree);
+    out = seen;
+    rbt_base_postorder(&tree, record_key, &out);
+    assert_int_equal(out - seen, count);
+    assert_ptr_equal(rbt_get(&tree, seen[count - 1]), (unsigned char *)tree.m_top - offsetof(test_obj_t, nd));
+
+    size_t destroyed = 0;
+    rbt_base_clear(&tree, destroy_obj, &destroyed);
+    assert_int_equal(destroyed, count);
+    check_tree(&tree);
+
+    // The tree is usable again after being cleared
+    test_obj_t *const obj = test_malloc(sizeof(*obj));
+    obj->key = 7;
+    assert_ptr_equal(rbt_add(&tree, obj), obj);
+    check_tree(&tree);
+    rbt_base_clear(&tree, destroy_obj, &destroyed);
+    assert_int_equal(destroyed, count + 1);
+
+    // Clearing an empty tree does nothing
+    rbt_base_clear(&tree, destroy_obj, &destroyed);
+    assert_int_equal(destroyed, count + 1);
+    check_tree(&tree);
+}
+
+static void
+test_dump_and_load(void **state)
+{
+    (void)state;
+    unsigned rng = time(NULL);
+
+    for (int n = 0; n < 300; n += 1 + n / 4) {
+        rbt_t tree;
+        rbt_init(&tree);
+        while ((int)rbt_size(&tree) < n) {
+            test_obj_t *const obj = test_malloc(sizeof(*obj));
+            obj->key = randnum(&rng, 1000000);
+            if (rbt_add(&tree, obj) != obj)
+                test_free(obj);
+        }
+
+        FILE *const fp = tmpfile();
+        assert_non_null(fp);
+        assert_int_equal(rbt_dump(&tree, fp), 0);
+
+        rbt_t copy;
+        rbt_init(&copy);
+        // Running out of elements part way gives them all back
+        if (n > 0) {
+            assert_int_equal(rbt_load(&copy, fileno(fp), n - 1), -1);
+            assert_int_equal(errno, ENOMEM);
+            assert_int_equal(rbt_size(&copy), 0);
+            check_tree(&copy);
+        }
+
+        assert_int_equal(rbt_load(&copy, fileno(fp), n), 0);
+        check_tree(&copy);
+        assert_int_equal(rbt_size(&copy), n);
+
+        while (rbt_size(&tree) > 0) {
+            test_obj_t *const a = rbt_popmin(&tree);
+            test_obj_t *const b = rbt_popmin(&copy);
+            assert_int_equal(a->key, b->key);
+            test_free(a);
+            test_free(b);
+        }
+        assert_null(rbt_popmin(&copy));
+
+        // A truncated file is rejected and leaves the tree alone
+        if (n > 0) {
+            assert_int_equal(fflush(fp), 0);
+            assert_int_equal(ftruncate(fileno(fp), RBT_FILE_HDRLEN + 3), 0);
+            assert_int_equal(rbt_load(&copy, fileno(fp), n), -1);
+            assert_int_equal(errno, EINVAL);
+            check_tree(&copy);
+        }
+
+        fclose(fp);
+    }
+
+    // Record lengths that run past a size_t are rejected, rather than shifted
+    // out of range
+    static unsigned char const lens[][11] = {
+        { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x7f },
+        { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x00 },
+    };
+    for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); ++i) {
+        unsigned char hdr[RBT_FILE_HDRLEN] = RBT_FILE_MAGIC;
+        hdr[4] = RBT_FILE_VERSION;
+        rbt_file_put64(&hdr[8], 1);
+
+        FILE *const fp = tmpfile();
+        assert_non_null(fp);
+        assert_int_equal(fwrite(hdr, sizeof(hdr), 1, fp), 1);
+        assert_int_equal(fwrite(lens[i], sizeof(lens[i]), 1, fp), 1);
+        assert_int_equal(fflush(fp), 0);
+
+        rbt_t tree;
+        rbt_init(&tree);
+        assert_int_equal(rbt_load(&tree, fileno(fp), 1), -1);
+        assert_int_equal(errno, EINVAL);
+        assert_int_equal(rbt_size(&tree), 0);
+        fclose(fp);
+    }
+}
+
+/*
+ * Walk an offset linked tree in order, checking that it is sorted and holds
+ * only keys from the given set. Returns -1 if anything is wrong, otherwise
+ * the number of elements. Used from forked readers, so it can't assert.
+ */
+static int
+walk_otree(rbot_t *const tree, unsigned char const*const present)
+{
+    int count = 0;
+    int last = INT_MIN;
+    for (test_oobj_t *o = rbot_min(tree); o != NULL; o = rbot_next(tree, o)) {
+        if ((o->key <= last) || (present != NULL && !present[o->key]))
+            return -1;
+        last = o->key;
+        if (++count > (int)rbot_size(tree))
+            return -1;
+    }
+
+    return (count == (int)rbot_size(tree)) ? count : -1;
+}
+
+static void
+test_offset_tree(void **state)
+{
+    (void)state;
+    unsigned rng = time(NULL);
+    enum { NOBJ = 2000, NREADERS = 3 };
+
+    // A tree living in a file can be mapped at another address and used as is
+    char path[] = "/tmp/test_rbtree_XXXXXX";
+    int const fd = mkstemp(path);
+    assert_true(fd >= 0);
+    unlink(path);
+
+    size_t const len = sizeof(rbot_t) + NOBJ * sizeof(test_oobj_t);
+    assert_int_equal(ftruncate(fd, len), 0);
+
+    void *const a = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    assert_true(a != MAP_FAILED);
+    rbot_t *const tree = a;
+    test_oobj_t *const objs = (void *)(tree + 1);
+    assert_int_equal(rbot_init(tree), 0);
+
+    for (int i = 0; i < NOBJ; ++i) {
+        objs[i].key = (i * 7919) % NOBJ;
+        assert_ptr_equal(rbot_add(tree, &objs[i]), &objs[i]);
+    }
+    for (int i = 0; i < NOBJ; i += 3)
+        assert_ptr_equal(rbot_rem(tree, objs[i].key), &objs[i]);
+    size_t const n = rbot_size(tree);
+    assert_int_equal(walk_otree(tree, NULL), n);
+
+    void *const b = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    assert_true(b != MAP_FAILED);
+    assert_ptr_not_equal(a, b);
+    rbot_t *const other = b;
+    test_oobj_t *const oobjs = (void *)(other + 1);
+    assert_true(rbot_valid(other));
+    assert_int_equal(walk_otree(other, NULL), n);
+    for (int i = 0; i < NOBJ; ++i) {
+        test_oobj_t *const o = rbot_get(other, oobjs[i].key);
+        if (i % 3 == 0) {
+            assert_null(o);
+            continue;
+        }
+        assert_ptr_equal(o, &oobjs[i]);
+        assert_true((unsigned char *)o >= (unsigned char *)b);
+        assert_true((unsigned char *)o < (unsigned char *)b + len);
+        assert_int_equal(o->key, oobjs[i].key);
+    }
+
+    munmap(b, len);
+    munmap(a, len);
+    close(fd);
+
+    // Forked readers hammer the tree while the parent writes under the lock
+    size_t const slen = sizeof(rbot_t) + NOBJ * sizeof(test_oobj_t) + NOBJ;
+    void *const s = mmap(NULL, slen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    assert_true(s != MAP_FAILED);
+    rbot_t *const stree = s;
+    test_oobj_t *const sobjs = (void *)(stree + 1);
+    unsigned char *const present = (void *)(sobjs + NOBJ);
+    assert_int_equal(rbot_init(stree), 0);
+    for (int i = 0; i < NOBJ; ++i)
+        sobjs[i].key = i;
+
+    pid_t pids[NREADERS];
+    for (int r = 0; r < NREADERS; ++r) {
+        pids[r] = fork();
+        assert_true(pids[r] >= 0);
+        if (pids[r] == 0) {
+            int bad = 0;
+            for (int it = 0; (it < 2000) && !bad; ++it) {
+                rbot_rdlock(stree);
+                int const count = walk_otree(stree, present);
+                if (count < 0)
+                    bad = 1;
+                for (int k = 0; k < NOBJ; k += 97) {
+                    if ((rbot_get(stree, k) != NULL) != present[k])
+                        bad = 1;
+                }
+                rbot_unlock(stree);
+            }
+            _exit(bad);
+        }
+    }
+
+    for (int it = 0; it < 20000; ++it) {
+        int const k = randnum(&rng, NOBJ);
+        rbot_wrlock(stree);
+        if (present[k]) {
+            assert_ptr_equal(rbot_rem(stree, k), &sobjs[k]);
+            present[k] = 0;
+        } else {
+            assert_ptr_equal(rbot_add(stree, &sobjs[k]), &sobjs[k]);
+            present[k] = 1;
+        }
+        rbot_unlock(stree);
+    }
+
+    for (int r = 0; r < NREADERS; ++r) {
+        int status;
+        assert_int_equal(waitpid(pids[r], &status, 0), pids[r]);
+        assert_true(WIFEXITED(status));
+        assert_int_equal(WEXITSTATUS(status), 0);
+    }
+    assert_true(walk_otree(stree, present) >= 0);
+
+    munmap(s, slen);
+}
+
+static void
+test_stats_and_shape(void **state)
+{
+    (void)state;
+
+    rbt_t tree;
+    rbt_init(&tree);
+
+    rbt_shape_t shape;
+    rbt_shape(&tree, &shape);
+    assert_int_equal(shape.height, 0);
+    assert_int_equal(shape.black_height, 0);
+
+    // Ascending inserts rotate on almost every insert
+    int const n = 1000;
+    test_obj_t *const objs = test_malloc(sizeof(*objs) * n);
+    for (int i = 0; i < n; ++i) {
+        objs[i].key = i;
+        assert_ptr_equal(rbt_add(&tree, &objs[i]), &objs[i]);
+    }
+
+    rbt_stats_t st;
+    rbt_stats(&tree, &st);
+    assert_int_equal(st.descents, n);
+    assert_true(st.depth > 0);
+    assert_true(st.cmps >= st.depth);
+    assert_true(st.rotl > 0);
+    assert_int_equal(st.rotr, 0);
+    assert_true(st.ins_fixups > 0);
+    assert_true(st.recolors > 0);
+    assert_int_equal(st.del_fixups, 0);
+
+    rbt_shape(&tree, &shape);
+    size_t total = 0;
+    for (unsigned d = 0; d < RBT_MAX_DEPTH; ++d) {
+        if (d >= shape.height)
+            assert_int_equal(shape.depth[d], 0);
+        total += shape.depth[d];
+    }
+    assert_int_equal(total, n);
+    assert_int_equal(shape.depth[0], 1);
+    assert_true(shape.height <= 2 * log2(n + 1));
+    assert_true(shape.height >= shape.black_height);
+    // check_subtree counts the sentinel as well
+    assert_int_equal(shape.black_height + 1, check_subtree(&tree, tree.m_top, &(size_t){ 0 }));
+
+    // Lookups only count comparisons and depth
+    rbt_stats_reset(&tree);
+    for (int i = 0; i < n; ++i)
+        assert_ptr_equal(rbt_get(&tree, i), &objs[i]);
+    rbt_stats(&tree, &st);
+    assert_int_equal(st.descents, n);
+    assert_int_equal(st.cmps, st.depth);
+    size_t depth_sum = 0;
+    for (unsigned d = 0; d < shape.height; ++d)
+        depth_sum += shape.depth[d] * (d + 1);
+    assert_int_equal(st.depth, depth_sum);
+    assert_int_equal(st.rotl + st.rotr + st.ins_fixups + st.recolors, 0);
+
+    // Repeated lookups each count, even with the result unused
+    rbt_stats_reset(&tree);
+    for (int i = 0; i < 3; ++i) {
+        rbt_base_get(&tree, &(test_key_t){ 0 }, mykeycmp);
+        rbt_base_get_int(&tree, 0, mykeyof);
+    }
+    rbt_stats(&tree, &st);
+    assert_int_equal(st.descents, 6);
+
+    rbt_stats_reset(&tree);
+    for (int i = 0; i < n; i += 2)
+        assert_ptr_equal(rbt_rem(&tree, i), &objs[i]);
+    rbt_stats(&tree, &st);
+    assert_true(st.del_fixups > 0);
+    check_tree(&tree);
+
+    test_free(objs);
+}
+
+// Check a multiset, where equal keys are ordered by their sequence number in
+// data1[0]
+static void
+check_multi(rbt_t *const tree)
+{
+    size_t count = 0;
+    assert_int_equal(tree->m_top->color, BLACK);
+    check_subtree(tree, tree->m_top, &count);
+    assert_int_equal(count, rbt_size(tree));
+    if (count == 0)
+        return;
+
+    assert_ptr_equal(tree->m_min, tree_minimum(tree, tree->m_top));
+    assert_ptr_equal(tree->m_max, tree_maximum(tree, tree->m_top));
+    test_obj_t *prev = rbt_min(tree);
+    for (test_obj_t *obj = rbt_next(tree, prev); obj != NULL; obj = rbt_next(tree, obj)) {
+        assert_true((obj->key > prev->key) ||
+                    ((obj->key == prev->key) && (obj->data1[0] > prev->data1[0])));
+        prev = obj;
+    }
+}
+
+static void
+count_removed(rbn_t *const x, void *const ctx)
+{
+    test_obj_t *const obj = (void *)((unsigned char *)x - offsetof(test_obj_t, nd));
+    ++*(int *)ctx;
+    test_free(obj);
+}
+
+static void
+test_multiset(void **state)
+{
+    (void)state;
+    unsigned rng = time(NULL);
+    enum { NKEYS = 20 };
+
+    rbt_t tree;
+    rbt_init(&tree);
+
+    int counts[NKEYS] = { 0 };
+    for (unsigned seq = 0; seq < 1000; ++seq) {
+        test_obj_t *const obj = test_malloc(sizeof(*obj));
+        obj->key = 2 * randnum(&rng, NKEYS);
+        obj->data1[0] = seq;
+        rbt_add_multi(&tree, obj);
+        ++counts[obj->key / 2];
+    }
+    check_multi(&tree);
+
+    for (int k = -1; k <= 2 * NKEYS; ++k) {
+        int const c = ((k >= 0) && (k % 2 == 0) && (k < 2 * NKEYS)) ? counts[k / 2] : 0;
+        assert_int_equal(rbt_count(&tree, k), c);
+
+        test_obj_t *first, *end;
+        assert_int_equal(rbt_equal_range(&tree, k, &first, &end), c > 0);
+        assert_ptr_equal(first, rbt_lower_bound(&tree, k));
+        assert_ptr_equal(end, rbt_gt(&tree, k));
+        if (c > 0) {
+            // The range covers exactly the equal keys, oldest first
+            test_obj_t *const before = rbt_lt(&tree, k);
+            if (before != NULL) {
+                assert_true(before->key < k);
+                assert_ptr_equal(rbt_next(&tree, before), first);
+            } else {
+                assert_ptr_equal(rbt_min(&tree), first);
+            }
+            int n = 0;
+            for (test_obj_t *x = first; x != end; x = rbt_next(&tree, x)) {
+                assert_int_equal(x->key, k);
+                ++n;
+            }
+            assert_int_equal(n, c);
+        } else {
+            assert_ptr_equal(first, end);
+        }
+        if (end != NULL)
+            assert_true(end->key > k);
+    }
+
+    // Removing one takes the earliest inserted
+    for (int k = 0; k < NKEYS; ++k) {
+        if (counts[k] == 0)
+            continue;
+        test_obj_t *const first = rbt_lower_bound(&tree, 2 * k);
+        assert_ptr_equal(rbt_rem_one(&tree, 2 * k), first);
+        test_free(first);
+        --counts[k];
+    }
+    assert_null(rbt_rem_one(&tree, 1));
+    check_multi(&tree);
+
+    for (int k = 0; k < NKEYS; ++k) {
+        int removed = 0;
+        assert_int_equal(rbt_rem_all(&tree, 2 * k, count_removed, &removed), counts[k]);
+        assert_int_equal(removed, counts[k]);
+        assert_int_equal(rbt_count(&tree, 2 * k), 0);
+        check_multi(&tree);
+    }
+    assert_int_equal(rbt_size(&tree), 0);
+}
+
+static void
+test_find_or_insert(void **state)
+{
+    (void)state;
+    unsigned rng = time(NULL);
+
+    rbt_t tree;
+    rbt_init(&tree);
+
+    int made = 0;
+    int misses = 0;
+    for (int i = 0; i < 2000; ++i) {
+        int const key = randnum(&rng, 500) - 250;
+        test_obj_t *const had = rbt_get(&tree, key);
+        int const before = made;
+        test_obj_t *const obj = rbt_find_or_insert(&tree, key, &made);
+        assert_non_null(obj);
+        assert_int_equal(obj->key, key);
+        if (had != NULL) {
+            assert_ptr_equal(obj, had);
+            assert_int_equal(made, before);
+        } else {
+            assert_int_equal(made, before + 1);
+            ++misses;
+        }
+    }
+    assert_int_equal(rbt_size(&tree), misses);
+    check_tree(&tree);
+
+    // A failed construction leaves the tree alone
+    int fail = -1;
+    unsigned const gen = tree.m_gen;
+    assert_null(rbt_find_or_insert(&tree, 1000, &fail));
+    assert_null(rbt_get(&tree, 1000));
+    assert_int_equal(tree.m_gen, gen);
+    assert_non_null(rbt_find_or_insert(&tree, rbt_min(&tree)->key, &fail));
+    check_tree(&tree);
+
+    while (rbt_size(&tree) > 0)
+        test_free(rbt_popmin(&tree));
+}
+
+static void
+test_cursor(void **state)
+{
+    (void)state;
+    unsigned rng = time(NULL);
+    int const n = 500;
+
+    rbt_t tree;
+    rbt_init(&tree);
+
+    // Build the tree purely from cursors, keys 0, 4, 8, ...
+    for (int i = 0; i < n; ++i) {
+        test_obj_t *const obj = test_malloc(sizeof(*obj));
+        obj->key = 4 * i;
+        rbt_insert_before(&tree, NULL, obj);
+    }
+    check_tree(&tree);
+
+    // Squeeze odd keys in around random cursors
+    for (int i = 0; i < n; ++i) {
+        test_obj_t *const cursor = rbt_get(&tree, 4 * randnum(&rng, n));
+        test_obj_t *const before = test_malloc(sizeof(*before));
+        test_obj_t *const after = test_malloc(sizeof(*after));
+        before->key = cursor->key - 1;
+        after->key = cursor->key + 1;
+        if (rbt_get(&tree, before->key) == NULL) {
+            rbt_insert_before(&tree, cursor, before);
+        } else {
+            test_free(before);
+        }
+        if (rbt_get(&tree, after->key) == NULL) {
+            rbt_insert_after(&tree, cursor, after);
+        } else {
+            test_free(after);
+        }
+    }
+    test_obj_t *const first = test_malloc(sizeof(*first));
+    first->key = -10;
+    rbt_insert_after(&tree, NULL, first);
+    assert_ptr_equal(rbt_min(&tree), first);
+    check_tree(&tree);
+
+    // Finger search agrees with a plain lookup, near and far
+    for (int i = 0; i < 5000; ++i) {
+        test_obj_t *const cursor = rbt_get(&tree, 4 * randnum(&rng, n));
+        int const key = (i % 2 == 0) ? cursor->key + randnum(&rng, 41) - 20 : randnum(&rng, 4 * n + 20) - 10;
+        assert_ptr_equal(rbt_finger(&tree, cursor, key), rbt_get(&tree, key));
+    }
+
+    // Removing at a cursor hands back the next element
+    test_obj_t *x = rbt_min(&tree);
+    while (x != NULL) {
+        test_obj_t *const next = rbt_next(&tree, x);
+        assert_ptr_equal(rbt_remove_at(&tree, x), next);
+        test_free(x);
+        x = next;
+        if ((x != NULL) && (randnum(&rng, 2) == 0))
+            x = rbt_next(&tree, x);
+        if (x == NULL)
+            check_tree(&tree);
+    }
+    check_tree(&tree);
+
+    while (rbt_size(&tree) > 0)
+        test_free(rbt_popmin(&tree));
+}
+
+// Check the weights of a relaxed tree, returns the weight of any path down
+// from x including the m_nil at the end
+static unsigned
+check_relaxed_subtree(rbt_t const*const tree, rbn_t const*const x, size_t *const p_count)
+{
+    rbn_t const*const nil = &tree->m_nil;
+    assert_int_equal(nil->color, BLACK);
+
+    unsigned const lw = (x->lc == nil) ? 1 + rb_field(x, RB_LNIL_SHIFT) : check_relaxed_subtree(tree, x->lc, p_count);
+    unsigned const rw = (x->rc == nil) ? 1 + rb_field(x, RB_RNIL_SHIFT) : check_relaxed_subtree(tree, x->rc, p_count);
+    assert_int_equal(lw, rw);
+    if (x->lc != nil)
+        assert_ptr_equal(x->lc->p, x);
+    if (x->rc != nil)
+        assert_ptr_equal(x->rc->p, x);
+
+    // Anything wrong at or below a node is flagged on it
+    if (rb_relax_violation(x) || (x->lc->color & RB_DIRTY) || (x->rc->color & RB_DIRTY))
+        assert_true(x->color & RB_DIRTY);
+
+    ++*p_count;
+    return lw + rb_weight(x);
+}
+
+static void
+check_relaxed(rbt_t *const tree)
+{
+    size_t count = 0;
+    if (tree->m_top != &tree->m_nil) {
+        assert_int_equal(tree->m_top->color & RED, BLACK);
+        check_relaxed_subtree(tree, tree->m_top, &count);
+    }
+    assert_int_equal(count, rbt_size(tree));
+
+    if (count == 0)
+        return;
+    assert_ptr_equal(tree->m_min, tree_minimum(tree, tree->m_top));
+    assert_ptr_equal(tree->m_max, tree_maximum(tree, tree->m_top));
+    test_obj_t *prev = rbt_min(tree);
+    for (test_obj_t *obj = rbt_next(tree, prev); obj != NULL; obj = rbt_next(tree, obj)) {
+        assert_true(obj->key > prev->key);
+        prev = obj;
+    }
+}
+
+static void
+test_relaxed(void **state)
+{
+    (void)state;
+    unsigned rng = time(NULL);
+    enum { NKEYS = 600 };
+
+    test_obj_t *const objs = test_malloc(sizeof(*objs) * NKEYS);
+    bool present[NKEYS] = { 0 };
+    for (int i = 0; i < NKEYS; ++i)
+        objs[i].key = i;
+
+    rbt_t tree;
+    rbt_init(&tree);
+
+    for (int round = 0; round < 40; ++round) {
+        // A burst of writes, biased one way or the other
+        int const add_pct = (round % 4 == 3) ? 20 : 70;
+        for (int i = 0; i < 200; ++i) {
+            int const k = randnum(&rng, NKEYS);
+            if (randnum(&rng, 100) < add_pct) {
+                assert_ptr_equal(rbt_add_relaxed(&tree, &objs[k]), &objs[k]);
+                present[k] = true;
+            } else {
+                assert_ptr_equal(rbt_rem_relaxed(&tree, k), present[k] ? &objs[k] : NULL);
+                present[k] = false;
+            }
+            if (i % 16 == 0)
+                check_relaxed(&tree);
+        }
+        check_relaxed(&tree);
+
+        // Reads keep working before the tree is repaired
+        for (int k = 0; k < NKEYS; ++k)
+            assert_ptr_equal(rbt_get(&tree, k), present[k] ? &objs[k] : NULL);
+
+        // Repair a step at a time, each one rotating no more than three
+        // times whatever the tree looks like, or all at once
+        if (round % 2 == 0) {
+            for (;;) {
+                rbt_stats_reset(&tree);
+                int const pending = rbt_base_rebalance(&tree, 1);
+                rbt_stats_t st;
+                rbt_stats(&tree, &st);
+                assert_true(st.rotl + st.rotr <= 3);
+                check_relaxed(&tree);
+                if (!pending)
+                    break;
+            }
+        } else {
+            assert_false(rbt_base_rebalance(&tree, SIZE_MAX));
+        }
+        assert_false(rbt_base_pending(&tree));
+        check_tree(&tree);
+    }
+
+    // Back to the regular mutators once nothing is pending
+    for (int k = 0; k < NKEYS; ++k) {
+        if (present[k])
+            assert_ptr_equal(rbt_rem(&tree, k), &objs[k]);
+        else
+            assert_ptr_equal(rbt_add(&tree, &objs[k]), &objs[k]);
+    }
+    check_tree(&tree);
+
+    test_free(objs);
+}
+
+// Check the rank rules of a WAVL tree, returns the rank of x
+static int
+check_wavl_subtree(rbt_t const*const tree, rbn_t const*const x, bool const avl, size_t *const p_count)
+{
+    rbn_t const*const nil = &tree->m_nil;
+    if (x == nil)
+        return -1;
+
+    int const lr = check_wavl_subtree(tree, x->lc, avl, p_count);
+    int const rr = check_wavl_subtree(tree, x->rc, avl, p_count);
+    assert_in_range(x->color - lr, 1, 2);
+    assert_in_range(x->color - rr, 1, 2);
+    if ((x->lc == nil) && (x->rc == nil))
+        assert_int_equal(x->color, 0);
+    // Without deletes no node is 2,2
+    if (avl)
+        assert_true((x->color - lr == 1) || (x->color - rr == 1));
+    if (x->lc != nil)
+        assert_ptr_equal(x->lc->p, x);
+    if (x->rc != nil)
+        assert_ptr_equal(x->rc->p, x);
+
+    ++*p_count;
+    return x->color;
+}
+
+static void
+check_wavl(rbt_t *const tree, bool const avl)
+{
+    size_t count = 0;
+    assert_int_equal(tree->m_nil.color, -1);
+    check_wavl_subtree(tree, tree->m_top, avl, &count);
+    assert_int_equal(count, rbt_size(tree));
+
+    if (count == 0)
+        return;
+    assert_ptr_equal(tree->m_min, tree_minimum(tree, tree->m_top));
+    assert_ptr_equal(tree->m_max, tree_maximum(tree, tree->m_top));
+    test_obj_t *prev = rbt_min(tree);
+    for (test_obj_t *obj = rbt_next(tree, prev); obj != NULL; obj = rbt_next(tree, obj)) {
+        assert_true(obj->key > prev->key);
+        prev = obj;
+    }
+}
+
+static void
+test_wavl(void **state)
+{
+    (void)state;
+    unsigned rng = time(NULL);
+    enum { NKEYS = 2000 };
+
+    test_obj_t *const objs = test_malloc(sizeof(*objs) * NKEYS);
+    bool present[NKEYS] = { 0 };
+    for (int i = 0; i < NKEYS; ++i)
+        objs[i].key = i;
+
+    wavl_t w;
+    wavl_init(&w);
+    rbt_t *const tree = &w.m_tree;
+
+    // Insert only, the result is an AVL tree
+    for (int i = 0; i < NKEYS / 2; ++i) {
+        int const k = randnum(&rng, NKEYS);
+        assert_ptr_equal(wavl_add(&w, &objs[k]), &objs[k]);
+        present[k] = true;
+        if (i % 64 == 0)
+            check_wavl(tree, true);
+    }
+    check_wavl(tree, true);
+    rbt_shape_t shape;
+    rbt_shape(tree, &shape);
+    assert_true(shape.height <= 1.44 * log2(rbt_size(tree) + 2));
+
+    // Mixed, then drained from the front
+    for (int i = 0; i < 4 * NKEYS; ++i) {
+        int const k = randnum(&rng, NKEYS);
+        if (randnum(&rng, 2)) {
+            assert_ptr_equal(wavl_add(&w, &objs[k]), &objs[k]);
+            present[k] = true;
+        } else {
+            assert_ptr_equal(wavl_rem(&w, k), present[k] ? &objs[k] : NULL);
+            present[k] = false;
+        }
+        if (i % 64 == 0)
+            check_wavl(tree, false);
+    }
+    check_wavl(tree, false);
+    for (int k = 0; k < NKEYS; ++k) {
+        assert_ptr_equal(rbt_get(tree, k), present[k] ? &objs[k] : NULL);
+    }
+
+    int last = -1;
+    for (test_obj_t *obj; (obj = wavl_popmin(&w)) != NULL; ) {
+        assert_true(obj->key > last);
+        last = obj->key;
+        present[last] = false;
+        if (rbt_size(tree) % 64 == 0)
+            check_wavl(tree, false);
+    }
+    assert_ptr_equal(rbt_min(tree), NULL);
+
+    test_free(objs);
+}
+
+static void
+test_hash_index(void **state)
+{
+    (void)state;
+    unsigned rng = time(NULL);
+    enum { NKEYS = 3000 };
+
+    test_obj_t *const objs = test_malloc(sizeof(*objs) * NKEYS);
+    bool present[NKEYS] = { 0 };
+    for (int i = 0; i < NKEYS; ++i)
+        objs[i].key = i;
+
+    rbht_t h;
+    rbht_init(&h);
+    assert_ptr_equal(rbht_get(&h, 0), NULL);
+    assert_ptr_equal(rbht_rem(&h, 0), NULL);
+
+    for (int i = 0; i < 10 * NKEYS; ++i) {
+        int const k = randnum(&rng, NKEYS);
+        int const op = randnum(&rng, 10);
+        if (op < 5) {
+            assert_ptr_equal(rbht_add(&h, &objs[k]), &objs[k]);
+            present[k] = true;
+        } else if (op < 9) {
+            assert_ptr_equal(rbht_rem(&h, k), present[k] ? &objs[k] : NULL);
+            present[k] = false;
+        } else if (rbt_size(&h.m_tree) > 0) {
+            test_obj_t *const obj = rbht_popmin(&h);
+            assert_true(present[obj->key]);
+            for (int j = 0; j < obj->key; ++j)
+                assert_false(present[j]);
+            present[obj->key] = false;
+        }
+
+        if (i % 256 == 0) {
+            // Both indexes hold the same elements
+            size_t used = 0;
+            for (size_t j = 0; (h.m_slots != NULL) && (j <= h.m_mask); ++j)
+                used += (h.m_slots[j].node != NULL);
+            assert_int_equal(used, rbt_size(&h.m_tree));
+            for (int j = 0; j < NKEYS; ++j) {
+                assert_ptr_equal(rbht_get(&h, j), present[j] ? &objs[j] : NULL);
+                assert_ptr_equal(rbt_get(&h.m_tree, j), present[j] ? &objs[j] : NULL);
+            }
+            check_tree(&h.m_tree);
+        }
+    }
+
+    // Ordered queries go straight to the tree
+    for (int j = 0; j < NKEYS; ++j) {
+        if (!present[j])
+            continue;
+        test_obj_t *const n = rbt_gt(&h.m_tree, j);
+        int k = j + 1;
+        while ((k < NKEYS) && !present[k])
+            ++k;
+        assert_ptr_equal(n, (k < NKEYS) ? &objs[k] : NULL);
+    }
+
+    rbht_destroy(&h);
+    test_free(objs);
+}
+
+typedef struct test_timer test_timer_t;
+struct test_timer {
+    rbtm_t tm;
+    uint64_t fired;     // time it last fired, or UINT64_MAX
+    int rearm;          // ticks to rearm by when it fires, 0 for none
+};
+
+struct timer_ctx {
+    rbt_t *q;
+    uint64_t now;
+    uint64_t last;
+    size_t fired;
+};
+
+static void
+fire_timer(rbtm_t *const tm, void *const ctx)
+{
+    struct timer_ctx *const c = ctx;
+    test_timer_t *const t = (void *)tm;
+    assert_false(rbtm_armed(tm));
+    assert_true(tm->expires <= c->now);
+    // Fired in order of expiry
+    assert_true(tm->expires >= c->last);
+    c->last = tm->expires;
+    t->fired = c->now;
+    ++c->fired;
+    if (t->rearm != 0)
+        rbtm_arm(c->q, tm, c->now + t->rearm);
+}
+
+static void
+check_timers(rbt_t *const q)
+{
+    size_t count = 0;
+    assert_int_equal(q->m_top->color, BLACK);
+    check_subtree(q, q->m_top, &count);
+    assert_int_equal(count, rbt_size(q));
+    if (count == 0)
+        return;
+
+    assert_ptr_equal(q->m_min, tree_minimum(q, q->m_top));
+    assert_ptr_equal(q->m_max, tree_maximum(q, q->m_top));
+    uint64_t prev = 0;
+    for (rbn_t *x = q->m_min; x != &q->m_nil; x = tree_successor(q, x)) {
+        rbtm_t const*const tm = (void *)x;
+        assert_true(tm->expires >= prev);
+        prev = tm->expires;
+    }
+}
+
+static void
+test_split_and_timers(void **state)
+{
+    (void)state;
+    unsigned rng = time(NULL);
+    enum { NKEYS = 1000, NTIMERS = 2000 };
+
+    // Splits of a plain tree at every kind of spot
+    test_obj_t *const objs = test_malloc(sizeof(*objs) * NKEYS);
+    for (int round = 0; round < 50; ++round) {
+        rbt_t tree;
+        rbt_init(&tree);
+        int const n = randnum(&rng, NKEYS);
+        for (int i = 0; i < n; ++i) {
+            objs[i].key = randnum(&rng, 4 * NKEYS);
+            rbt_add(&tree, &objs[i]);
+        }
+        size_t const size = rbt_size(&tree);
+        int const key = randnum(&rng, 4 * NKEYS + 2) - 1;
+
+        size_t taken = 0;
+        int prev = INT_MIN;
+        for (test_obj_t *obj = rbt_split_le(&tree, key); obj != NULL; ) {
+            assert_true(obj->key <= key);
+            assert_true(obj->key > prev);
+            assert_null(obj->nd.p);
+            assert_null(obj->nd.rc);
+            prev = obj->key;
+            ++taken;
+            obj = (obj->nd.lc == NULL) ? NULL :
+                (void *)((unsigned char *)obj->nd.lc - offsetof(test_obj_t, nd));
+        }
+        check_tree(&tree);
+        assert_int_equal(rbt_size(&tree) + taken, size);
+        if (rbt_size(&tree) > 0)
+            assert_true(rbt_min(&tree)->key > key);
+    }
+    test_free(objs);
+
+    // Timers armed, moved, cancelled and fired as time goes by
+    test_timer_t *const timers = test_malloc(sizeof(*timers) * NTIMERS);
+    rbt_t q;
+    rbt_init(&q);
+    assert_int_equal(rbtm_next_expiry(&q), UINT64_MAX);
+    for (int i = 0; i < NTIMERS; ++i) {
+        rbtm_init(&timers[i].tm);
+        timers[i].fired = UINT64_MAX;
+        timers[i].rearm = (i % 10 == 0) ? 1 + randnum(&rng, 50) : 0;
+    }
+
+    struct timer_ctx ctx = { .q = &q };
+    for (uint64_t now = 1; now < 2000; ++now) {
+        for (int j = 0; j < 8; ++j) {
+            test_timer_t *const t = &timers[randnum(&rng, NTIMERS)];
+            int const op = randnum(&rng, 4);
+            if (op == 0) {
+                rbtm_cancel(&q, &t->tm);
+                assert_false(rbtm_armed(&t->tm));
+            } else {
+                // Small moves usually stay between the same neighbours
+                uint64_t const at = (op == 1 && rbtm_armed(&t->tm)) ?
+                    t->tm.expires + randnum(&rng, 3) : now + randnum(&rng, 200);
+                rbtm_arm(&q, &t->tm, at);
+                assert_true(rbtm_armed(&t->tm));
+                assert_int_equal(t->tm.expires, at);
+            }
+        }
+        check_timers(&q);
+
+        ctx.now = now;
+        ctx.last = 0;
+        size_t const fired = ctx.fired;
+        size_t const n = rbtm_expire(&q, now, fire_timer, &ctx);
+        assert_int_equal(n, ctx.fired - fired);
+        assert_true(rbtm_next_expiry(&q) > now);
+        check_timers(&q);
+    }
+
+    // Everything armed is fired by the end of time
+    for (int i = 0; i < NTIMERS; ++i)
+        timers[i].rearm = 0;
+    ctx.now = UINT64_MAX;
+    ctx.last = 0;
+    rbtm_expire(&q, UINT64_MAX, fire_timer, &ctx);
+    assert_int_equal(rbt_size(&q), 0);
+    assert_int_equal(rbtm_next_expiry(&q), UINT64_MAX);
+    check_timers(&q);
+
+    test_free(timers);
+}
+
+// The sum of the keys in a subtree, kept in data2[0]
+static int
+keysum_aug(rbn_t *const x, rbn_t const*const nil)
+{
+    test_obj_t *const obj = (void *)((unsigned char *)x - offsetof(test_obj_t, nd));
+    unsigned sum = (unsigned)obj->key;
+    if (x->lc != nil)
+        sum += ((test_obj_t *)((unsigned char *)x->lc - offsetof(test_obj_t, nd)))->data2[0];
+    if (x->rc != nil)
+        sum += ((test_obj_t *)((unsigned char *)x->rc - offsetof(test_obj_t, nd)))->data2[0];
+    int const changed = (obj->data2[0] != sum);
+    obj->data2[0] = sum;
+    return changed;
+}
+
+static void
+test_rekey(void **state)
+{
+    (void)state;
+    unsigned rng = time(NULL);
+    enum { NOBJ = 500 };
+
+    test_obj_t *const objs = test_malloc(sizeof(*objs) * NOBJ);
+    unsigned seq = 0;
+    unsigned total = 0;
+    rbt_t tree;
+    rbt_init(&tree);
+    rbt_base_augment(&tree, keysum_aug);
+    for (int i = 0; i < NOBJ; ++i) {
+        objs[i].key = randnum(&rng, 2 * NOBJ);
+        objs[i].data1[0] = ++seq;
+        total += (unsigned)objs[i].key;
+        rbt_add_multi(&tree, &objs[i]);
+    }
+    check_multi(&tree);
+
+    for (int i = 0; i < 20 * NOBJ; ++i) {
+        test_obj_t *const obj = &objs[randnum(&rng, NOBJ)];
+        int const key = (i % 3 == 0) ? randnum(&rng, 2 * NOBJ) : obj->key + randnum(&rng, 7) - 3;
+
+        // Whether it can stay put, going after anything equal
+        test_obj_t *const prev = rbt_prev(&tree, obj);
+        test_obj_t *const next = rbt_next(&tree, obj);
+        bool const stays = ((prev == NULL) || (prev->key <= key)) && ((next == NULL) || (key < next->key));
+        rbn_t *const p = obj->nd.p;
+        unsigned const gen = tree.m_gen;
+
+        obj->data1[0] = ++seq;
+        total += (unsigned)key - (unsigned)obj->key;
+        rbt_rekey(&tree, obj, key);
+        assert_int_equal(obj->key, key);
+        assert_true(tree.m_gen != gen);
+        // The key sums are right whether it moved or not
+        assert_int_equal(((test_obj_t *)((unsigned char *)tree.m_top - offsetof(test_obj_t, nd)))->data2[0],
+                         total);
+        if (stays) {
+            assert_ptr_equal(obj->nd.p, p);
+            assert_ptr_equal(rbt_prev(&tree, obj), prev);
+            assert_ptr_equal(rbt_next(&tree, obj), next);
+        }
+        assert_int_equal(rbt_size(&tree), NOBJ);
+        if (i % 32 == 0)
+            check_multi(&tree);
+    }
+    check_multi(&tree);
+
+    test_free(objs);
+}
+
+static void
+check_strings(rbst_t *const t)
+{
+    rbt_t *const tree = &t->m_tree;
+    size_t count = 0;
+    assert_int_equal(tree->m_top->color, BLACK);
+    check_subtree(tree, tree->m_top, &count);
+    assert_int_equal(count, rbt_size(tree));
+    if (count == 0)
+        return;
+
+    assert_ptr_equal(tree->m_min, tree_minimum(tree, tree->m_top));
+    assert_ptr_equal(tree->m_max, tree_maximum(tree, tree->m_top));
+    char const *prev = NULL;
+    for (rbn_t *x = tree->m_min; x != &tree->m_nil; x = tree_successor(tree, x)) {
+        char const*const key = mystrkey(x);
+        if (prev != NULL)
+            assert_true(strcmp(prev, key) < 0);
+        // Every key has the common prefix, and caches its own bytes at the
+        // offset it records
+        assert_memory_equal(key, t->m_common, t->m_skip);
+#ifdef RBTS_PREFIX_CACHE
+        uint32_t const c = (uint32_t)x->reserved;
+        size_t const o = c >> 24;
+        assert_true(o <= strlen(key));
+        for (int j = 0; j < 3; ++j) {
+            assert_int_equal((c >> (16 - 8 * j)) & 0xff, (unsigned char)key[o + j]);
+            if (key[o + j] == '\0')
+                break;
+        }
+#endif
+        prev = key;
+    }
+}
+
+static void
+test_string_keys(void **state)
+{
+    (void)state;
+    unsigned rng = time(NULL);
+    enum { NOBJ = 400 };
+    static char const*const parts[] = { "", "a", "ab", "abc", "abcd", "abcde", "b", "zz", "\xff" };
+
+    test_str_t *const objs = test_malloc(sizeof(*objs) * NOBJ);
+    bool present[NOBJ] = { 0 };
+    // Long shared prefixes first, so the common prefix is cut back later on
+    for (int i = 0; i < NOBJ; ++i) {
+        int const depth = 4 - i * 4 / NOBJ;
+        snprintf(objs[i].name, sizeof(objs[i].name), "%s%s/%s%d",
+                 (depth > 2) ? "https://example.com/" : (depth > 1) ? "https://ex" : (depth > 0) ? "h" : "",
+                 parts[randnum(&rng, 9)], parts[randnum(&rng, 9)], randnum(&rng, 50));
+    }
+
+    rbst_t t;
+    rbts_init(&t);
+    assert_null(rbts_get(&t, "x"));
+    for (int i = 0; i < NOBJ; ++i) {
+        test_str_t *const added = rbts_add(&t, &objs[i]);
+        if (added == &objs[i]) {
+            present[i] = true;
+        } else {
+            assert_string_equal(added->name, objs[i].name);
+        }
+        if (i % 16 == 0)
+            check_strings(&t);
+    }
+    check_strings(&t);
+    assert_true(t.m_skip < strlen("https://example.com/"));
+
+    for (int i = 0; i < NOBJ; ++i) {
+        test_str_t *const g = rbts_get(&t, objs[i].name);
+        assert_non_null(g);
+        assert_string_equal(g->name, objs[i].name);
+        // The generic lookups agree
+        assert_ptr_equal(&g->nd, rbt_base_get(&t.m_tree, objs[i].name, mystrcmp));
+    }
+    assert_null(rbts_get(&t, "https://example.com/nothere"));
+    assert_null(rbts_get(&t, "zzzz"));
+    assert_null(rbts_get(&t, ""));
+
+    for (int i = 0; i < NOBJ; ++i) {
+        if (!present[i])
+            continue;
+        assert_ptr_equal(rbts_rem(&t, objs[i].name), &objs[i]);
+        assert_null(rbts_get(&t, objs[i].name));
+        if (i % 16 == 0)
+            check_strings(&t);
+    }
+    assert_int_equal(rbt_size(&t.m_tree), 0);
+
+    test_free(objs);
+}
+
+// What a walk over part of the tree saw
+typedef struct scan scan_t;
+struct scan {
+    size_t count;
+    long sum;
+    int first;
+    int last;
+    bool ordered;
+};
+
+static void
+scan_visit(rbn_t *const x, void *const ctx)
+{
+    scan_t *const s = ctx;
+    int const key = ((test_obj_t *)((unsigned char *)x - offsetof(test_obj_t, nd)))->key;
+    if (s->count == 0)
+        s->first = key;
+    else if (key < s->last)
+        s->ordered = false;
+    s->last = key;
+    s->sum += key;
+    ++s->count;
+}
+
+// Pieces come to the reduction in key order
+static void
+scan_reduce(void *const acc, void const*const piece)
+{
+    scan_t *const a = acc;
+    scan_t const*const p = piece;
+    if (p->count == 0)
+        return;
+    if (a->count == 0)
+        a->first = p->first;
+    else if (p->first < a->last)
+        a->ordered = false;
+    a->last = p->last;
+    a->sum += p->sum;
+    a->count += p->count;
+    a->ordered = a->ordered && p->ordered;
+}
+
+// Without a reduction every thread updates the same totals
+static void
+scan_visit_shared(rbn_t *const x, void *const ctx)
+{
+    scan_t *const s = ctx;
+    int const key = ((test_obj_t *)((unsigned char *)x - offsetof(test_obj_t, nd)))->key;
+    __atomic_fetch_add(&s->sum, key, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->count, 1, __ATOMIC_RELAXED);
+}
+
+static void
+test_parallel_for_each(void **state)
+{
+    (void)state;
+    unsigned rng = time(NULL);
+    enum { NOBJ = 3000 };
+
+    test_obj_t *const objs = test_malloc(sizeof(*objs) * NOBJ);
+    rbt_t tree;
+    rbt_init(&tree);
+
+    scan_t s = { .ordered = true };
+    assert_int_equal(rbt_parallel_for_each(&tree, NULL, NULL, scan_visit, &s, sizeof(s), scan_reduce, 4), 0);
+    assert_int_equal(s.count, 0);
+
+    for (int i = 0; i < NOBJ; ++i) {
+        objs[i].key = randnum(&rng, NOBJ);
+        rbt_add_multi(&tree, &objs[i]);
+    }
+
+    for (int i = 0; i < 200; ++i) {
+        int lo = randnum(&rng, NOBJ + 20) - 10;
+        int hi = randnum(&rng, NOBJ + 20) - 10;
+        int const*const plo = (i % 5 == 1) ? NULL : &lo;
+        int const*const phi = (i % 7 == 2) ? NULL : &hi;
+        unsigned const nthreads = 1 + i % 6;
+
+        // What a sequential walk sees
+        scan_t want = { .ordered = true };
+        test_obj_t *x = (plo != NULL) ? rbt_lower_bound(&tree, lo) : rbt_min(&tree);
+        for (; (x != NULL) && ((phi == NULL) || (x->key < hi)); x = rbt_next(&tree, x))
+            scan_visit(&x->nd, &want);
+
+        scan_t got = { .ordered = true };
+        assert_int_equal(rbt_parallel_for_each(&tree, plo, phi, scan_visit, &got, sizeof(got),
+                                               scan_reduce, nthreads), 0);
+        assert_true(got.ordered);
+        assert_int_equal(got.count, want.count);
+        assert_int_equal(got.sum, want.sum);
+        if (want.count > 0) {
+            assert_int_equal(got.first, want.first);
+            assert_int_equal(got.last, want.last);
+        }
+
+        scan_t shared = { .ordered = true };
+        assert_int_equal(rbt_parallel_for_each(&tree, plo, phi, scan_visit_shared, &shared,
+                                               sizeof(shared), NULL, nthreads), 0);
+        assert_int_equal(shared.count, want.count);
+        assert_int_equal(shared.sum, want.sum);
+    }
+
+    test_free(objs);
+}
+
+// Both trees have the same shape and colors, with equal keys in each place
+static void
+check_same_shape(rbt_t const*const a, rbn_t const*const x, rbt_t const*const b, rbn_t const*const y)
+{
+    if (x == &a->m_nil) {
+        assert_ptr_equal(y, &b->m_nil);
+        return;
+    }
+    assert_ptr_not_equal(y, &b->m_nil);
+    assert_ptr_not_equal(x, y);
+    assert_int_equal(x->color, y->color);
+    assert_int_equal(((test_obj_t *)((unsigned char *)x - offsetof(test_obj_t, nd)))->key,
+                     ((test_obj_t *)((unsigned char *)y - offsetof(test_obj_t, nd)))->key);
+    check_same_shape(a, x->lc, b, y->lc);
+    check_same_shape(a, x->rc, b, y->rc);
+}
+
+static void
+free_obj(rbn_t *const x, void *const ctx)
+{
+    (void)ctx;
+    test_free((unsigned char *)x - offsetof(test_obj_t, nd));
+}
+
+static void
+test_clone(void **state)
+{
+    (void)state;
+    unsigned rng = time(NULL);
+    enum { NOBJ = 1000 };
+
+    test_obj_t *const objs = test_malloc(sizeof(*objs) * NOBJ);
+    rbt_t src, dst;
+    rbt_init(&src);
+    rbt_init(&dst);
+
+    assert_int_equal(rbt_clone(&dst, &src, NOBJ), 0);
+    check_tree(&dst);
+
+    int count = 0;
+    for (int i = 0; i < NOBJ; ++i) {
+        objs[i].key = randnum(&rng, 10 * NOBJ);
+        if (rbt_add(&src, &objs[i]) == &objs[i])
+            ++count;
+        // Clone every shape a small tree goes through
+        if (i < 40) {
+            unsigned const gen = dst.m_gen;
+            assert_int_equal(rbt_clone(&dst, &src, NOBJ), 0);
+            assert_true(dst.m_gen != gen);
+            check_tree(&dst);
+            check_same_shape(&src, src.m_top, &dst, dst.m_top);
+            rbt_base_clear(&dst, free_obj, NULL);
+        }
+    }
+
+    assert_int_equal(rbt_clone(&dst, &src, NOBJ), 0);
+    check_tree(&dst);
+    check_same_shape(&src, src.m_top, &dst, dst.m_top);
+
+    // The copy doesn't change along with the original
+    while (rbt_size(&src) > (size_t)count / 2)
+        rbt_popmin(&src);
+    check_tree(&src);
+    check_tree(&dst);
+    assert_int_equal(rbt_size(&dst), count);
+    rbt_base_clear(&dst, free_obj, NULL);
+
+    // Running out part way leaves nothing behind
+    for (int budget = 0; budget < 50; budget += 7) {
+        int left = budget;
+        assert_int_equal(rbt_base_clone(&dst, &src, mycopy, myfree, &left), -1);
+        assert_int_equal(left, budget);
+        check_tree(&dst);
+    }
+
+    // Into a buffer, in pre-order
+    test_obj_t *const buf = test_malloc(sizeof(*buf) * rbt_size(&src));
+    rbt_clone_into(&dst, &src, buf);
+    check_tree(&dst);
+    check_same_shape(&src, src.m_top, &dst, dst.m_top);
+    assert_ptr_equal(dst.m_top, &buf[0].nd);
+    assert_ptr_equal(dst.m_top->lc, &buf[1].nd);
+
+    test_free(buf);
+    test_free(objs);
+}
+
+static void
+test_int_keys(void **state)
+{
+    (void)state;
+    unsigned rng = time(NULL);
+    enum { NOBJ = 2000 };
+
+    test_obj_t *const objs = test_malloc(sizeof(*objs) * NOBJ);
+    bool present[2 * NOBJ] = { 0 };
+    rbt_t tree;
+    rbt_init(&tree);
+
+    // The children by name and by direction are the same
+    assert_ptr_equal(&objs[0].nd.ch[0], &objs[0].nd.lc);
+    assert_ptr_equal(&objs[0].nd.ch[1], &objs[0].nd.rc);
+
+    assert_null(rbt_get_int(&tree, 0));
+    for (int i = 0; i < NOBJ; ++i) {
+        objs[i].key = randnum(&rng, 2 * NOBJ);
+        test_obj_t *const added = rbt_add_int(&tree, &objs[i]);
+        if (present[objs[i].key]) {
+            assert_ptr_not_equal(added, &objs[i]);
+            assert_int_equal(added->key, objs[i].key);
+        } else {
+            assert_ptr_equal(added, &objs[i]);
+            present[objs[i].key] = true;
+        }
+        if (i % 64 == 0)
+            check_tree(&tree);
+    }
+    check_tree(&tree);
+
+    for (int k = -1; k <= 2 * NOBJ; ++k) {
+        test_obj_t *const g = rbt_get_int(&tree, k);
+        assert_ptr_equal(g, rbt_get(&tree, k));
+        assert_true((g != NULL) == ((k >= 0) && (k < 2 * NOBJ) && present[k]));
+    }
+
+    // Deleting goes through the folded fixup
+    for (int k = 0; k < 2 * NOBJ; k += 2) {
+        if (present[k])
+            assert_non_null(rbt_rem(&tree, k));
+    }
+    check_tree(&tree);
+    for (int k = 0; k < 2 * NOBJ; ++k)
+        assert_true((rbt_get_int(&tree, k) != NULL) == ((k % 2 == 1) && present[k]));
+
+    test_free(objs);
+}
+
+// Matches keys below a threshold, out of every hundred, and checks that
+// matches leave the tree in ascending order
+struct sweep {
+    int pct;
+    int last;
+    size_t removed;
+};
+
+static int
+sweep_pred(rbn_t const*const x, void *const ctx)
+{
+    struct sweep const*const sw = ctx;
+    test_obj_t const*const obj = (void const*)((unsigned char const*)x - offsetof(test_obj_t, nd));
+    return obj->key % 100 < sw->pct;
+}
+
+static void
+sweep_removed(rbn_t *const x, void *const ctx)
+{
+    struct sweep *const sw = ctx;
+    test_obj_t *const obj = (void *)((unsigned char *)x - offsetof(test_obj_t, nd));
+    assert_null(x->p);
+    assert_true(obj->key % 100 < sw->pct);
+    assert_true(obj->key > sw->last);
+    sw->last = obj->key;
+    ++sw->removed;
+    test_free(obj);
+}
+
+// Matches keys from `from` on
+struct suffix {
+    int from;
+    size_t removed;
+};
+
+static int
+suffix_pred(rbn_t const*const x, void *const ctx)
+{
+    test_obj_t const*const obj = (void const*)((unsigned char const*)x - offsetof(test_obj_t, nd));
+    return obj->key >= ((struct suffix const*)ctx)->from;
+}
+
+static void
+suffix_removed(rbn_t *const x, void *const ctx)
+{
+    ++((struct suffix *)ctx)->removed;
+    test_free((unsigned char *)x - offsetof(test_obj_t, nd));
+}
+
+static void
+test_remove_if(void **state)
+{
+    (void)state;
+    unsigned rng = time(NULL);
+
+    static int const sizes[] = { 0, 1, 5, 100, 3000 };
+    static int const pcts[] = { 0, 1, 5, 30, 70, 100 };
+    for (size_t si = 0; si < sizeof(sizes) / sizeof(sizes[0]); ++si) {
+        for (size_t pi = 0; pi < sizeof(pcts) / sizeof(pcts[0]); ++pi) {
+            rbt_t tree;
+            rbt_init(&tree);
+            size_t want = 0;
+            for (int i = 0; i < sizes[si]; ++i) {
+                test_obj_t *const obj = test_malloc(sizeof(*obj));
+                obj->key = randnum(&rng, 100000);
+                if (rbt_add(&tree, obj) != obj) {
+                    test_free(obj);
+                    continue;
+                }
+                want += (obj->key % 100 < pcts[pi]);
+            }
+            size_t const size = rbt_size(&tree);
+
+            struct sweep sw = { pcts[pi], -1, 0 };
+            assert_int_equal(rbt_base_remove_if(&tree, sweep_pred, sweep_removed, &sw), want);
+            assert_int_equal(sw.removed, want);
+            assert_int_equal(rbt_size(&tree), size - want);
+            check_tree(&tree);
+            for (test_obj_t *obj = rbt_min(&tree); obj != NULL; obj = rbt_next(&tree, obj))
+                assert_true(obj->key % 100 >= pcts[pi]);
+
+            size_t destroyed = 0;
+            rbt_base_clear(&tree, destroy_obj, &destroyed);
+            assert_int_equal(destroyed, size - want);
+        }
+    }
+
+    // Nothing after the first match survives, every cut of small trees
+    for (int size = 1; size <= 40; ++size) {
+        for (int from = 0; from <= size; ++from) {
+            rbt_t tree;
+            rbt_init(&tree);
+            for (int i = 0; i < size; ++i) {
+                test_obj_t *const obj = test_malloc(sizeof(*obj));
+                obj->key = i;
+                rbt_add(&tree, obj);
+            }
+            struct suffix sf = { from, 0 };
+            assert_int_equal(rbt_base_remove_if(&tree, suffix_pred, suffix_removed, &sf), size - from);
+            assert_int_equal(sf.removed, size - from);
+            check_tree(&tree);
+
+            size_t destroyed = 0;
+            rbt_base_clear(&tree, destroy_obj, &destroyed);
+            assert_int_equal(destroyed, from);
+        }
+    }
+}
+
+// Check the subtree sizes and return the size
+static size_t
+check_counts(rbt_t const*const tree, rbn_t const*const x)
+{
+    if (x == &tree->m_nil)
+        return 0;
+    size_t const n = check_counts(tree, x->lc) + 1 + check_counts(tree, x->rc);
+    assert_int_equal(rbq_sample_of(x)->count, n);
+    return n;
+}
+
+__attribute__((pure))
+static int
+sample_keycmp(void const*const key, rbn_t const*const r)
+{
+    uint64_t const k = *(uint64_t const*)key;
+    return (k > rbq_sample_of(r)->value) - (k < rbq_sample_of(r)->value);
+}
+
+static int
+odd_sample(rbn_t const*const x, void *const ctx)
+{
+    (void)ctx;
+    return rbq_sample_of(x)->value & 1;
+}
+
+static int
+cmp_u64(void const*const l, void const*const r)
+{
+    uint64_t const a = *(uint64_t const*)l;
+    uint64_t const b = *(uint64_t const*)r;
+    return (a > b) - (a < b);
+}
+
+static void
+test_quantiles(void **state)
+{
+    (void)state;
+    unsigned rng = time(NULL);
+    enum { CAP = 50 };
+
+    rbq_t q;
+    assert_int_equal(rbq_init(&q, CAP), 0);
+    assert_null(rbq_quantile(&q, 0.5));
+
+    uint64_t window[CAP];
+    for (unsigned i = 0; i < 500; ++i) {
+        uint64_t const v = randnum(&rng, 20);
+        window[i % CAP] = v;
+        rbq_add(&q, v);
+        size_t const n = (i < CAP) ? i + 1 : CAP;
+        assert_int_equal(rbq_size(&q), n);
+        assert_int_equal(check_counts(&q.m_tree, q.m_tree.m_top), n);
+
+        uint64_t sorted[CAP];
+        memcpy(sorted, window, sizeof(sorted[0]) * n);
+        qsort(sorted, n, sizeof(sorted[0]), cmp_u64);
+        for (size_t k = 0; k < n; ++k)
+            assert_int_equal(rbq_select(&q, k)->value, sorted[k]);
+        assert_null(rbq_select(&q, n));
+
+        assert_ptr_equal(rbq_quantile(&q, 0), rbq_select(&q, 0));
+        assert_ptr_equal(rbq_quantile(&q, 1), rbq_select(&q, n - 1));
+        assert_ptr_equal(rbq_quantile(&q, 0.5), rbq_select(&q, (n + 1) / 2 - 1));
+        assert_ptr_equal(rbq_quantile(&q, 0.99), rbq_select(&q, (99 * n + 99) / 100 - 1));
+
+        // Equal values are in arrival order
+        size_t const oldest = (i < CAP) ? 0 : q.m_next;
+        rbq_sample_t const *prev = rbq_select(&q, 0);
+        for (size_t k = 1; k < n; ++k) {
+            rbq_sample_t const*const s = rbq_select(&q, k);
+            if (s->value == prev->value)
+                assert_true((s - q.m_ring + CAP - oldest) % CAP > (prev - q.m_ring + CAP - oldest) % CAP);
+            prev = s;
+        }
+    }
+
+    // Bulk removal keeps the counts
+    size_t odd = 0;
+    for (size_t k = 0; k < CAP; ++k)
+        odd += window[k] & 1;
+    assert_int_equal(rbt_base_remove_if(&q.m_tree, odd_sample, NULL, NULL), odd);
+    assert_int_equal(check_counts(&q.m_tree, q.m_tree.m_top), CAP - odd);
+
+    // So do the regular inserts, which recount on their own
+    for (size_t k = 0; k < CAP; ++k) {
+        if (q.m_ring[k].nd.p == NULL)
+            rbt_base_add_multi(&q.m_tree, &q.m_ring[k].nd, rbq_cmp);
+    }
+    assert_int_equal(check_counts(&q.m_tree, q.m_tree.m_top), CAP);
+    for (size_t k = 0; k + 1 < CAP; ++k)
+        assert_true(rbq_select(&q, k)->value <= rbq_select(&q, k + 1)->value);
+
+    // And splitting, which joins what is left back together
+    uint64_t const cut = rbq_select(&q, CAP / 2)->value;
+    size_t taken = 0;
+    for (rbn_t *x = rbt_base_split_le(&q.m_tree, &cut, sample_keycmp); x != NULL; x = x->lc)
+        ++taken;
+    assert_int_equal(check_counts(&q.m_tree, q.m_tree.m_top), CAP - taken);
+    if (taken < CAP)
+        assert_true(rbq_select(&q, 0)->value > cut);
+
+    rbq_destroy(&q);
+}
+
+
+typedef struct replica replica_t;
+struct replica {
+    rbmn_t mn;
+    int key;
+    int value;
+};
+
+__attribute__((pure))
+static inline replica_t *
+replica_of(rbn_t const*const n)
+{
+    return (replica_t *)((unsigned char *)rbm_of(n) - offsetof(replica_t, mn));
+}
+
+__attribute__((pure))
+static int
+replica_cmp(rbn_t const*const l, rbn_t const*const r)
+{
+    return (replica_of(l)->key > replica_of(r)->key) - (replica_of(l)->key < replica_of(r)->key);
+}
+
+__attribute__((pure))
+static int
+replica_keycmp(void const*const key, rbn_t const*const r)
+{
+    int const k = *(int const*)key;
+    return (k > replica_of(r)->key) - (k < replica_of(r)->key);
+}
+
+__attribute__((pure))
+static uint64_t
+replica_digest(rbn_t const*const n)
+{
+    uint64_t z = ((uint64_t)(unsigned)replica_of(n)->key << 32) + (unsigned)replica_of(n)->value;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9u;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebu;
+    return z ^ (z >> 31);
+}
+
+// How each key differed: 1 only in a, 2 only in b, 3 in both
+static void
+replica_diff(rbn_t *const a, rbn_t *const b, void *const ctx)
+{
+    int *const seen = ctx;
+    int const key = (a != NULL) ? replica_of(a)->key : replica_of(b)->key;
+    if ((a != NULL) && (b != NULL))
+        assert_int_equal(replica_of(a)->key, replica_of(b)->key);
+    assert_int_equal(seen[key], 0);
+    seen[key] = (a != NULL) | ((b != NULL) << 1);
+}
+
+static void
+test_merkle_diff(void **state)
+{
+    (void)state;
+    unsigned rng = time(NULL);
+    enum { KEYS = 2000 };
+
+    static replica_t as[KEYS], bs[KEYS];
+    static int want[KEYS], seen[KEYS];
+    rbt_t a, b;
+    rbm_init(&a);
+    rbm_init(&b);
+    assert_int_equal(rbt_base_diff(&a, &b, replica_cmp, replica_diff, seen), 0);
+
+    // The same contents from different histories, so different shapes
+    for (int k = 0; k < KEYS; ++k) {
+        as[k].key = bs[k].key = k;
+        as[k].value = bs[k].value = randnum(&rng, 1000);
+        as[k].mn.nd.p = bs[k].mn.nd.p = NULL;
+    }
+    static int order[KEYS];
+    for (int i = 0; i < KEYS; ++i)
+        order[i] = i;
+    for (int i = KEYS - 1; i > 0; --i) {
+        int const j = randnum(&rng, i + 1);
+        int const t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+    for (int i = 0; i < KEYS; ++i) {
+        rbm_base_add(&a, &as[i].mn, replica_cmp, replica_digest);
+        rbm_base_add(&b, &bs[order[i]].mn, replica_cmp, replica_digest);
+    }
+    size_t na, nb;
+    assert_int_equal(rbm_sum(&a, &na), rbm_sum(&b, &nb));
+    assert_int_equal(na, KEYS);
+    assert_int_equal(nb, KEYS);
+    assert_int_equal(rbt_base_diff(&a, &b, replica_cmp, replica_diff, seen), 0);
+
+    // Drop some from each side and change some values in place
+    size_t diffs = 0;
+    for (int round = 0; round < 60; ++round) {
+        int const k = randnum(&rng, KEYS);
+        if (want[k] != 0)
+            continue;
+        switch (randnum(&rng, 3)) {
+        case 0:
+            rb_base_delete(&a, &as[k].mn.nd);
+            want[k] = 2;
+            break;
+        case 1:
+            rb_base_delete(&b, &bs[k].mn.nd);
+            want[k] = 1;
+            break;
+        default:
+            ++bs[k].value;
+            rbm_base_update(&b, &bs[k].mn, replica_digest);
+            want[k] = 3;
+            break;
+        }
+        ++diffs;
+    }
+    assert_int_equal(rbt_base_diff(&a, &b, replica_cmp, replica_diff, seen), diffs);
+    assert_memory_equal(seen, want, sizeof(seen));
+
+    // Range sums and selection against the elements in order
+    assert_null(rbm_select(&a, rbt_size(&a)));
+    for (int i = 0; i < 200; ++i) {
+        int lo = randnum(&rng, KEYS + 1);
+        int hi = randnum(&rng, KEYS + 1);
+        if (lo > hi) {
+            int const t = lo;
+            lo = hi;
+            hi = t;
+        }
+        uint64_t sum = 0;
+        size_t count = 0, before = 0;
+        for (int k = 0; k < hi; ++k) {
+            if (as[k].mn.nd.p == NULL)
+                continue;
+            if (k < lo) {
+                ++before;
+            } else {
+                sum += as[k].mn.digest;
+                ++count;
+            }
+        }
+        size_t got;
+        assert_int_equal(rbm_base_range(&a, &lo, &hi, replica_keycmp, &got), sum);
+        assert_int_equal(got, count);
+        if (count > 0)
+            assert_int_equal(replica_of(rbm_select(&a, before))->key, replica_of(rbt_base_lower_bound(&a, &lo, replica_keycmp))->key);
+    }
+    size_t got;
+    assert_int_equal(rbm_base_range(&a, NULL, NULL, replica_keycmp, &got), rbm_sum(&a, &na));
+    assert_int_equal(got, na);
+}
+
+typedef struct item item_t;
+struct item {
+    rbsn_t sn;
+    int value;
+};
+
+__attribute__((pure))
+static inline item_t *
+item_of(rbn_t const*const n)
+{
+    return (item_t *)((unsigned char *)rbs_of(n) - offsetof(item_t, sn));
+}
+
+// Check a sequence's shape and sizes against the values it should hold
+static void
+check_seq(rbs_t *const seq, int const*const want, size_t const n)
+{
+    rbt_t *const tree = &seq->m_forest->m_work;
+    rbn_t *const nil = &tree->m_nil;
+    size_t count = 0;
+    assert_int_equal(seq->m_top->color, BLACK);
+    check_subtree(tree, seq->m_top, &count);
+    assert_int_equal(count, n);
+    assert_int_equal(rbs_size(seq), n);
+    if (n == 0) {
+        assert_ptr_equal(seq->m_top, nil);
+        assert_ptr_equal(seq->m_min, nil);
+        assert_ptr_equal(seq->m_max, nil);
+        assert_null(rbs_at(seq, 0));
+        return;
+    }
+
+    assert_ptr_equal(seq->m_top->p, nil);
+    assert_ptr_equal(seq->m_min, tree_minimum(tree, seq->m_top));
+    assert_ptr_equal(seq->m_max, tree_maximum(tree, seq->m_top));
+    rbn_t *x = seq->m_min;
+    for (size_t i = 0; i < n; ++i, x = rbs_next(seq, x)) {
+        assert_int_equal(rbs_of(x)->count, rbs_count(x->lc, nil) + 1 + rbs_count(x->rc, nil));
+        assert_int_equal(item_of(x)->value, want[i]);
+        assert_ptr_equal(rbs_at(seq, i), x);
+        assert_int_equal(rbs_index(seq, x), i);
+    }
+    assert_null(x);
+    assert_null(rbs_at(seq, n));
+}
+
+static void
+test_sequence(void **state)
+{
+    (void)state;
+    unsigned rng = time(NULL);
+    enum { CAP = 400 };
+
+    static item_t items[CAP];
+    static int want[CAP], tmp[CAP];
+    rbsf_t forest;
+    rbsf_init(&forest);
+    rbs_t seq, tail;
+    rbs_init(&seq, &forest);
+    rbs_init(&tail, &forest);
+    check_seq(&seq, want, 0);
+    assert_null(rbs_remove_at(&seq, 0));
+
+    size_t n = 0, used = 0;
+    for (int round = 0; round < 2000; ++round) {
+        int const op = randnum(&rng, 10);
+        if ((op < 5) && (used < CAP)) {
+            // Insert somewhere, the end included
+            size_t const i = randnum(&rng, n + 1);
+            item_t *const it = &items[used];
+            it->value = used++;
+            rbs_insert_at(&seq, i, &it->sn);
+            memmove(&want[i + 1], &want[i], sizeof(want[0]) * (n - i));
+            want[i] = it->value;
+            ++n;
+        } else if ((op < 8) && (n > 0)) {
+            size_t const i = randnum(&rng, n);
+            rbn_t *const x = rbs_remove_at(&seq, i);
+            assert_int_equal(item_of(x)->value, want[i]);
+            memmove(&want[i], &want[i + 1], sizeof(want[0]) * (n - i - 1));
+            --n;
+            // Put it back at the end, so there are always items to hand
+            rbs_insert_at(&seq, n, rbs_of(x));
+            want[n++] = item_of(x)->value;
+        } else {
+            // Rotate the sequence by splitting it and joining the tail on first
+            size_t const i = randnum(&rng, n + 1);
+            rbs_split(&seq, i, &tail);
+            check_seq(&seq, want, i);
+            check_seq(&tail, want + i, n - i);
+            rbs_concat(&tail, &seq);
+            check_seq(&seq, want, 0);
+            memcpy(tmp, want + i, sizeof(want[0]) * (n - i));
+            memcpy(tmp + n - i, want, sizeof(want[0]) * i);
+            memcpy(want, tmp, sizeof(want[0]) * n);
+            seq = tail;
+            rbs_init(&tail, &forest);
+        }
+        check_seq(&seq, want, n);
+    }
+
+    // Joining runs of every size, each way round
+    for (size_t l = 0; l < 40; ++l) {
+        for (size_t r = 0; r < 40; ++r) {
+            rbs_init(&seq, &forest);
+            rbs_init(&tail, &forest);
+            for (size_t i = 0; i < l + r; ++i) {
+                items[i].value = i;
+                want[i] = i;
+                rbs_insert_at((i < l) ? &seq : &tail, (i < l) ? i : i - l, &items[i].sn);
+            }
+            rbs_concat(&seq, &tail);
+            check_seq(&tail, want, 0);
+            check_seq(&seq, want, l + r);
+        }
+    }
+}
+
+static void
+test_hot_keys(void **state)
+{
+    (void)state;
+    unsigned rng = time(NULL);
+    enum { KEYS = 200 };
+
+    rbhk_t h;
+    assert_int_equal(rbhk_init(&h, 0), -1);
+    // Few enough sets that keys compete for them
+    assert_int_equal(rbhk_init(&h, 6), 0);
+    assert_int_equal(h.m_mask, 7);
+    assert_null(rbhk_get(&h, 1));
+
+    static test_obj_t objs[KEYS];
+    for (int i = 0; i < KEYS; ++i) {
+        objs[i].key = i;
+        assert_ptr_equal(rbhk_add(&h, &objs[i]), &objs[i]);
+    }
+    assert_ptr_equal(rbhk_add(&h, &objs[3]), &objs[3]);
+    rbhk_stats_reset(&h);
+
+    // Skewed lookups, some of keys that aren't there
+    rbhk_stats_t st;
+    for (int i = 0; i < 5000; ++i) {
+        int const key = (randnum(&rng, 4) != 0) ? randnum(&rng, 8) : randnum(&rng, KEYS + 50);
+        assert_ptr_equal(rbhk_get(&h, key), (key < KEYS) ? &objs[key] : NULL);
+    }
+    rbhk_stats(&h, &st);
+    assert_int_equal(st.hits + st.misses, 5000);
+    assert_true(st.hits > st.misses);
+    assert_int_equal(st.flushes, 0);
+
+    // Removing through the cache keeps it
+    assert_ptr_equal(rbhk_rem(&h, 2), &objs[2]);
+    assert_null(rbhk_rem(&h, 2));
+    rbhk_base_delete(&h, &objs[5].nd, myhash);
+    for (int i = 0; i < 100; ++i) {
+        int const key = randnum(&rng, 8);
+        assert_ptr_equal(rbhk_get(&h, key), ((key == 2) || (key == 5)) ? NULL : &objs[key]);
+    }
+    assert_ptr_equal(rbhk_add(&h, &objs[2]), &objs[2]);
+    assert_ptr_equal(rbhk_get(&h, 2), &objs[2]);
+    rbhk_stats(&h, &st);
+    assert_int_equal(st.flushes, 0);
+    check_tree(&h.m_tree);
+
+    // Changing the tree behind its back empties it
+    rbhk_stats_reset(&h);
+    assert_ptr_equal(rbt_rem(&h.m_tree, 1), &objs[1]);
+    assert_null(rbhk_get(&h, 1));
+    assert_ptr_equal(rbhk_get(&h, 0), &objs[0]);
+    rbhk_stats(&h, &st);
+    assert_int_equal(st.flushes, 1);
+    assert_int_equal(st.hits, 0);
+
+    rbhk_destroy(&h);
+}
 int main(void) {
 
     const struct CMUnitTest tests[] = {
@@ -267,6 +2352,28 @@ int main(void) {
         cmocka_unit_test(test_add_twice),
         cmocka_unit_test(test_find_nearest),
         cmocka_unit_test(test_next_and_prev),
+        cmocka_unit_test(test_relayout),
+        cmocka_unit_test(test_traversal),
+        cmocka_unit_test(test_dump_and_load),
+        cmocka_unit_test(test_offset_tree),
+        cmocka_unit_test(test_stats_and_shape),
+        cmocka_unit_test(test_multiset),
+        cmocka_unit_test(test_find_or_insert),
+        cmocka_unit_test(test_cursor),
+        cmocka_unit_test(test_relaxed),
+        cmocka_unit_test(test_wavl),
+        cmocka_unit_test(test_hash_index),
+        cmocka_unit_test(test_split_and_timers),
+        cmocka_unit_test(test_rekey),
+        cmocka_unit_test(test_string_keys),
+        cmocka_unit_test(test_parallel_for_each),
+        cmocka_unit_test(test_clone),
+        cmocka_unit_test(test_int_keys),
+        cmocka_unit_test(test_remove_if),
+        cmocka_unit_test(test_quantiles),
+        cmocka_unit_test(test_merkle_diff),
+        cmocka_unit_test(test_sequence),
+        cmocka_unit_test(test_hot_keys),
     };
     return cmocka_run_group_tests(tests, NULL, NULL);
 }
@@ -1,6 +1,20 @@
 #pragma once
 
+// The tests run with the hot path counters compiled in
+#define RBT_STATS
+
 #include "rbtree.h"
+#include "rbtfile.h"
+#include "rbotree.h"
+#include "wavltree.h"
+#include "rbhash.h"
+#include "rbtimer.h"
+#include "rbtstr.h"
+#include "rbtpar.h"
+#include "rbquantile.h"
+#include "rbmerkle.h"
+#include "rbseq.h"
+#include "rbhot.h"
 
 typedef struct test_obj test_obj_t;
 struct test_obj {
@@ -56,6 +70,31 @@ rbt_add(rbt_t *const tree, test_obj_t *const obj)
 
     return (void *)((unsigned char *)v - offsetof(test_obj_t, nd));
 }
+__attribute__((pure))
+static inline int64_t
+mykeyof(rbn_t const*const n)
+{
+    return ((test_obj_t const*)((unsigned char const*)n - offsetof(test_obj_t, nd)))->key;
+}
+
+static inline test_obj_t *
+rbt_add_int(rbt_t *const tree, test_obj_t *const obj)
+{
+    rbn_t *v = rbt_base_add_int(tree, &obj->nd, mykeyof);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(test_obj_t, nd));
+}
+
+static inline test_obj_t *
+rbt_get_int(rbt_t *const tree, int key)
+{
+    rbn_t *v = rbt_base_get_int(tree, key, mykeyof);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(test_obj_t, nd));
+}
+
 static inline test_obj_t *
 rbt_get(rbt_t *const tree, int key)
 {
@@ -103,6 +142,297 @@ rbt_gt(rbt_t *const tree, int key)
     return (void *)((unsigned char *)v - offsetof(test_obj_t, nd));
 }
 
+static inline void
+rbt_add_multi(rbt_t *const tree, test_obj_t *const obj)
+{
+    rbt_base_add_multi(tree, &obj->nd, mycmp);
+}
+
+static inline void
+rbt_rekey(rbt_t *const tree, test_obj_t *const obj, int key)
+{
+    obj->key = key;
+    rbt_base_rekey(tree, &obj->nd, mycmp);
+}
+
+static inline test_obj_t *
+rbt_lower_bound(rbt_t *const tree, int key)
+{
+    test_key_t const k = {
+        key,
+    };
+    rbn_t *v = rbt_base_lower_bound(tree, &k, mykeycmp);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(test_obj_t, nd));
+}
+
+static inline int
+rbt_equal_range(rbt_t *const tree, int key, test_obj_t **const p_first, test_obj_t **const p_end)
+{
+    test_key_t const k = {
+        key,
+    };
+    rbn_t *first, *end;
+    int const rc = rbt_base_equal_range(tree, &k, mykeycmp, &first, &end);
+    *p_first = (first == NULL) ? NULL : (void *)((unsigned char *)first - offsetof(test_obj_t, nd));
+    *p_end = (end == NULL) ? NULL : (void *)((unsigned char *)end - offsetof(test_obj_t, nd));
+    return rc;
+}
+
+static inline size_t
+rbt_count(rbt_t *const tree, int key)
+{
+    test_key_t const k = {
+        key,
+    };
+    return rbt_base_count(tree, &k, mykeycmp);
+}
+
+static inline test_obj_t *
+rbt_rem_one(rbt_t *const tree, int key)
+{
+    test_key_t const k = {
+        key,
+    };
+    rbn_t *v = rbt_base_rem_one(tree, &k, mykeycmp);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(test_obj_t, nd));
+}
+
+static inline size_t
+rbt_rem_all(rbt_t *const tree, int key, rbtvisit_t const removed, void *const ctx)
+{
+    test_key_t const k = {
+        key,
+    };
+    return rbt_base_rem_all(tree, &k, mykeycmp, removed, ctx);
+}
+
+// Builds an element for the key and counts the calls in ctx, a negative count
+// makes it fail instead
+static inline rbn_t *
+mymake(void const*const key, void *const ctx)
+{
+    int *const p_made = ctx;
+    if (*p_made < 0)
+        return NULL;
+    ++*p_made;
+    test_obj_t *const obj = test_malloc(sizeof(*obj));
+    obj->key = ((test_key_t const*)key)->key;
+    return &obj->nd;
+}
+
+static inline test_obj_t *
+rbt_find_or_insert(rbt_t *const tree, int key, int *const p_made)
+{
+    test_key_t const k = {
+        key,
+    };
+    rbn_t *v = rbt_base_find_or_insert(tree, &k, mykeycmp, mymake, p_made);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(test_obj_t, nd));
+}
+
+static inline void
+rbt_insert_before(rbt_t *const tree, test_obj_t *const cursor, test_obj_t *const obj)
+{
+    rbt_base_insert_before(tree, (cursor == NULL) ? NULL : &cursor->nd, &obj->nd);
+}
+
+static inline void
+rbt_insert_after(rbt_t *const tree, test_obj_t *const cursor, test_obj_t *const obj)
+{
+    rbt_base_insert_after(tree, (cursor == NULL) ? NULL : &cursor->nd, &obj->nd);
+}
+
+static inline test_obj_t *
+rbt_remove_at(rbt_t *const tree, test_obj_t *const cursor)
+{
+    rbn_t *v = rbt_base_remove_at(tree, &cursor->nd);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(test_obj_t, nd));
+}
+
+static inline test_obj_t *
+rbt_finger(rbt_t *const tree, test_obj_t *const cursor, int key)
+{
+    test_key_t const k = {
+        key,
+    };
+    rbn_t *v = rbt_base_finger(tree, &cursor->nd, &k, mykeycmp);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(test_obj_t, nd));
+}
+
+static inline test_obj_t *
+rbt_add_relaxed(rbt_t *const tree, test_obj_t *const obj)
+{
+    rbn_t *v = rbt_base_add_relaxed(tree, &obj->nd, mycmp);
+    return (void *)((unsigned char *)v - offsetof(test_obj_t, nd));
+}
+
+static inline test_obj_t *
+rbt_rem_relaxed(rbt_t *const tree, int key)
+{
+    test_key_t const k = {
+        key,
+    };
+    rbn_t *v = rbt_base_rem_relaxed(tree, &k, mykeycmp);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(test_obj_t, nd));
+}
+
+static inline test_obj_t *
+wavl_add(wavl_t *const w, test_obj_t *const obj)
+{
+    rbn_t *v = wavl_base_add(w, &obj->nd, mycmp);
+    return (void *)((unsigned char *)v - offsetof(test_obj_t, nd));
+}
+
+static inline test_obj_t *
+wavl_rem(wavl_t *const w, int key)
+{
+    test_key_t const k = {
+        key,
+    };
+    rbn_t *v = wavl_base_rem(w, &k, mykeycmp);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(test_obj_t, nd));
+}
+
+static inline test_obj_t *
+wavl_popmin(wavl_t *const w)
+{
+    rbn_t *v = wavl_base_popmin(w);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(test_obj_t, nd));
+}
+
+// Deliberately weak so that probe runs get long
+__attribute__((pure))
+static inline size_t
+mykeyhash(void const*const key)
+{
+    test_key_t const*const k = key;
+    return (size_t)k->key / 4;
+}
+
+__attribute__((pure))
+static inline size_t
+myhash(rbn_t const*const n)
+{
+    test_obj_t const*const o = (void *)((unsigned char *)n - offsetof(test_obj_t, nd));
+    return (size_t)o->key / 4;
+}
+
+static inline test_obj_t *
+rbht_add(rbht_t *const h, test_obj_t *const obj)
+{
+    rbn_t *v = rbht_base_add(h, &obj->nd, mycmp, myhash);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(test_obj_t, nd));
+}
+
+static inline test_obj_t *
+rbht_get(rbht_t *const h, int key)
+{
+    test_key_t const k = {
+        key,
+    };
+    rbn_t *v = rbht_base_get(h, &k, mykeyhash, mykeycmp);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(test_obj_t, nd));
+}
+
+static inline test_obj_t *
+rbht_rem(rbht_t *const h, int key)
+{
+    test_key_t const k = {
+        key,
+    };
+    rbn_t *v = rbht_base_rem(h, &k, mykeyhash, mykeycmp);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(test_obj_t, nd));
+}
+
+static inline test_obj_t *
+rbht_popmin(rbht_t *const h)
+{
+    rbn_t *v = rbht_base_popmin(h, myhash);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(test_obj_t, nd));
+}
+
+static inline test_obj_t *
+rbhk_add(rbhk_t *const h, test_obj_t *const obj)
+{
+    rbn_t *v = rbhk_base_add(h, &obj->nd, mycmp);
+    return (void *)((unsigned char *)v - offsetof(test_obj_t, nd));
+}
+
+static inline test_obj_t *
+rbhk_get(rbhk_t *const h, int key)
+{
+    test_key_t const k = {
+        key,
+    };
+    rbn_t *v = rbhk_base_get(h, &k, mykeyhash, mykeycmp);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(test_obj_t, nd));
+}
+
+static inline test_obj_t *
+rbhk_rem(rbhk_t *const h, int key)
+{
+    test_key_t const k = {
+        key,
+    };
+    rbn_t *v = rbhk_base_rem(h, &k, mykeyhash, mykeycmp);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(test_obj_t, nd));
+}
+
+// Visit the elements with keys in [lo, hi), a NULL bound leaves that end open
+static inline int
+rbt_parallel_for_each(rbt_t *const tree, int const*const lo, int const*const hi, rbtvisit_t visit,
+                      void *const state, size_t const size, rbtreduce_t const reduce, unsigned const nthreads)
+{
+    test_key_t const klo = {
+        (lo != NULL) ? *lo : 0,
+    };
+    test_key_t const khi = {
+        (hi != NULL) ? *hi : 0,
+    };
+    return rbt_base_parallel_for_each(tree, (lo != NULL) ? &klo : NULL, (hi != NULL) ? &khi : NULL,
+                                      mykeycmp, visit, state, size, reduce, nthreads);
+}
+
+static inline test_obj_t *
+rbt_split_le(rbt_t *const tree, int key)
+{
+    test_key_t const k = {
+        key,
+    };
+    rbn_t *v = rbt_base_split_le(tree, &k, mykeycmp);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(test_obj_t, nd));
+}
+
 static inline test_obj_t *
 rbt_popmin(rbt_t *const tree)
 {
@@ -156,3 +486,210 @@ rbt_next(rbt_t *const tree, test_obj_t *const obj)
 
     return (void *)((unsigned char *)v - offsetof(test_obj_t, nd));
 }
+
+static inline rbn_t *
+mymove(void *const dst, rbn_t *const src)
+{
+    test_obj_t *const d = dst;
+    *d = *(test_obj_t *)((unsigned char *)src - offsetof(test_obj_t, nd));
+    return &d->nd;
+}
+
+static inline void
+rbt_relayout(rbt_t *const tree, test_obj_t *const buf)
+{
+    rbt_base_relayout(tree, buf, sizeof(*buf), mymove);
+}
+
+static inline void
+rbt_clone_into(rbt_t *const dst, rbt_t const*const src, test_obj_t *const buf)
+{
+    rbt_base_clone_into(dst, src, buf, sizeof(*buf), mymove);
+}
+
+// Copies onto the test heap until the budget runs out
+static inline rbn_t *
+mycopy(rbn_t const*const x, void *const ctx)
+{
+    int *const budget = ctx;
+    if (*budget == 0)
+        return NULL;
+    --*budget;
+
+    test_obj_t *const obj = test_malloc(sizeof(*obj));
+    *obj = *(test_obj_t const*)((unsigned char const*)x - offsetof(test_obj_t, nd));
+    return &obj->nd;
+}
+
+static inline void
+myfree(rbn_t *const x, void *const ctx)
+{
+    int *const budget = ctx;
+    ++*budget;
+    test_free((unsigned char *)x - offsetof(test_obj_t, nd));
+}
+
+// Clone with at most `budget` copies, which are freed again on failure
+static inline int
+rbt_clone(rbt_t *const dst, rbt_t const*const src, int budget)
+{
+    return rbt_base_clone(dst, src, mycopy, myfree, &budget);
+}
+
+static inline size_t
+myenc(rbn_t const*const x, void *const buf, size_t const cap, void *const ctx)
+{
+    (void)ctx;
+    test_obj_t const*const obj = (void *)((unsigned char *)x - offsetof(test_obj_t, nd));
+    if (cap >= sizeof(obj->key))
+        memcpy(buf, &obj->key, sizeof(obj->key));
+    return sizeof(obj->key);
+}
+
+// Makes elements on the test heap until the budget runs out
+static inline rbn_t *
+mydec(void const*const rec, size_t const len, void *const ctx)
+{
+    int *const budget = ctx;
+    if (*budget == 0)
+        return NULL;
+    --*budget;
+
+    test_obj_t *const obj = test_malloc(sizeof(*obj));
+    assert_int_equal(len, sizeof(obj->key));
+    memcpy(&obj->key, rec, sizeof(obj->key));
+    return &obj->nd;
+}
+
+static inline int
+rbt_dump(rbt_t *const tree, FILE *const fp)
+{
+    return rbt_base_dump(tree, fp, myenc, NULL);
+}
+
+// Load with at most `budget` elements made, which are freed again on failure
+static inline int
+rbt_load(rbt_t *const tree, int const fd, int budget)
+{
+    return rbt_base_load(tree, fd, mydec, myfree, &budget);
+}
+
+// Element of an offset linked tree, which lives in the same region as the tree
+typedef struct test_oobj test_oobj_t;
+struct test_oobj {
+    int key;
+    rbon_t nd;
+};
+
+__attribute__((pure))
+static inline int
+myocmp(rbon_t const*const ln, rbon_t const*const rn)
+{
+    test_oobj_t const*const l = (void *)((unsigned char *)ln - offsetof(test_oobj_t, nd));
+    test_oobj_t const*const r = (void *)((unsigned char *)rn - offsetof(test_oobj_t, nd));
+    return (l->key > r->key) - (l->key < r->key);
+}
+
+__attribute__((pure))
+static inline int
+myokeycmp(void const*const key, rbon_t const*const rn)
+{
+    test_key_t const*const l = key;
+    test_oobj_t const*const r = (void *)((unsigned char *)rn - offsetof(test_oobj_t, nd));
+    return (l->key > r->key) - (l->key < r->key);
+}
+
+static inline test_oobj_t *
+rbot_add(rbot_t *const tree, test_oobj_t *const obj)
+{
+    rbon_t *v = rbot_base_add(tree, &obj->nd, myocmp);
+    return (void *)((unsigned char *)v - offsetof(test_oobj_t, nd));
+}
+
+static inline test_oobj_t *
+rbot_get(rbot_t *const tree, int key)
+{
+    test_key_t const k = {
+        key,
+    };
+    rbon_t *v = rbot_base_get(tree, &k, myokeycmp);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(test_oobj_t, nd));
+}
+
+static inline test_oobj_t *
+rbot_rem(rbot_t *const tree, int key)
+{
+    test_key_t const k = {
+        key,
+    };
+    rbon_t *v = rbot_base_rem(tree, &k, myokeycmp);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(test_oobj_t, nd));
+}
+
+static inline test_oobj_t *
+rbot_min(rbot_t *const tree)
+{
+    rbon_t *v = rbot_base_min(tree);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(test_oobj_t, nd));
+}
+
+static inline test_oobj_t *
+rbot_next(rbot_t *const tree, test_oobj_t *const obj)
+{
+    rbon_t *v = rbot_base_next(tree, &obj->nd);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(test_oobj_t, nd));
+}
+
+typedef struct test_str test_str_t;
+struct test_str {
+    rbn_t nd;
+    char name[48];
+};
+
+__attribute__((pure))
+static inline char const*
+mystrkey(rbn_t const*const n)
+{
+    test_str_t const*const s = (void *)((unsigned char *)n - offsetof(test_str_t, nd));
+    return s->name;
+}
+
+__attribute__((pure))
+static inline int
+mystrcmp(void const*const key, rbn_t const*const n)
+{
+    return strcmp(key, mystrkey(n));
+}
+
+static inline test_str_t *
+rbts_add(rbst_t *const t, test_str_t *const obj)
+{
+    rbn_t *v = rbts_base_add(t, &obj->nd, mystrkey);
+    return (void *)((unsigned char *)v - offsetof(test_str_t, nd));
+}
+
+static inline test_str_t *
+rbts_get(rbst_t *const t, char const*const key)
+{
+    rbn_t *v = rbts_base_get(t, key, mystrkey);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(test_str_t, nd));
+}
+
+static inline test_str_t *
+rbts_rem(rbst_t *const t, char const*const key)
+{
+    rbn_t *v = rbts_base_rem(t, key, mystrkey);
+    if (v == NULL) return NULL;
+
+    return (void *)((unsigned char *)v - offsetof(test_str_t, nd));
+}
@@ -0,0 +1,250 @@
+#pragma once
+
+#include "rbtree.h"
+
+/*
+ * Weak AVL engine over the same node and tree types. Only insertion and
+ * deletion differ from the red-black tree, so lookups, bounds, iteration and
+ * the traversals in rbtree.h all work on the `m_tree` of a wavl_t. The tree
+ * is wrapped so that it can't be handed to the red-black mutators by mistake,
+ * which would take the ranks for colors; changes go through wavl_base_*.
+ *
+ * Each node keeps its rank in `color`, and the sentinel has rank -1. Every
+ * rank difference between a parent and a child is 1 or 2, and every leaf has
+ * rank 0. Without deletes the tree is an AVL tree, so its height is at most
+ * 1.44 log2(n), and a delete does at most two rotations, with the demotions
+ * above it amortised O(1).
+ */
+
+typedef struct weak_avl_tree wavl_t;
+struct weak_avl_tree {
+    rbt_t m_tree;
+};
+
+static inline void
+wavl_init(wavl_t *const w)
+{
+    rbt_init(&w->m_tree);
+    w->m_tree.m_nil.color = -1;
+}
+
+// x has just been given the same rank as its parent
+static inline void
+wavl_insert_fixup(rbt_t *const tree, rbn_t *x)
+{
+    rbn_t *p = x->p;
+    while ((p != &tree->m_nil) && (p->color == x->color)) {
+        int const left = (x == p->lc);
+        rbn_t *const s = left ? p->rc : p->lc;
+        if (p->color - s->color == 1) {
+            ++p->color;
+            RBT_STAT_ADD(tree, ins_fixups, 1);
+            x = p;
+            p = x->p;
+            continue;
+        }
+
+        // The sibling is a 2-child, one or two rotations finish it
+        rbn_t *const y = left ? x->rc : x->lc;
+        if (x->color - y->color == 2) {
+            if (left)
+                right_rotate(tree, p);
+            else
+                left_rotate(tree, p);
+        } else {
+            if (left) {
+                left_rotate(tree, x);
+                right_rotate(tree, p);
+            } else {
+                right_rotate(tree, x);
+                left_rotate(tree, p);
+            }
+            ++y->color;
+            --x->color;
+        }
+        --p->color;
+        break;
+    }
+}
+
+static inline rbn_t *
+wavl_base_add(wavl_t *const w, rbn_t *const z, rbtcmp_t const cmpfunc)
+{
+    rbt_t *const tree = &w->m_tree;
+    rbn_t *y = &tree->m_nil;
+    rbn_t *x = tree->m_top;
+    int cmp = 0;
+    RBT_STAT_ADD(tree, descents, 1);
+    while (x != &tree->m_nil) {
+        y = x;
+        RBT_STAT_ADD(tree, depth, 1);
+        RBT_STAT_ADD(tree, cmps, 1);
+        cmp = cmpfunc(z, x);
+        if (cmp < 0)
+            x = x->lc;
+        else if (cmp > 0)
+            x = x->rc;
+        else
+            return x;
+    }
+
+    rb_attach_node(tree, z, y, cmp < 0);
+    z->color = 0;
+    if (y != &tree->m_nil)
+        wavl_insert_fixup(tree, z);
+
+    ++tree->m_size;
+    ++tree->m_gen;
+
+    return z;
+}
+
+/*
+ * x has taken the place of a removed node under p and may be nil. When both of
+ * p's children are nil it doesn't matter which side x is on.
+ */
+static inline void
+wavl_delete_fixup(rbt_t *const tree, rbn_t *x, rbn_t *p)
+{
+    rbn_t *const nil = &tree->m_nil;
+    if (p == nil)
+        return;
+
+    // A leaf must have rank 0
+    if ((p->lc == nil) && (p->rc == nil) && (p->color == 1)) {
+        p->color = 0;
+        RBT_STAT_ADD(tree, del_fixups, 1);
+        x = p;
+        p = x->p;
+    }
+
+    while ((p != nil) && (p->color - x->color == 3)) {
+        int const left = (x == p->lc);
+        rbn_t *const y = left ? p->rc : p->lc;
+        RBT_STAT_ADD(tree, del_fixups, 1);
+        if (p->color - y->color == 2) {
+            --p->color;
+        } else if ((y->color - y->lc->color == 2) && (y->color - y->rc->color == 2)) {
+            --p->color;
+            --y->color;
+        } else {
+            // y is a 1-child with a 1-child, one or two rotations finish it
+            rbn_t *const v = left ? y->lc : y->rc;
+            rbn_t *const w = left ? y->rc : y->lc;
+            if (y->color - w->color == 1) {
+                if (left)
+                    left_rotate(tree, p);
+                else
+                    right_rotate(tree, p);
+                ++y->color;
+                --p->color;
+                if ((p->lc == nil) && (p->rc == nil))
+                    --p->color;
+            } else {
+                if (left) {
+                    right_rotate(tree, y);
+                    left_rotate(tree, p);
+                } else {
+                    left_rotate(tree, y);
+                    right_rotate(tree, p);
+                }
+                v->color += 2;
+                --y->color;
+                p->color -= 2;
+            }
+            return;
+        }
+        x = p;
+        p = x->p;
+    }
+}
+
+static inline void
+wavl_base_delete(wavl_t *const w, rbn_t *const z)
+{
+    rbt_t *const tree = &w->m_tree;
+    if (z == tree->m_min) {
+        tree->m_min = (z->rc != &tree->m_nil) ? z->rc : z->p;
+    }
+    if (z == tree->m_max) {
+        tree->m_max = (z->lc != &tree->m_nil) ? z->lc : z->p;
+    }
+
+    rbn_t *x;
+    rbn_t *xp;
+    if (z->lc == &tree->m_nil) {
+        x = z->rc;
+        xp = z->p;
+        rb_transplant(tree, z, z->rc);
+    } else if (z->rc == &tree->m_nil) {
+        x = z->lc;
+        xp = z->p;
+        rb_transplant(tree, z, z->lc);
+    } else {
+        rbn_t *const y = tree_minimum(tree, z->rc);
+        x = y->rc;
+        if (y->p == z) {
+            xp = y;
+        } else {
+            xp = y->p;
+            rb_transplant(tree, y, y->rc);
+            y->rc = z->rc;
+            y->rc->p = y;
+        }
+        rb_transplant(tree, z, y);
+        y->lc = z->lc;
+        y->lc->p = y;
+        y->color = z->color;
+    }
+
+    wavl_delete_fixup(tree, x, xp);
+
+    z->p = NULL;
+    z->rc = NULL;
+    z->lc = NULL;
+
+    tree->m_size--;
+    tree->m_gen++;
+}
+
+static inline rbn_t *
+wavl_base_rem(wavl_t *const w, void const*const key, rbtkeycmp_t cmpfunc)
+{
+    rbn_t *const x = rb_find_node_by_key(&w->m_tree, key, cmpfunc);
+
+    if (x == NULL) {
+        return NULL;
+    }
+
+    wavl_base_delete(w, x);
+
+    return x;
+}
+
+static inline rbn_t *
+wavl_base_popmin(wavl_t *const w)
+{
+    rbn_t *const x = w->m_tree.m_min;
+
+    if (x == &w->m_tree.m_nil) {
+        return NULL;
+    }
+
+    wavl_base_delete(w, x);
+
+    return x;
+}
+
+static inline rbn_t *
+wavl_base_popmax(wavl_t *const w)
+{
+    rbn_t *const x = w->m_tree.m_max;
+
+    if (x == &w->m_tree.m_nil) {
+        return NULL;
+    }
+
+    wavl_base_delete(w, x);
+
+    return x;
+}